@@ -0,0 +1,424 @@
+#include "StdAfx.h"
+#include "BatchRunner.h"
+#include <algorithm>
+
+BatchRunner::BatchRunner(void)
+{
+	this->input = ImageSource::AVI;
+	this->convertGray = false;
+	this->runChecks = false;
+	this->validatePyramids = false;
+	this->fixedPoint = -1;
+	this->stream = -1;
+	this->aaDecimate = -1;
+	this->maxFrames = 0;
+	this->reportEvery = 100;
+}
+
+BatchRunner::~BatchRunner(void)
+{
+}
+
+void BatchRunner::printUsage()
+{
+	printf("usage: SIFT_tracking [config file] [--key value ...]\n");
+	printf("  --input avi|dir|y4m|usb  kind of source (avi)\n");
+	printf("  --source path            video file, image directory or Y4M clip\n");
+	printf("  --box x,y,w,h            initial box of a target, once per target\n");
+	printf("  --out file               result file, \"frame,target,x,y,width,height,confidence\" lines\n");
+	printf("  --images dir             write the painted frames as JPEGs\n");
+	printf("  --frames n               track at most n frames (0: all)\n");
+	printf("  --report n               progress every n frames (0: none)\n");
+	printf("  --config file            read \"key value\" lines, # starts a comment\n");
+	printf("  --convert file.y4m       convert the AVI source instead of tracking\n");
+	printf("  --gray 1                 convert to a gray-only clip\n");
+	printf("  --check 1                run the detector's self-checks instead of tracking\n");
+	printf("  --fixed_point 0|1        16-bit fixed-point pyramid (%d)\n", SIFT_FIXED_POINT);
+	printf("  --stream 0|1             stream row bands through the pyramid (%d)\n", SIFT_STREAM);
+	printf("  --aa_decimate 0|1        average 2x2 blocks between octaves (%d)\n", SIFT_AA_DECIMATE);
+	printf("  --validate 1             compare fixed-point with float features on every frame\n");
+	printf("without arguments the tracker runs interactively\n");
+}
+
+//////////////////////////////////////////////////////////////////////////
+// settings
+
+bool BatchRunner::set(const std::string& key, const std::string& value)
+{
+	int x, y, w, h;
+
+	if (key == "input")
+	{
+		if (value == "avi")
+			input = ImageSource::AVI;
+		else if (value == "dir")
+			input = ImageSource::DIRECTORY;
+		else if (value == "y4m")
+			input = ImageSource::Y4M;
+		else if (value == "usb")
+			input = ImageSource::USB;
+		else
+		{
+			printf("unknown input %s\n", value.c_str());
+			return false;
+		}
+	}
+	else if (key == "source")
+		source = value;
+	else if (key == "out")
+		output = value;
+	else if (key == "images")
+		imageDir = value;
+	else if (key == "box")
+	{
+		if (sscanf(value.c_str(), "%d,%d,%d,%d", &x, &y, &w, &h) != 4 || w <= 0 || h <= 0)
+		{
+			printf("bad box %s, expected x,y,w,h\n", value.c_str());
+			return false;
+		}
+		boxes.push_back(Rect(y,x,h,w));
+	}
+	else if (key == "frames")
+		maxFrames = atoi(value.c_str());
+	else if (key == "report")
+		reportEvery = atoi(value.c_str());
+	else if (key == "config")
+		return readConfig(value.c_str());
+	else if (key == "convert")
+		convertTo = value;
+	else if (key == "gray")
+		convertGray = (atoi(value.c_str()) != 0);
+	else if (key == "check")
+		runChecks = (atoi(value.c_str()) != 0);
+	else if (key == "fixed_point")
+		fixedPoint = (atoi(value.c_str()) != 0);
+	else if (key == "stream")
+		stream = (atoi(value.c_str()) != 0);
+	else if (key == "aa_decimate")
+		aaDecimate = (atoi(value.c_str()) != 0);
+	else if (key == "validate")
+		validatePyramids = (atoi(value.c_str()) != 0);
+	else
+	{
+		printf("unknown setting %s\n", key.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool BatchRunner::parseArgs(int argc, char** argv)
+{
+	for (int i=1;i<argc;i++)
+	{
+		if (strncmp(argv[i],"--",2) != 0)
+		{
+			/* a bare argument names a config file */
+			if (!readConfig(argv[i]))
+				return false;
+			continue;
+		}
+		if (i+1 >= argc)
+		{
+			printf("%s needs a value\n", argv[i]);
+			return false;
+		}
+		if (!set(argv[i]+2, argv[i+1]))
+			return false;
+		i++;
+	}
+	if (runChecks)
+		return true;
+	if (source.empty() && input != ImageSource::USB)
+	{
+		printf("no source given\n");
+		return false;
+	}
+	if (!convertTo.empty())
+	{
+		if (input != ImageSource::AVI)
+		{
+			printf("only AVI sources can be converted\n");
+			return false;
+		}
+		return true;
+	}
+	if (boxes.empty() && !validatePyramids)
+	{
+		printf("no initial box given\n");
+		return false;
+	}
+	return true;
+}
+
+bool BatchRunner::readConfig(const char* filename)
+{
+	FILE* file = fopen(filename, "r");
+	char line[1024];
+	std::string text, key, value;
+	size_t end, split;
+	int lineNumber = 0;
+
+	if (file == NULL)
+	{
+		printf("cannot read config file %s\n", filename);
+		return false;
+	}
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		lineNumber++;
+		text = line;
+		end = text.find('#');
+		if (end != std::string::npos)
+			text.erase(end);
+		/* "key value" or "key = value"; values may contain spaces */
+		split = text.find_first_of(" \t=");
+		key = text.substr(0, split);
+		key.erase(key.find_last_not_of(" \t\r\n")+1);
+		key.erase(0, key.find_first_not_of(" \t"));
+		if (key.empty())
+			continue;
+		value = (split == std::string::npos) ? "" : text.substr(split);
+		value.erase(0, value.find_first_not_of(" \t="));
+		value.erase(value.find_last_not_of(" \t\r\n")+1);
+		if (!set(key, value))
+		{
+			printf("  in %s line %d\n", filename, lineNumber);
+			fclose(file);
+			return false;
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// running
+
+ImageSource* BatchRunner::openSource(ImageSource::InputDevice input, const char* source,
+	ImagePool* pool, ImageSourcePrefetch** prefetch)
+{
+	ImageSource* imageSource;
+
+	*prefetch = NULL;
+	switch (input)
+	{
+	case ImageSource::AVI:
+		imageSource = new ImageSourceAVIFile(source);
+		break;
+	case ImageSource::DIRECTORY:
+		/* decodes ahead on its own threads, and reads index.txt if the directory has one */
+		imageSource = new ImageSourceDirCached(source, NULL, DIR_DECODE_THREADS,
+			DIR_DECODE_AHEAD, (size_t)DIR_CACHE_MB*1024*1024);
+		break;
+	case ImageSource::USB:
+		imageSource = new ImageSourceUSBCam();
+		break;
+	case ImageSource::Y4M:
+		/* mapped clip, converted once with ImageSourceY4M::convertAVI */
+		imageSource = new ImageSourceY4M(source, pool);
+		break;
+	default:
+		return NULL;
+	}
+#if FRAME_PREFETCH_DEPTH>0
+	/* decode the video while the previous frame is tracked */
+	if (input == ImageSource::AVI)
+		*prefetch = new ImageSourcePrefetch(imageSource, FRAME_PREFETCH_DEPTH, true, pool);
+#endif
+	/* capture a live camera on its own thread, dropping frames the tracker cannot keep up with */
+	if (input == ImageSource::USB)
+		*prefetch = new ImageSourcePrefetch(imageSource, LIVE_QUEUE_DEPTH, true, pool, LIVE_DROP_POLICY);
+	if (*prefetch != NULL)
+		imageSource = *prefetch;
+	return imageSource;
+}
+
+int BatchRunner::run()
+{
+	int frames;
+
+	if (runChecks)
+	{
+		/* the SIMD rows against OpenCV and against their scalar code */
+		return check_decimation();
+	}
+	if (!convertTo.empty())
+	{
+		printf("converting %s to %s...\n", source.c_str(), convertTo.c_str());
+		frames = ImageSourceY4M::convertAVI(source.c_str(), convertTo.c_str(), convertGray);
+		if (frames < 0)
+		{
+			printf("conversion failed\n");
+			return 1;
+		}
+		printf("%d frames written\n", frames);
+		return 0;
+	}
+
+	ImagePool* framePool = new ImagePool((size_t)IMAGE_POOL_MAX_MB*1024*1024);
+	ImageSourcePrefetch* prefetch;
+	ImageSource* imageSource = openSource(input, source.c_str(), framePool, &prefetch);
+	ImageHandler* imageSequence = new ImageHandler(imageSource, framePool);
+	/* the trackers' overlay is only recorded when frames are saved */
+	imageSequence->setDrawing(!imageDir.empty());
+	if (!imageSequence->getImage())
+	{
+		printf("cannot read a frame from %s\n", source.c_str());
+		delete imageSequence;
+		delete imageSource;
+		delete framePool;
+		return 1;
+	}
+
+	Rect wholeImage;
+	wholeImage = imageSequence->getImageSize();
+	struct sift_options tmplOpts;
+	init_sift_options( &tmplOpts );
+	tmplOpts.img_dbl = SIFT_IMG_DBL_ADAPTIVE;
+	tmplOpts.pool = framePool;
+	if (fixedPoint >= 0)
+		tmplOpts.fixed_point = fixedPoint;
+	if (stream >= 0)
+		tmplOpts.stream = stream;
+	if (aaDecimate >= 0)
+		tmplOpts.aa_decimate = aaDecimate;
+	if (validatePyramids)
+	{
+		frames = validate(imageSequence, &tmplOpts);
+		delete imageSequence;
+		delete imageSource;
+		delete framePool;
+		return (frames > 0) ? 0 : 1;
+	}
+	MultiTargetTracker* tracker = new MultiTargetTracker(wholeImage,&tmplOpts);
+	for (int i=0;i<(int)boxes.size();i++)
+	{
+		if (!boxes[i].isValid(wholeImage))
+		{
+			printf("box %d,%d,%d,%d is outside the %dx%d frame, skipped\n", boxes[i].left,
+				boxes[i].upper, boxes[i].width, boxes[i].height, wholeImage.width, wholeImage.height);
+			continue;
+		}
+		tracker->addTarget(imageSequence,boxes[i]);
+	}
+
+	/* encodes frames and writes the log on its own threads */
+	ResultWriter* writer = new ResultWriter(output.c_str(), imageDir.c_str(), framePool,
+		RESULT_WRITER_THREADS, RESULT_WRITER_QUEUE, RESULT_LOG_BATCH);
+	writer->writeTargets(0, tracker);
+
+	/* wall time of every frame, reading and tracking */
+	std::vector<double> frameTimes;
+	double start, frameStart, readTime = 0.0, trackTime = 0.0;
+	double latency, latencySum = 0.0, latencyMax = 0.0;
+	int live = tracker->getNumTargets();
+
+	start = wallTime();
+	frames = 0;
+	while (live > 0 && (maxFrames <= 0 || frames < maxFrames))
+	{
+		frameStart = wallTime();
+		if (!imageSequence->getImage())
+			break;
+		readTime += wallTime() - frameStart;
+		live = tracker->track(imageSequence);
+		trackTime += wallTime() - frameStart;
+		frames++;
+		writer->writeTargets(frames, tracker);
+		if (writer->writesFrames())
+			writer->writeFrame(frames, imageSequence->getPaintedImage());
+		frameTimes.push_back(wallTime() - frameStart);
+		/* capture to result */
+		if (prefetch != NULL)
+		{
+			latency = wallTime() - prefetch->getCaptureTime();
+			latencySum += latency;
+			latencyMax = MAX(latencyMax, latency);
+		}
+		if (reportEvery > 0 && frames % reportEvery == 0)
+			printf("frame %d, %d targets, %.1f fps\n", frames, live, frames/(wallTime()-start));
+	}
+	double elapsed = wallTime() - start;
+	trackTime -= readTime;
+	if (live == 0)
+		printf("all targets lost after frame %d\n", frames);
+
+	printf("tracked %d frames of %d targets in %.2f s, %.1f fps\n", frames,
+		tracker->getNumTargets(), elapsed, (elapsed > 0.0) ? frames/elapsed : 0.0);
+	if (frames > 0)
+	{
+		std::sort(frameTimes.begin(), frameTimes.end());
+		printf("per frame: mean %.2f ms (read %.2f, track %.2f), median %.2f, 95%% %.2f, max %.2f ms\n",
+			elapsed/frames*1000, readTime/frames*1000, trackTime/frames*1000,
+			frameTimes[frames/2]*1000, frameTimes[MIN(frames-1, frames*95/100)]*1000,
+			frameTimes[frames-1]*1000);
+	}
+	printf("targets lost: %d of %d\n", tracker->getNumTargets()-tracker->getNumLive(), tracker->getNumTargets());
+	printf("SIFT detection on %d of %d frames\n", tracker->getNumDetections(), tracker->getNumFrames());
+	if (prefetch != NULL)
+	{
+		printf("prefetch: %d stalls, %d frames dropped\n", prefetch->getNumStalls(), prefetch->getNumDropped());
+		if (frames > 0)
+			printf("latency: queue %.2f ms (max %.2f), end to end %.2f ms (max %.2f)\n",
+				prefetch->getMeanQueueLatency()*1000, prefetch->getMaxQueueLatency()*1000,
+				latencySum/frames*1000, latencyMax*1000);
+	}
+	if (writer->writesFrames())
+		printf("result frames: %d written, %d stalls, %d dropped\n", writer->getNumFrames(),
+			writer->getNumStalls(), writer->getNumDropped());
+	printf("image pool: %d hits, %d misses, %d failures, %d unpooled, peak %d KB\n", framePool->getNumHits(),
+		framePool->getNumMisses(), framePool->getNumFailures(), framePool->getNumUnpooled(),
+		(int)(framePool->getPeakBytes()/1024));
+
+	/* waits for the queued results */
+	delete writer;
+	delete tracker;
+	/* the handler's frame views go back to the source */
+	delete imageSequence;
+	delete imageSource;
+	delete framePool;
+	return 0;
+}
+
+/*
+Detects features on every frame with the float and with the fixed-point
+pyramid, otherwise with the options given, and prints the fraction of
+float features the fixed-point pyramid repeats and their mean descriptor
+distance.
+
+@return the number of frames compared
+*/
+int BatchRunner::validate(ImageHandler* imageSequence, const struct sift_options* opts)
+{
+	struct sift_options floatOpts = *opts, fixedOpts = *opts;
+	double repeat, descrDist, repeatSum = 0.0, descrSum = 0.0, worst = 1.0;
+	int frames = 0, floatFeats = 0, fixedFeats = 0;
+
+	/* only the whole-level detector builds fixed-point pyramids */
+	floatOpts.stream = fixedOpts.stream = 0;
+	floatOpts.fixed_point = 0;
+	fixedOpts.fixed_point = 1;
+	do
+	{
+		SIFT_feature floatFeat(imageSequence->getIplGrayImage(), &floatOpts);
+		SIFT_feature fixedFeat(imageSequence->getIplGrayImage(), &fixedOpts);
+
+		repeat = feature_repeatability(&floatFeat, &fixedFeat, SIFT_REPEAT_DIST, &descrDist);
+		frames++;
+		floatFeats += floatFeat.GetLength();
+		fixedFeats += fixedFeat.GetLength();
+		repeatSum += repeat;
+		descrSum += descrDist;
+		worst = MIN(worst, repeat);
+		if (reportEvery > 0 && frames % reportEvery == 0)
+			printf("frame %d: %d float, %d fixed-point features, %.1f%% repeated, descriptor distance %.3f\n",
+				frames, floatFeat.GetLength(), fixedFeat.GetLength(), repeat*100, descrDist);
+	}
+	while ((maxFrames <= 0 || frames < maxFrames) && imageSequence->getImage());
+
+	printf("validated %d frames: %.1f float and %.1f fixed-point features per frame\n",
+		frames, (double)floatFeats/frames, (double)fixedFeats/frames);
+	printf("fixed-point repeats %.1f%% of the float features (worst frame %.1f%%), "
+		"mean descriptor distance %.3f\n", repeatSum/frames*100, worst*100, descrSum/frames);
+	return frames;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "MultiTargetTracker.h"
+#include "ImagePool.h"
+#include "ResultWriter.h"
+#include <string>
+#include <vector>
+
+/*
+Tracks a sequence without HighGUI: the source and the initial boxes come
+from the command line or a config file, frames are tracked as fast as they
+can be read, the boxes of every frame go to a result file (and the frames
+as painted to a directory, if wanted) and throughput statistics are
+printed at the end.  Settings are key/value pairs, given
+as "--key value" arguments or as "key value" lines of a config file:
+
+	input   avi, dir, y4m or usb
+	source  video file, directory or Y4M clip
+	box     x,y,w,h of a target's initial box; repeat for more targets
+	out     result file, CSV lines "frame,target,x,y,width,height,confidence"
+	        per target and frame
+	images  directory to write the painted frames to as JPEGs
+	frames  frames to track at most, 0 for all
+	report  frames between progress lines, 0 for none
+	config  config file to read settings from
+	convert Y4M file to write from the AVI source instead of tracking
+	gray    1 to convert to a gray-only clip
+	check   1 to run the detector's self-checks instead of tracking; the
+	        exit code is the number of failed cases
+	fixed_point, stream, aa_decimate
+	        1 or 0 to override the detector's SIFT_FIXED_POINT, SIFT_STREAM
+	        and SIFT_AA_DECIMATE defaults
+	validate
+	        1 to detect features on every frame with both the float and the
+	        fixed-point pyramid and print how well the fixed-point features
+	        repeat the float ones, instead of tracking
+*/
+class BatchRunner
+{
+public:
+	BatchRunner(void);
+	~BatchRunner(void);
+	bool parseArgs(int argc, char** argv);
+	bool readConfig(const char* filename);
+	int run();
+	static void printUsage();
+
+	/* the source of a tracking run, wrapped for prefetching where it helps;
+	*prefetch is the wrapper, NULL if there is none */
+	static ImageSource* openSource(ImageSource::InputDevice input, const char* source,
+		ImagePool* pool, ImageSourcePrefetch** prefetch);
+
+private:
+	bool set(const std::string& key, const std::string& value);
+	int validate(ImageHandler* imageSequence, const struct sift_options* opts);
+
+	ImageSource::InputDevice input;
+	std::string source;
+	std::string output;
+	std::string imageDir;
+	std::string convertTo;
+	bool convertGray;
+	bool runChecks;
+	bool validatePyramids;
+	/* detector options given, -1 where the default stands */
+	int fixedPoint;
+	int stream;
+	int aaDecimate;
+	std::vector<Rect> boxes;
+	int maxFrames;
+	int reportEvery;
+};
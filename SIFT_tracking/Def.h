@@ -16,6 +16,14 @@ enum feature_match_type
 	FEATURE_MDL_MATCH,
 };
 
+/** MOTION_TRANSLATION <BR> MOTION_SIMILARITY <BR> MOTION_AFFINE */
+enum motion_model
+{
+	MOTION_TRANSLATION,
+	MOTION_SIMILARITY,
+	MOTION_AFFINE,
+};
+
 /*define Pi*/
 #define PI 3.1415926
 
@@ -43,6 +51,18 @@ enum feature_match_type
 /** double image size before pyramid construction? */
 #define SIFT_IMG_DBL 1
 
+/** img_dbl value that picks the base scale and octave count from the object size */
+#define SIFT_IMG_DBL_ADAPTIVE -1
+
+/* adaptive scale range: objects whose short side is below this are doubled */
+#define SIFT_ADAPT_DBL_SIZE 160
+
+/* adaptive scale range: objects whose short side is above this start at half size */
+#define SIFT_ADAPT_HALF_SIZE 640
+
+/* adaptive scale range: largest useful keypoint scale relative to the object's short side */
+#define SIFT_ADAPT_MAX_SCL 0.125
+
 /** default width of descriptor histogram array */
 #define SIFT_DESCR_WIDTH 4
 
@@ -82,6 +102,46 @@ enum feature_match_type
 /* factor used to convert floating-point descriptor to unsigned char */
 #define SIFT_INT_DESCR_FCTR 512.0
 
+/* default pyramid type: 1 for 16-bit fixed-point levels, 0 for 32-bit float */
+#define SIFT_FIXED_POINT 0
+
+/* pyramid validation: a float keypoint is repeated by a fixed-point one within this many pixels */
+#define SIFT_REPEAT_DIST 1.5
+
+/* fixed-point pyramid: fractional bits of the 16-bit levels */
+#define SIFT_FIX_SHIFT 6
+
+/* fixed-point pyramid: 16-bit value of a 32-bit float level value of 1.0 */
+#define SIFT_FIX_ONE ( 255 << SIFT_FIX_SHIFT )
+
+/* fixed-point pyramid: fractional bits of the integer Gaussian kernels */
+#define SIFT_FIX_KERN_SHIFT 14
+
+/* default detector: 1 streams row bands through the pyramid, 0 builds whole levels */
+#define SIFT_STREAM 0
+
+/* default octave decimation: 1 averages 2x2 blocks, 0 samples every other pixel */
+#define SIFT_AA_DECIMATE 0
+
+/* SSE2 pyramid kernels, on x86 targets whose compiler enables SSE2 */
+#if defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 ) || defined(__SSE2__)
+#define SIFT_USE_SSE2 1
+#else
+#define SIFT_USE_SSE2 0
+#endif
+
+/** default keypoint budget, 0 keeps every keypoint */
+#define SIFT_MAX_FEATS 0
+
+/** default number of cells per side of the keypoint budget grid */
+#define SIFT_BUDGET_GRID 4
+
+/** default max squared distance ratio of nearest to second nearest match */
+#define SIFT_MATCH_RATIO 0.5
+
+/** default cross-check: 1 keeps only mutual nearest neighbour matches */
+#define SIFT_MATCH_CROSS_CHECK 0
+
 /* returns a feature's detection data */
 #define feat_detection_data(f) ( (struct detection_data*)(f->feature_data) )
 
@@ -94,6 +154,23 @@ struct detection_data
 	int intvl;
 	double subintvl;
 	double scl_octv;
+	double contr;
+};
+
+class ImagePool;
+
+/** run-time options of the SIFT detector */
+struct sift_options
+{
+	int max_feats;                 /**< keypoint budget, 0 keeps every keypoint */
+	int budget_grid;               /**< cells per side of the budget grid */
+	int img_dbl;                   /**< 1 doubles, 0 keeps, SIFT_IMG_DBL_ADAPTIVE picks the base scale */
+	int obj_size;                  /**< short side of the tracked object, 0 uses the image's */
+	int obj_size_max;              /**< short side of the largest of several objects, 0 if only obj_size */
+	int fixed_point;               /**< 1 builds 16-bit fixed-point pyramid levels */
+	int stream;                    /**< 1 detects in sliding row bands, for large frames */
+	int aa_decimate;               /**< 1 averages 2x2 blocks into each octave base */
+	ImagePool* pool;               /**< pool of the detector's temporary images, NULL for the global one */
 };
 
 
@@ -120,13 +197,146 @@ struct SIFT_feature_unit
 };
 
 void ConvertImage(IplImage* source, IplImage* target, Rect Roi);
-/* when tracking window move over this threshold */
-#define TRACKING_PIXEL_THR 2
-
 /* Tracking window size factor the template size */
 #define TRACKING_WINDOW_SIZE 0.3
 
-/* Optical flow point area*/
-#define OPTICAL_FLOW_POINT_AREA 10
+/* keypoint budget of the per-frame tracking window detection */
+#define TRACKING_MAX_FEATS 300
+
+/* Optical flow pyramid levels, counting the full resolution frame */
+#define OPTICAL_FLOW_LEVELS 4
+
+/* Optical flow window half size; the window is 2 * half + 1 pixels wide */
+#define OPTICAL_FLOW_WIN_HALF 7
+
+/* Optical flow iterations per pyramid level */
+#define OPTICAL_FLOW_MAX_ITER 20
+
+/* Optical flow convergence threshold on the update, in pixels */
+#define OPTICAL_FLOW_EPS 0.03
+
+/* Optical flow minimum eigenvalue of the gradient matrix per window pixel */
+#define OPTICAL_FLOW_MIN_EIG 0.1
+
+/* Optical flow points per batch chunk handed to a worker */
+#define OPTICAL_FLOW_GRAIN 16
+
+/* Optical flow worker threads, 0 for one per core */
+#define TRACKING_FLOW_THREADS 0
+
+/* Optical flow max distance between a point and its forward-backward track */
+#define OPTICAL_FLOW_FB_THR 1.0
+
+/* Optical flow min normalized cross-correlation of a point's two windows */
+#define OPTICAL_FLOW_NCC_THR 0.8
+
+/* Optical flow min distance between two tracked points, in pixels */
+#define OPTICAL_FLOW_MIN_DIST 3
+
+/* Tracked point budget; lost points are replaced up to this many */
+#define TRACKING_FLOW_POINTS 150
+
+/* Tracking is lost when fewer healthy points than this remain */
+#define TRACKING_MIN_POINTS 4
+
+/* Frames between two SIFT re-detections, 1 detects on every frame, 0 only on low confidence */
+#define TRACKING_DETECT_PERIOD 10
+
+/* SIFT re-detection also runs when less than this share of flow points survives */
+#define TRACKING_DETECT_CONFIDENCE 0.5
+
+/* Multi-target detection covers the whole frame past this share of it */
+#define MULTI_TARGET_FULL_FRAME 0.5
+
+/* Multi-target keypoint dispatch grid cell side, in pixels */
+#define MULTI_TARGET_GRID_CELL 64
+
+/* Template store max keypoints */
+#define TEMPLATE_CAPACITY 300
+
+/* Template store relocations a keypoint may go unmatched before eviction */
+#define TEMPLATE_MAX_AGE 30
+
+/* Template store learns new keypoints only from relocations with this many inliers */
+#define TEMPLATE_ADD_MIN_INLIERS 8
+
+/* Template store min inlier share of the matches of a relocation it learns from */
+#define TEMPLATE_ADD_MIN_RATIO 0.5
+
+/* Template store max keypoints learned per relocation */
+#define TEMPLATE_MAX_ADD 20
+
+/* Template store min distance of a new keypoint to the kept ones, in pixels */
+#define TEMPLATE_MIN_DIST 3
+
+/* 1 places the search window by motion prediction, 0 grows the last box by TRACKING_WINDOW_SIZE */
+#define TRACKING_PREDICT_WINDOW 1
+
+/* Search window min margin around the predicted box, as a fraction of its size */
+#define TRACKING_WINDOW_MARGIN 0.1
+
+/* Window prediction std of the target acceleration, in pixels per frame squared */
+#define KALMAN_ACCEL_NOISE 1.0
+
+/* Window prediction std of the change of log box size per frame squared */
+#define KALMAN_SCALE_NOISE 0.01
+
+/* Window prediction std of the tracked box centre, in pixels */
+#define KALMAN_MEAS_NOISE 2.0
+
+/* Window prediction std of the tracked log box size */
+#define KALMAN_SCALE_MEAS_NOISE 0.05
+
+/* Window prediction standard deviations covered by the search window */
+#define KALMAN_GATE 3.0
+
+/* Motion model fitted to the tracked points or matches */
+#define TRACKING_MOTION_MODEL MOTION_SIMILARITY
+
+/* Motion estimation max reprojection error of an inlier, in pixels */
+#define MOTION_INLIER_THR 2.0
+
+/* Motion estimation probability of having drawn an all-inlier sample */
+#define MOTION_CONFIDENCE 0.99
+
+/* Motion estimation max RANSAC iterations */
+#define MOTION_MAX_ITER 500
+
+/* Frames decoded ahead of the tracker from AVI files, 0 decodes on demand;
+   directories decode ahead by themselves through ImageSourceDirCached */
+#define FRAME_PREFETCH_DEPTH 4
+
+/* Frames queued between a live camera and the tracker */
+#define LIVE_QUEUE_DEPTH 2
+
+/* What the capture thread of a live camera does when the queue is full:
+   BLOCK waits for the tracker, DROP_OLDEST drops the oldest queued frame,
+   LATEST keeps only the newest frame so latency stays bounded */
+#define LIVE_DROP_POLICY ImageSourcePrefetch::LATEST
+
+/* Memory cap of the image pool of a stream in MB, 0 for no cap */
+#define IMAGE_POOL_MAX_MB 256
+
+/* Time a frame reader waits for pool buffers to come back when the pool is
+   full (e.g. during a SIFT pass), in ms, before taking one from the heap */
+#define FRAME_POOL_WAIT_MS 500
+
+/* Decoder threads of directory sources, 0 for one per core */
+#define DIR_DECODE_THREADS 0
+
+/* Frames a directory source decodes ahead of the tracker */
+#define DIR_DECODE_AHEAD 8
+
+/* Bound of the decoded frame cache of a directory source in MB */
+#define DIR_CACHE_MB 256
+
+/* Threads encoding result frames */
+#define RESULT_WRITER_THREADS 2
+
+/* Result frames waiting for encoding before the tracker waits for them */
+#define RESULT_WRITER_QUEUE 8
+
+/* Trajectory log lines written at a time */
+#define RESULT_LOG_BATCH 64
  
 #endif
\ No newline at end of file
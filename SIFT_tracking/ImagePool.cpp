@@ -0,0 +1,225 @@
+#include "StdAfx.h"
+#include "ImagePool.h"
+
+bool ImagePool::Key::operator<(const Key& k) const
+{
+	if (width != k.width)
+		return width < k.width;
+	if (height != k.height)
+		return height < k.height;
+	if (depth != k.depth)
+		return depth < k.depth;
+	return channels < k.channels;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//maxBytes of 0 puts no cap on the pool
+//////////////////////////////////////////////////////////////////////////
+ImagePool::ImagePool(size_t maxBytes)
+{
+	this->maxBytes = maxBytes;
+	this->bytesInUse = 0;
+	this->bytesKept = 0;
+	this->peakBytes = 0;
+	this->numHits = 0;
+	this->numMisses = 0;
+	this->numFailures = 0;
+	this->numUnpooled = 0;
+	this->numReleases = 0;
+}
+
+ImagePool::~ImagePool(void)
+{
+	trim();
+}
+
+ImagePool* ImagePool::global()
+{
+	static ImagePool pool;
+	return &pool;
+}
+
+/* image data size as cvCreateImage lays it out, rows aligned to 4 bytes */
+size_t ImagePool::bytesOf(CvSize size, int depth, int channels)
+{
+	size_t step = ((size_t)size.width * channels * ((depth & 255) / 8) + 3) & ~(size_t)3;
+	return step * size.height;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//an image of the given format, reused if one was released before; returns
+//NULL if the cap leaves no room for it
+//////////////////////////////////////////////////////////////////////////
+IplImage* ImagePool::create(CvSize size, int depth, int channels)
+{
+	std::map< Key, std::vector<IplImage*> >::iterator it;
+	std::vector<IplImage*> evicted;
+	IplImage* img;
+	size_t bytes = bytesOf(size, depth, channels);
+	bool fits;
+	Key key;
+	int i;
+
+	key.width = size.width;
+	key.height = size.height;
+	key.depth = depth;
+	key.channels = channels;
+
+	mutex.lock();
+	it = kept.find(key);
+	if (it != kept.end() && !it->second.empty())
+	{
+		img = it->second.back();
+		it->second.pop_back();
+		bytesKept -= img->imageSize;
+		bytesInUse += img->imageSize;
+		numHits++;
+		mutex.unlock();
+		cvResetImageROI(img);
+		return img;
+	}
+
+	numMisses++;
+	/* free kept images of other formats until the new one fits */
+	for (it = kept.begin(); maxBytes > 0 && bytesInUse + bytesKept + bytes > maxBytes &&
+		it != kept.end(); ++it)
+	{
+		while (!it->second.empty() && bytesInUse + bytesKept + bytes > maxBytes)
+		{
+			bytesKept -= it->second.back()->imageSize;
+			evicted.push_back(it->second.back());
+			it->second.pop_back();
+		}
+	}
+	fits = (maxBytes == 0 || bytesInUse + bytes <= maxBytes);
+	if (fits)
+	{
+		bytesInUse += bytes;
+		peakBytes = MAX(peakBytes, bytesInUse + bytesKept);
+	}
+	else
+		numFailures++;
+	mutex.unlock();
+
+	for (i = 0; i < (int)evicted.size(); i++)
+		cvReleaseImage(&evicted[i]);
+	return (fits)? cvCreateImage(size, depth, channels) : NULL;
+}
+
+IplImage* ImagePool::clone(const IplImage* img)
+{
+	IplImage* copy = create(cvGetSize(img), img->depth, img->nChannels);
+
+	if (copy != NULL)
+		cvCopy(img, copy);
+	return copy;
+}
+
+FrameView ImagePool::createView(CvSize size, int depth, int channels)
+{
+	return FrameView(create(size, depth, channels), this);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//a view of a pool image like createView, but a full pool is taken for a
+//passing peak: it waits up to maxWait seconds for images in use to come
+//back, and then gives an image from the heap, outside the cap, that is
+//freed with its last view
+//////////////////////////////////////////////////////////////////////////
+FrameView ImagePool::createViewWaiting(CvSize size, int depth, int channels, double maxWait)
+{
+	double end = wallTime() + maxWait;
+	IplImage* img = create(size, depth, channels);
+
+	while (img == NULL && waitForRelease(end - wallTime()))
+		img = create(size, depth, channels);
+	if (img != NULL)
+		return FrameView(img, this);
+
+	mutex.lock();
+	numUnpooled++;
+	mutex.unlock();
+	return FrameView(cvCreateImage(size, depth, channels));
+}
+
+//////////////////////////////////////////////////////////////////////////
+//wait until an image comes back to the pool; false if none did within
+//seconds
+//////////////////////////////////////////////////////////////////////////
+bool ImagePool::waitForRelease(double seconds)
+{
+	long before;
+	bool any;
+	double end = wallTime() + seconds;
+
+	mutex.lock();
+	before = numReleases;
+	while (numReleases == before && end > wallTime())
+	{
+		if (!released.wait(mutex, end - wallTime()))
+			break;
+	}
+	any = (numReleases != before);
+	mutex.unlock();
+	return any;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//take an image of the pool back and set *img to NULL; the image is kept
+//for reuse unless the cap has no room for it
+//////////////////////////////////////////////////////////////////////////
+void ImagePool::release(IplImage** img)
+{
+	std::vector<IplImage*>* slot;
+	Key key;
+	bool keep;
+
+	if (*img == NULL)
+		return;
+
+	key.width = (*img)->width;
+	key.height = (*img)->height;
+	key.depth = (*img)->depth;
+	key.channels = (*img)->nChannels;
+
+	mutex.lock();
+	numReleases++;
+	released.broadcast();
+	bytesInUse -= (*img)->imageSize;
+	keep = (maxBytes == 0 || bytesInUse + bytesKept + (*img)->imageSize <= maxBytes);
+	if (keep)
+	{
+		slot = &kept[key];
+		slot->push_back(*img);
+		bytesKept += (*img)->imageSize;
+	}
+	mutex.unlock();
+
+	if (!keep)
+		cvReleaseImage(img);
+	*img = NULL;
+}
+
+void ImagePool::recycle(IplImage* img)
+{
+	release(&img);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//free every kept image
+//////////////////////////////////////////////////////////////////////////
+void ImagePool::trim()
+{
+	std::map< Key, std::vector<IplImage*> >::iterator it;
+	int i;
+
+	mutex.lock();
+	for (it = kept.begin(); it != kept.end(); ++it)
+	{
+		for (i = 0; i < (int)it->second.size(); i++)
+			cvReleaseImage(&it->second[i]);
+	}
+	kept.clear();
+	bytesKept = 0;
+	mutex.unlock();
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include "Thread.h"
+#include "FrameView.h"
+#include <map>
+#include <vector>
+
+/*
+Allocator of IplImage buffers that keeps released images and hands them
+out again to requests of the same width, height, depth and channels, so
+per-frame temporaries stop hitting the heap once a stream runs.  A pool
+with a byte cap never holds more than that in used and kept images
+together: kept images are freed to make room, and create() returns NULL
+when the images in use leave none.  Images of a pool must go back to it
+through release(), or through recycle() as the last FrameView of them.
+Callers that must not go without an image, like the frame readers, use
+createViewWaiting(): it waits for images in use to come back and only
+then takes one from the heap, outside the cap.
+*/
+class ImagePool : public FrameRecycler
+{
+public:
+	ImagePool(size_t maxBytes = 0);
+	~ImagePool(void);
+	IplImage* create(CvSize size, int depth, int channels);
+	IplImage* clone(const IplImage* img);
+	FrameView createView(CvSize size, int depth, int channels);
+	FrameView createViewWaiting(CvSize size, int depth, int channels, double maxWait);
+	bool waitForRelease(double seconds);
+	void release(IplImage** img);
+	void recycle(IplImage* img);
+	void trim();
+
+	size_t getMaxBytes(){return maxBytes;};
+	size_t getBytesInUse(){return bytesInUse;};
+	size_t getBytesKept(){return bytesKept;};
+	size_t getPeakBytes(){return peakBytes;};
+	int getNumHits(){return numHits;};
+	int getNumMisses(){return numMisses;};
+	int getNumFailures(){return numFailures;};
+	int getNumUnpooled(){return numUnpooled;};
+
+	/* pool of callers that name none; it has no cap */
+	static ImagePool* global();
+
+private:
+	struct Key
+	{
+		int width;
+		int height;
+		int depth;
+		int channels;
+		bool operator<(const Key& k) const;
+	};
+	static size_t bytesOf(CvSize size, int depth, int channels);
+
+	size_t maxBytes;
+	size_t bytesInUse;
+	size_t bytesKept;
+	size_t peakBytes;
+	int numHits;
+	int numMisses;
+	int numFailures;
+	int numUnpooled;
+	long numReleases;
+	std::map< Key, std::vector<IplImage*> > kept;
+	Mutex mutex;
+	Condition released;
+};
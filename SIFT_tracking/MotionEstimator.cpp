@@ -0,0 +1,380 @@
+#include "StdAfx.h"
+#include "MotionEstimator.h"
+#include <algorithm>
+
+#if SIFT_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+/* number of set bits of a 4 bit SSE comparison mask */
+static const int bits4[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+Motion2D::Motion2D(void)
+{
+	a[0] = a[4] = 1;
+	a[1] = a[2] = a[3] = a[5] = 0;
+}
+
+Point2D Motion2D::map(Point2D p)
+{
+	return Point2D( a[3] * p.dcol + a[4] * p.drow + a[5],
+		a[0] * p.dcol + a[1] * p.drow + a[2] );
+}
+
+/* the motion undoing this one; a degenerate motion inverts to identity */
+Motion2D Motion2D::inverse()
+{
+	Motion2D m;
+	double det = a[0] * a[4] - a[1] * a[3];
+
+	if( fabs( det ) < DBL_EPSILON )
+		return m;
+	m.a[0] = a[4] / det;
+	m.a[1] = -a[1] / det;
+	m.a[3] = -a[3] / det;
+	m.a[4] = a[0] / det;
+	m.a[2] = -( m.a[0] * a[2] + m.a[1] * a[5] );
+	m.a[5] = -( m.a[3] * a[2] + m.a[4] * a[5] );
+	return m;
+}
+
+/*
+Moves a rectangle's centre with the motion and scales its sides by the
+motion's stretch along each axis.  Rotation and shear are not represented.
+
+@param r rectangle
+@return Returns the moved rectangle
+*/
+Rect Motion2D::mapRect(Rect r)
+{
+	Point2D c = map( Point2D( r.upper + r.height / 2.0, r.left + r.width / 2.0 ) );
+	double h = r.height * scaleY(), w = r.width * scaleX();
+
+	r.height = MAX( 1, cvRound( h ) );
+	r.width = MAX( 1, cvRound( w ) );
+	r.upper = cvRound( c.drow - h / 2.0 );
+	r.left = cvRound( c.dcol - w / 2.0 );
+	return r;
+}
+
+MotionEstimator::MotionEstimator(motion_model model, double inlierThr,
+								 double confidence, int maxIter)
+{
+	this->model = model;
+	this->inlierThr = inlierThr;
+	this->confidence = confidence;
+	this->maxIter = MAX( 1, maxIter );
+	this->numInliers = 0;
+	this->seed = 1;
+	this->count = 0;
+}
+
+/* number of correspondences a minimal sample of the model holds */
+int MotionEstimator::getSampleSize()
+{
+	switch( model )
+	{
+	case MOTION_TRANSLATION:
+		return 1;
+	case MOTION_SIMILARITY:
+		return 2;
+	default:
+		return 3;
+	}
+}
+
+unsigned int MotionEstimator::random()
+{
+	seed = seed * 1664525u + 1013904223u;
+	return seed >> 8;
+}
+
+struct QualityOrder
+{
+	const vector<double>* quality;
+	bool operator()( int i, int j ) const
+	{
+		return (*quality)[i] > (*quality)[j];
+	}
+};
+
+/*
+Copies the correspondences into float columns for scoring and sorts their
+indices by decreasing quality for PROSAC sampling.
+*/
+void MotionEstimator::load(const vector<Point2D>& from, const vector<Point2D>& to,
+						   const vector<double>* quality)
+{
+	QualityOrder cmp;
+	int i;
+
+	count = (int)MIN( from.size(), to.size() );
+	fx.resize( count );
+	fy.resize( count );
+	tx.resize( count );
+	ty.resize( count );
+	order.resize( count );
+	mask.resize( count );
+	bestMask.resize( count );
+	for( i = 0; i < count; i++ )
+	{
+		fx[i] = (float)from[i].dcol;
+		fy[i] = (float)from[i].drow;
+		tx[i] = (float)to[i].dcol;
+		ty[i] = (float)to[i].drow;
+		order[i] = i;
+	}
+	if( quality )
+	{
+		cmp.quality = quality;
+		std::stable_sort( order.begin(), order.end(), cmp );
+	}
+}
+
+/*
+Least squares fit of the model to a set of correspondences.  On a minimal
+sample this is the exact fit.
+
+@param idx correspondence indices
+@param n number of indices
+@param motion output motion
+
+@return Returns false if the correspondences are degenerate for the model
+*/
+bool MotionEstimator::fit(const int* idx, int n, Motion2D* motion)
+{
+	double mx = 0, my = 0, mX = 0, mY = 0, x, y, X, Y;
+	double sxx = 0, sxy = 0, syy = 0, sxX = 0, syX = 0, sxY = 0, syY = 0, s, det;
+	double* a = motion->a;
+	int i, k;
+
+	for( i = 0; i < n; i++ )
+	{
+		k = idx[i];
+		mx += fx[k];
+		my += fy[k];
+		mX += tx[k];
+		mY += ty[k];
+	}
+	mx /= n;
+	my /= n;
+	mX /= n;
+	mY /= n;
+	if( model == MOTION_TRANSLATION )
+	{
+		a[0] = a[4] = 1;
+		a[1] = a[3] = 0;
+		a[2] = mX - mx;
+		a[5] = mY - my;
+		return true;
+	}
+
+	for( i = 0; i < n; i++ )
+	{
+		k = idx[i];
+		x = fx[k] - mx;
+		y = fy[k] - my;
+		X = tx[k] - mX;
+		Y = ty[k] - mY;
+		sxx += x * x;
+		sxy += x * y;
+		syy += y * y;
+		sxX += x * X;
+		syX += y * X;
+		sxY += x * Y;
+		syY += y * Y;
+	}
+
+	if( model == MOTION_SIMILARITY )
+	{
+		s = sxx + syy;
+		if( s < 1e-6 )
+			return false;
+		a[0] = a[4] = ( sxX + syY ) / s;
+		a[3] = ( sxY - syX ) / s;
+		a[1] = -a[3];
+	}
+	else
+	{
+		det = sxx * syy - sxy * sxy;
+		if( det <= 1e-9 * ( sxx * syy + 1e-6 ) )
+			return false;
+		a[0] = ( syy * sxX - sxy * syX ) / det;
+		a[1] = ( sxx * syX - sxy * sxX ) / det;
+		a[3] = ( syy * sxY - sxy * syY ) / det;
+		a[4] = ( sxx * syY - sxy * sxY ) / det;
+	}
+	a[2] = mX - a[0] * mx - a[1] * my;
+	a[5] = mY - a[3] * mx - a[4] * my;
+	return true;
+}
+
+/*
+Counts the correspondences a motion maps within the inlier threshold.
+
+@param motion motion to score
+@param mask output as 1 for inliers and 0 for outliers
+
+@return Returns the number of inliers
+*/
+int MotionEstimator::score(Motion2D* motion, uchar* mask)
+{
+	float a0 = (float)motion->a[0], a1 = (float)motion->a[1], a2 = (float)motion->a[2];
+	float a3 = (float)motion->a[3], a4 = (float)motion->a[4], a5 = (float)motion->a[5];
+	float thr = (float)( inlierThr * inlierThr ), ex, ey;
+	int i = 0, n = 0, bits;
+
+#if SIFT_USE_SSE2
+	__m128 va0 = _mm_set1_ps( a0 ), va1 = _mm_set1_ps( a1 ), va2 = _mm_set1_ps( a2 );
+	__m128 va3 = _mm_set1_ps( a3 ), va4 = _mm_set1_ps( a4 ), va5 = _mm_set1_ps( a5 );
+	__m128 vthr = _mm_set1_ps( thr ), x, y, vx, vy;
+
+	for( ; i <= count - 4; i += 4 )
+	{
+		x = _mm_loadu_ps( &fx[i] );
+		y = _mm_loadu_ps( &fy[i] );
+		vx = _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( va0, x ),
+			_mm_mul_ps( va1, y ) ), va2 ), _mm_loadu_ps( &tx[i] ) );
+		vy = _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( va3, x ),
+			_mm_mul_ps( va4, y ) ), va5 ), _mm_loadu_ps( &ty[i] ) );
+		bits = _mm_movemask_ps( _mm_cmplt_ps( _mm_add_ps( _mm_mul_ps( vx, vx ),
+			_mm_mul_ps( vy, vy ) ), vthr ) );
+		mask[i] = (uchar)( bits & 1 );
+		mask[i+1] = (uchar)( ( bits >> 1 ) & 1 );
+		mask[i+2] = (uchar)( ( bits >> 2 ) & 1 );
+		mask[i+3] = (uchar)( ( bits >> 3 ) & 1 );
+		n += bits4[bits];
+	}
+#endif
+
+	for( ; i < count; i++ )
+	{
+		ex = a0 * fx[i] + a1 * fy[i] + a2 - tx[i];
+		ey = a3 * fx[i] + a4 * fy[i] + a5 - ty[i];
+		mask[i] = (uchar)( ex * ex + ey * ey < thr );
+		n += mask[i];
+	}
+	return n;
+}
+
+/*
+Draws a minimal sample of distinct correspondences among the n best.
+
+@param n size of the pool sampled from, counted in quality order
+@param prosacLast true to always include the n-th best correspondence, as
+	PROSAC does while the pool grows
+@param sample output correspondence indices
+*/
+void MotionEstimator::drawSample(int n, bool prosacLast, int* sample)
+{
+	int m = getSampleSize(), i = 0, j, k;
+
+	if( prosacLast )
+		sample[i++] = order[n-1];
+	while( i < m )
+	{
+		k = order[random() % ( prosacLast ? n - 1 : n )];
+		for( j = 0; j < i; j++ )
+			if( sample[j] == k )
+				break;
+		if( j == i )
+			sample[i++] = k;
+	}
+}
+
+/*
+Fits the model to point correspondences.
+
+@param from points in the first frame
+@param to corresponding points in the second frame
+@param motion output as the motion from the first frame to the second
+@param inliers output as 1 for correspondences consistent with the motion;
+	may be NULL
+@param quality match quality of each correspondence, higher is better;
+	given, samples are drawn PROSAC style.  May be NULL
+
+@return Returns false if no motion has at least a minimal sample of inliers
+*/
+bool MotionEstimator::estimate(const vector<Point2D>& from, const vector<Point2D>& to,
+							   Motion2D* motion, vector<uchar>* inliers,
+							   const vector<double>* quality)
+{
+	Motion2D cand, best;
+	int m = getSampleSize(), sample[3];
+	int bestScore = -1, limit = maxIter, t, k, i;
+	int n = m, nextT = 1;
+	double tn, tnNext, w, denom;
+
+	numInliers = 0;
+	seed = 1;
+	load( from, to, quality );
+	if( count < m )
+		return false;
+
+	/* PROSAC: expected draws from the n best before the pool grows */
+	for( tn = maxIter, i = 0; i < m; i++ )
+		tn *= (double)( m - i ) / ( count - i );
+
+	for( t = 1; t <= limit; t++ )
+	{
+		if( quality )
+		{
+			if( t > nextT  &&  n < count )
+			{
+				tnNext = tn * ( n + 1 ) / ( n + 1 - m );
+				nextT += (int)ceil( tnNext - tn );
+				tn = tnNext;
+				n++;
+			}
+			drawSample( n, t <= nextT  &&  n > m, sample );
+		}
+		else
+			drawSample( count, false, sample );
+
+		if( ! fit( sample, m, &cand ) )
+			continue;
+		k = score( &cand, &mask[0] );
+		if( k > bestScore )
+		{
+			bestScore = k;
+			best = cand;
+			bestMask.swap( mask );
+			mask.resize( count );
+
+			/* draws needed to pick an all-inlier sample with the given confidence */
+			w = (double)k / count;
+			denom = log( 1.0 - pow( w, m ) );
+			if( w >= 1.0 )
+				limit = t;
+			else if( denom < 0 )
+				limit = MIN( maxIter, (int)ceil( log( 1.0 - confidence ) / denom ) );
+		}
+	}
+	if( bestScore < m )
+		return false;
+
+	/* refine on the consensus while it keeps growing */
+	for( i = 0; i < 3; i++ )
+	{
+		inlierIdx.clear();
+		for( k = 0; k < count; k++ )
+			if( bestMask[k] )
+				inlierIdx.push_back( k );
+		if( ! fit( &inlierIdx[0], (int)inlierIdx.size(), &cand ) )
+			break;
+		k = score( &cand, &mask[0] );
+		if( k < bestScore )
+			break;
+		best = cand;
+		bestMask.swap( mask );
+		if( k == bestScore )
+			break;
+		bestScore = k;
+	}
+
+	numInliers = bestScore;
+	*motion = best;
+	if( inliers )
+		inliers->assign( bestMask.begin(), bestMask.end() );
+	return true;
+}
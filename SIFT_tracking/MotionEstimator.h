@@ -0,0 +1,61 @@
+#pragma once
+#include "Def.h"
+
+/*
+2D motion x' = a[0] x + a[1] y + a[2], y' = a[3] x + a[4] y + a[5], with x
+the column and y the row.  Translation and similarity motions are affine
+motions with tied coefficients.
+*/
+class Motion2D
+{
+public:
+	Motion2D(void);
+	Point2D map(Point2D p);
+	Rect mapRect(Rect r);
+	Motion2D inverse();
+	double scaleX(){return sqrt(a[0]*a[0]+a[3]*a[3]);};
+	double scaleY(){return sqrt(a[1]*a[1]+a[4]*a[4]);};
+
+	double a[6];
+};
+
+/*
+Robust fit of a translation, similarity or affine motion to point
+correspondences.  Minimal samples are drawn RANSAC style, or PROSAC style
+from the best correspondences first when a quality is given, until the
+consensus found makes a better sample unlikely.  The best model is refined
+by least squares on its inliers.
+*/
+class MotionEstimator
+{
+public:
+	MotionEstimator(motion_model model = TRACKING_MOTION_MODEL,
+		double inlierThr = MOTION_INLIER_THR, double confidence = MOTION_CONFIDENCE,
+		int maxIter = MOTION_MAX_ITER);
+	bool estimate(const vector<Point2D>& from, const vector<Point2D>& to,
+		Motion2D* motion, vector<uchar>* inliers = NULL,
+		const vector<double>* quality = NULL);
+	int getNumInliers(){return numInliers;};
+	int getSampleSize();
+
+private:
+	void load(const vector<Point2D>& from, const vector<Point2D>& to,
+		const vector<double>* quality);
+	bool fit(const int* idx, int n, Motion2D* motion);
+	int score(Motion2D* motion, uchar* mask);
+	void drawSample(int n, bool prosacLast, int* sample);
+	unsigned int random();
+
+	motion_model model;
+	double inlierThr;
+	double confidence;
+	int maxIter;
+	int numInliers;
+	unsigned int seed;
+	int count;
+	/* correspondences as float columns, padded to a multiple of 4 */
+	vector<float> fx, fy, tx, ty;
+	vector<int> order;
+	vector<int> inlierIdx;
+	vector<uchar> mask, bestMask;
+};
@@ -0,0 +1,213 @@
+#include "StdAfx.h"
+#include "MultiTargetTracker.h"
+#include <limits.h>
+
+MultiTargetTracker::MultiTargetTracker(Rect wholeImage, const struct sift_options* tmplOpts)
+	: pool(TRACKING_FLOW_THREADS)
+{
+	this->wholeImage = wholeImage;
+	this->tmplOpts = *tmplOpts;
+	this->frameOpts = *tmplOpts;
+	this->gridRows = this->gridCols = 0;
+	this->numFrames = 0;
+	this->numDetections = 0;
+	this->primed = false;
+}
+
+MultiTargetTracker::~MultiTargetTracker(void)
+{
+	for (int i=0;i<(int)targets.size();i++)
+	{
+		delete targets[i]->tracker;
+		delete targets[i]->tmpl;
+		delete targets[i];
+	}
+}
+
+int MultiTargetTracker::getNumLive()
+{
+	int live = 0;
+
+	for (int i=0;i<(int)targets.size();i++)
+	{
+		if (!targets[i]->lost)
+			live++;
+	}
+	return live;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//cut a template out of the current frame and start tracking it; returns
+//the target's index
+//////////////////////////////////////////////////////////////////////////
+int MultiTargetTracker::addTarget(ImageHandler* imhdr, Rect box)
+{
+	Target* t = new Target;
+	struct sift_options opts = tmplOpts;
+	/* SIFT works on gray; the handler's gray frame saves it the conversion */
+	FrameView frame = imhdr->getGrayFrame();
+
+	if (!primed)
+	{
+		flow.pushFrame(imhdr->getIplGrayImage());
+		primed = true;
+	}
+	opts.obj_size = MIN(box.width,box.height);
+	t->tmpl = new SIFT_feature(frame.get(),box,&opts);
+	t->tracker = new SIFT_opt_tracker(t->tmpl,imhdr->getIplGrayImage(),t->tmpl->GetLength(),box,&flow,&pool);
+	t->box = box;
+	t->lost = false;
+	t->detect = t->tracked = false;
+#if TRACKING_PREDICT_WINDOW
+	t->predictor.init(box);
+	t->predictor.predict(&t->window,wholeImage);
+#else
+	ModifyTrackingWindows(box,&t->window,wholeImage);
+#endif
+	targets.push_back(t);
+	return (int)targets.size()-1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//list, for each cell of the detection region grid, the detecting targets
+//whose search window overlaps it
+//////////////////////////////////////////////////////////////////////////
+void MultiTargetTracker::buildGrid(Rect region)
+{
+	int r0,r1,c0,c1,r,c;
+	Target* t;
+
+	gridRows = (region.height+MULTI_TARGET_GRID_CELL-1)/MULTI_TARGET_GRID_CELL;
+	gridCols = (region.width+MULTI_TARGET_GRID_CELL-1)/MULTI_TARGET_GRID_CELL;
+	cells.resize(gridRows*gridCols);
+	for (r=0;r<(int)cells.size();r++)
+		cells[r].clear();
+	for (int i=0;i<(int)targets.size();i++)
+	{
+		t = targets[i];
+		if (t->lost||!t->detect)
+			continue;
+		r0 = MAX(0,(t->window.upper-region.upper)/MULTI_TARGET_GRID_CELL);
+		r1 = MIN(gridRows-1,(t->window.upper+t->window.height-1-region.upper)/MULTI_TARGET_GRID_CELL);
+		c0 = MAX(0,(t->window.left-region.left)/MULTI_TARGET_GRID_CELL);
+		c1 = MIN(gridCols-1,(t->window.left+t->window.width-1-region.left)/MULTI_TARGET_GRID_CELL);
+		for (r=r0;r<=r1;r++)
+			for (c=c0;c<=c1;c++)
+				cells[r*gridCols+c].push_back(i);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+//hand each keypoint detected over region to the detecting targets whose
+//search window contains it
+//////////////////////////////////////////////////////////////////////////
+void MultiTargetTracker::dispatch(SIFT_feature* sfeat, Rect region)
+{
+	struct SIFT_feature_unit* f;
+	vector<int>* cell;
+	Target* t;
+	double y,x;
+	int r,c,k;
+
+	buildGrid(region);
+	for (int i=0;i<sfeat->GetLength();i++)
+	{
+		f = sfeat->GetFeat(i);
+		r = MIN(gridRows-1,MAX(0,(int)(f->y/MULTI_TARGET_GRID_CELL)));
+		c = MIN(gridCols-1,MAX(0,(int)(f->x/MULTI_TARGET_GRID_CELL)));
+		y = f->y+region.upper;
+		x = f->x+region.left;
+		cell = &cells[r*gridCols+c];
+		for (k=0;k<(int)cell->size();k++)
+		{
+			t = targets[(*cell)[k]];
+			if (y>=t->window.upper&&y<t->window.upper+t->window.height&&
+				x>=t->window.left&&x<t->window.left+t->window.width)
+				t->feats.push_back(f);
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+//track every live target into the current frame; returns the number of
+//targets still tracked
+//////////////////////////////////////////////////////////////////////////
+int MultiTargetTracker::track(ImageHandler* imhdr)
+{
+	SIFT_feature* sfeat;
+	FrameView frame;
+	Rect region;
+	int top = INT_MAX,left = INT_MAX,bottom = INT_MIN,right = INT_MIN;
+	int nDetect = 0,minSide = INT_MAX,maxSide = 0,live = 0,i;
+	Target* t;
+
+	/* one pyramid per frame serves every target */
+	flow.pushFrame(imhdr->getIplGrayImage());
+	primed = true;
+	numFrames++;
+	for (i=0;i<(int)targets.size();i++)
+	{
+		t = targets[i];
+		if (t->lost)
+			continue;
+		t->tracked = t->tracker->tracking(imhdr,NULL,0,&t->window,&t->box);
+		t->detect = !t->tracked||t->scheduler.detectNow();
+		t->feats.clear();
+		if (!t->detect)
+			continue;
+		top = MIN(top,t->window.upper);
+		left = MIN(left,t->window.left);
+		bottom = MAX(bottom,t->window.upper+t->window.height);
+		right = MAX(right,t->window.left+t->window.width);
+		minSide = MIN(minSide,MIN(t->box.width,t->box.height));
+		maxSide = MAX(maxSide,MIN(t->box.width,t->box.height));
+		nDetect++;
+	}
+
+	/* one SIFT pass over the windows of all targets that need it */
+	if (nDetect>0)
+	{
+		region = Rect(top,left,bottom-top,right-left);
+		if (region.getArea()>MULTI_TARGET_FULL_FRAME*wholeImage.getArea())
+			region = wholeImage;
+		/* the smallest target picks the base scale, the largest the octaves */
+		frameOpts.obj_size = minSide;
+		frameOpts.obj_size_max = maxSide;
+		frameOpts.max_feats = TRACKING_MAX_FEATS*nDetect;
+		/* the decoded gray frame, free of the boxes painted on the display image */
+		frame = imhdr->getGrayFrame();
+		sfeat = new SIFT_feature(frame.get(),region,&frameOpts);
+		numDetections++;
+		dispatch(sfeat,region);
+		for (i=0;i<(int)targets.size();i++)
+		{
+			t = targets[i];
+			if (t->lost||!t->detect)
+				continue;
+			t->tracked = t->tracker->relocate(imhdr,(t->feats.empty())? NULL : &t->feats[0],
+				(int)t->feats.size(),&region,&t->box)||t->tracked;
+		}
+		delete sfeat;
+	}
+
+	for (i=0;i<(int)targets.size();i++)
+	{
+		t = targets[i];
+		if (t->lost)
+			continue;
+		t->scheduler.update(t->detect,t->tracker->getConfidence());
+		if (!t->tracked)
+		{
+			t->lost = true;
+			continue;
+		}
+#if TRACKING_PREDICT_WINDOW
+		t->predictor.correct(t->box);
+		t->predictor.predict(&t->window,wholeImage);
+#else
+		ModifyTrackingWindows(t->box,&t->window,wholeImage);
+#endif
+		live++;
+	}
+	return live;
+}
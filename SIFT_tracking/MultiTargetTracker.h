@@ -0,0 +1,60 @@
+#pragma once
+#include "SIFT_opt_tracker.h"
+#include "WindowPredictor.h"
+#include "TrackingScheduler.h"
+
+/*
+Tracks several targets in one video.  The targets share one flow pyramid
+and worker pool, and on frames where some of them need SIFT re-detection
+the keypoints are computed once, over the bounding box of their search
+windows or over the whole frame when that box covers most of it.  A
+coarse grid of the detection region, listing the windows overlapping each
+cell, hands every keypoint to the targets whose window contains it.
+*/
+class MultiTargetTracker
+{
+public:
+	MultiTargetTracker(Rect wholeImage, const struct sift_options* tmplOpts);
+	~MultiTargetTracker(void);
+	int addTarget(ImageHandler* imhdr, Rect box);
+	int track(ImageHandler* imhdr);
+	int getNumTargets(){return (int)targets.size();};
+	int getNumLive();
+	bool isLost(int i){return targets[i]->lost;};
+	Rect getBox(int i){return targets[i]->box;};
+	double getConfidence(int i){return targets[i]->tracker->getConfidence();};
+	int getNumFrames(){return numFrames;};
+	int getNumDetections(){return numDetections;};
+
+private:
+	struct Target
+	{
+		SIFT_feature* tmpl;
+		SIFT_opt_tracker* tracker;
+		WindowPredictor predictor;
+		TrackingScheduler scheduler;
+		Rect box;
+		Rect window;
+		bool lost;
+		bool detect;
+		bool tracked;
+		vector<struct SIFT_feature_unit*> feats;
+	};
+	void buildGrid(Rect region);
+	void dispatch(SIFT_feature* sfeat, Rect region);
+
+	Rect wholeImage;
+	struct sift_options tmplOpts;
+	struct sift_options frameOpts;
+	PyrLKFlow flow;
+	ThreadPool pool;
+	vector<Target*> targets;
+	/* detection region grid: target indices overlapping each cell */
+	vector< vector<int> > cells;
+	int gridRows;
+	int gridCols;
+	int numFrames;
+	int numDetections;
+	/* the flow engine holds the current frame */
+	bool primed;
+};
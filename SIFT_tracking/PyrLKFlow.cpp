@@ -0,0 +1,516 @@
+#include "StdAfx.h"
+#include "PyrLKFlow.h"
+
+#if SIFT_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+/* Scharr derivatives are 32 times the central difference */
+#define SCHARR_SCALE ( 1.0 / 32.0 )
+
+/*
+Bilinearly interpolates one window row from two neighbouring image rows.
+The subpixel offset is the same for every pixel of the window, so the
+four weights are shared.
+
+@param a upper image row at the left pixel of the window
+@param b lower image row at the left pixel of the window
+@param w00 weight of a[j]
+@param w01 weight of a[j+1]
+@param w10 weight of b[j]
+@param w11 weight of b[j+1]
+@param out window row
+@param n window width
+*/
+static void sampleRow( const float* a, const float* b, float w00, float w01,
+					  float w10, float w11, float* out, int n )
+{
+	int j = 0;
+
+#if SIFT_USE_SSE2
+	__m128 v00 = _mm_set1_ps( w00 ), v01 = _mm_set1_ps( w01 );
+	__m128 v10 = _mm_set1_ps( w10 ), v11 = _mm_set1_ps( w11 );
+
+	for( ; j <= n - 4; j += 4 )
+		_mm_storeu_ps( out + j, _mm_add_ps(
+			_mm_add_ps( _mm_mul_ps( v00, _mm_loadu_ps( a + j ) ),
+				_mm_mul_ps( v01, _mm_loadu_ps( a + j + 1 ) ) ),
+			_mm_add_ps( _mm_mul_ps( v10, _mm_loadu_ps( b + j ) ),
+				_mm_mul_ps( v11, _mm_loadu_ps( b + j + 1 ) ) ) ) );
+#endif
+
+	for( ; j < n; j++ )
+		out[j] = w00 * a[j] + w01 * a[j+1] + w10 * b[j] + w11 * b[j+1];
+}
+
+/*
+Accumulates the mismatch vector of one Lucas-Kanade iteration.
+
+@param I window of the previous frame
+@param J window of the next frame
+@param dx x derivative window of the previous frame
+@param dy y derivative window of the previous frame
+@param n number of window pixels
+@param bx output as sum of (I - J) * dx
+@param by output as sum of (I - J) * dy
+*/
+static void mismatch( const float* I, const float* J, const float* dx,
+					 const float* dy, int n, double* bx, double* by )
+{
+	float sx = 0, sy = 0, d;
+	int i = 0;
+
+#if SIFT_USE_SSE2
+	float tx[4], ty[4];
+	__m128 ax = _mm_setzero_ps(), ay = _mm_setzero_ps(), e;
+
+	for( ; i <= n - 4; i += 4 )
+	{
+		e = _mm_sub_ps( _mm_loadu_ps( I + i ), _mm_loadu_ps( J + i ) );
+		ax = _mm_add_ps( ax, _mm_mul_ps( e, _mm_loadu_ps( dx + i ) ) );
+		ay = _mm_add_ps( ay, _mm_mul_ps( e, _mm_loadu_ps( dy + i ) ) );
+	}
+	_mm_storeu_ps( tx, ax );
+	_mm_storeu_ps( ty, ay );
+	sx = ( tx[0] + tx[1] ) + ( tx[2] + tx[3] );
+	sy = ( ty[0] + ty[1] ) + ( ty[2] + ty[3] );
+#endif
+
+	for( ; i < n; i++ )
+	{
+		d = I[i] - J[i];
+		sx += d * dx[i];
+		sy += d * dy[i];
+	}
+	*bx = sx;
+	*by = sy;
+}
+
+PyrLKFlow::PyrLKFlow(int levels, int winHalf, int maxIter, double epsilon)
+{
+	this->levels = MAX( 1, levels );
+	this->winHalf = winHalf;
+	this->winSize = 2 * winHalf + 1;
+	this->maxIter = maxIter;
+	this->epsilon = epsilon;
+	this->border = winHalf + 2;
+	this->nLevels = 0;
+	this->frameSize = cvSize( 0, 0 );
+	this->gray = NULL;
+	this->levelBuf = NULL;
+	this->pyr[0] = this->pyr[1] = NULL;
+	this->derivX[0] = this->derivX[1] = NULL;
+	this->derivY[0] = this->derivY[1] = NULL;
+	this->prev = 0;
+	this->numFrames = 0;
+	this->scratch = NULL;
+	this->numScratch = 0;
+	reserveScratch( 1 );
+}
+
+PyrLKFlow::~PyrLKFlow(void)
+{
+	release();
+	free( scratch );
+}
+
+/*
+Makes sure every worker has its own window scratch: the I, dx, dy and J
+windows, back to back.  Scratch only grows, so tracking points allocates
+nothing once the worker count is stable.
+
+@param workers number of workers that will track points concurrently
+*/
+void PyrLKFlow::reserveScratch(int workers)
+{
+	if( workers <= numScratch )
+		return;
+	free( scratch );
+	scratch = (float*)malloc( workers * 4 * winSize * winSize * sizeof(float) );
+	numScratch = workers;
+}
+
+/*
+Allocates the pyramid levels for frames of a given size.  Levels are
+dropped when they would be smaller than the tracking window.
+
+@param size frame size
+*/
+void PyrLKFlow::allocate(CvSize size)
+{
+	CvSize s = size;
+	int l, f;
+
+	release();
+	frameSize = size;
+	for( nLevels = 1; nLevels < levels; nLevels++ )
+	{
+		s = cvSize( ( s.width + 1 ) / 2, ( s.height + 1 ) / 2 );
+		if( MIN( s.width, s.height ) < winSize )
+			break;
+	}
+
+	gray = cvCreateImage( size, IPL_DEPTH_8U, 1 );
+	levelBuf = (IplImage**)calloc( nLevels, sizeof(IplImage*) );
+	for( f = 0; f < 2; f++ )
+	{
+		pyr[f] = (IplImage**)calloc( nLevels, sizeof(IplImage*) );
+		derivX[f] = (IplImage**)calloc( nLevels, sizeof(IplImage*) );
+		derivY[f] = (IplImage**)calloc( nLevels, sizeof(IplImage*) );
+	}
+	for( l = 0, s = size; l < nLevels; l++ )
+	{
+		levelBuf[l] = cvCreateImage( s, IPL_DEPTH_32F, 1 );
+		for( f = 0; f < 2; f++ )
+		{
+			pyr[f][l] = cvCreateImage( cvSize( s.width + 2 * border,
+				s.height + 2 * border ), IPL_DEPTH_32F, 1 );
+			derivX[f][l] = cvCreateImage( cvGetSize( pyr[f][l] ), IPL_DEPTH_32F, 1 );
+			derivY[f][l] = cvCreateImage( cvGetSize( pyr[f][l] ), IPL_DEPTH_32F, 1 );
+		}
+		s = cvSize( ( s.width + 1 ) / 2, ( s.height + 1 ) / 2 );
+	}
+}
+
+void PyrLKFlow::release()
+{
+	int l, f;
+
+	for( l = 0; l < nLevels; l++ )
+	{
+		cvReleaseImage( &levelBuf[l] );
+		for( f = 0; f < 2; f++ )
+		{
+			cvReleaseImage( &pyr[f][l] );
+			cvReleaseImage( &derivX[f][l] );
+			cvReleaseImage( &derivY[f][l] );
+		}
+	}
+	free( levelBuf );
+	levelBuf = NULL;
+	for( f = 0; f < 2; f++ )
+	{
+		free( pyr[f] );
+		free( derivX[f] );
+		free( derivY[f] );
+		pyr[f] = derivX[f] = derivY[f] = NULL;
+	}
+	if( gray )
+		cvReleaseImage( &gray );
+	nLevels = 0;
+	numFrames = 0;
+}
+
+/*
+Builds the border-padded Gaussian pyramid of an 8-bit frame and its Scharr
+derivatives.  The border replicates the frame edge so that windows near
+it need no clipping.
+
+@param frame 8-bit gray or colour frame
+@param f frame slot receiving the pyramid
+*/
+void PyrLKFlow::buildPyramid(IplImage* frame, int f)
+{
+	int l;
+
+	if( frame->nChannels == 1 )
+		cvConvert( frame, levelBuf[0] );
+	else
+	{
+		cvCvtColor( frame, gray, CV_RGB2GRAY );
+		cvConvert( gray, levelBuf[0] );
+	}
+	for( l = 1; l < nLevels; l++ )
+		cvPyrDown( levelBuf[l-1], levelBuf[l], CV_GAUSSIAN_5x5 );
+	for( l = 0; l < nLevels; l++ )
+	{
+		cvCopyMakeBorder( levelBuf[l], pyr[f][l], cvPoint( border, border ),
+			IPL_BORDER_REPLICATE, cvScalarAll( 0 ) );
+		cvSobel( pyr[f][l], derivX[f][l], 1, 0, CV_SCHARR );
+		cvSobel( pyr[f][l], derivY[f][l], 0, 1, CV_SCHARR );
+	}
+}
+
+/*
+Prepares the engine to track points from one frame to the next.
+
+@param prev previous frame, 8-bit
+@param next next frame, 8-bit, of the same size
+*/
+void PyrLKFlow::setFrames(IplImage* prev, IplImage* next)
+{
+	if( prev->width != frameSize.width  ||  prev->height != frameSize.height )
+		allocate( cvGetSize( prev ) );
+	buildPyramid( prev, this->prev );
+	buildPyramid( next, 1 - this->prev );
+	numFrames = 2;
+}
+
+/*
+Makes a new frame the next one to track points to; the former next frame
+becomes the previous one.  Only the new frame's pyramid is built, into the
+slot of the dropped frame, and the frame itself is not kept.  A frame of a
+different size restarts the sequence.
+
+@param frame next frame, 8-bit
+*/
+void PyrLKFlow::pushFrame(IplImage* frame)
+{
+	if( frame->width != frameSize.width  ||  frame->height != frameSize.height )
+		allocate( cvGetSize( frame ) );
+	if( numFrames > 0 )
+		prev = 1 - prev;
+	buildPyramid( frame, 1 - prev );
+	numFrames = MIN( numFrames + 1, 2 );
+}
+
+/*
+Bilinearly samples a window from a padded pyramid level.
+
+@param img padded pyramid level
+@param x window centre column in unpadded level coordinates
+@param y window centre row in unpadded level coordinates
+@param patch output window, winSize x winSize
+
+@return Returns false if the window leaves the padded level
+*/
+bool PyrLKFlow::samplePatch(IplImage* img, double x, double y, float* patch)
+{
+	double px = x + border - winHalf, py = y + border - winHalf;
+	float fx, fy;
+	int ix, iy, i;
+	const float* a;
+
+	/* written so that NaN coordinates fail too */
+	if( !( px >= 0  &&  py >= 0  &&  px < img->width - winSize - 1  &&
+		py < img->height - winSize - 1 ) )
+		return false;
+
+	ix = cvFloor( px );
+	iy = cvFloor( py );
+	fx = (float)( px - ix );
+	fy = (float)( py - iy );
+	for( i = 0; i < winSize; i++ )
+	{
+		a = (const float*)( img->imageData + img->widthStep * ( iy + i ) ) + ix;
+		sampleRow( a, (const float*)( (const char*)a + img->widthStep ),
+			( 1 - fx ) * ( 1 - fy ), fx * ( 1 - fy ), ( 1 - fx ) * fy, fx * fy,
+			patch + i * winSize, winSize );
+	}
+	return true;
+}
+
+/*
+Tracks a point from the previous frame to the next one.
+
+@param p point in the previous frame
+@param q output as the point in the next frame
+@param err output as the mean absolute window difference at q; may be NULL
+
+@return Returns true if the point was tracked
+*/
+bool PyrLKFlow::trackPoint(Point2D p, Point2D* q, double* err)
+{
+	return track( p, q, err, NULL, 0, false );
+}
+
+struct TrackBatch
+{
+	PyrLKFlow* flow;
+	const vector<Point2D>* points;
+	vector<Point2D>* disp;
+	vector<uchar>* status;
+	vector<double>* err;
+	vector<double>* ncc;
+	bool backward;
+};
+
+/*
+Tracks a range of points of a batch with the scratch of one worker
+*/
+void PyrLKFlow::trackRange(void* arg, int worker, int begin, int end)
+{
+	TrackBatch* batch = (TrackBatch*)arg;
+	Point2D q;
+	int i;
+
+	for( i = begin; i < end; i++ )
+	{
+		(*batch->status)[i] = batch->flow->track( (*batch->points)[i], &q,
+			&(*batch->err)[i], ( batch->ncc )? &(*batch->ncc)[i] : NULL,
+			worker, batch->backward );
+		(*batch->disp)[i] = ( (*batch->status)[i] )?
+			q - (*batch->points)[i] : Point2D( 0.0, 0.0 );
+	}
+}
+
+/*
+Tracks a batch of points from the previous frame to the next one.  Points
+are independent, so the batch is split across the workers of a pool, each
+using its own window scratch.
+
+@param points points in the previous frame
+@param disp output as the displacement of each point; zero for lost points
+@param status output as 1 for tracked points and 0 for lost ones
+@param err output as the mean absolute window difference of each point
+@param pool workers to split the batch across; NULL tracks serially
+@param backward true to track points of the next frame back to the
+	previous one
+@param ncc output as the normalized cross-correlation of each point's
+	windows in the two frames; may be NULL
+*/
+void PyrLKFlow::trackPoints(const vector<Point2D>& points, vector<Point2D>& disp,
+							vector<uchar>& status, vector<double>& err, ThreadPool* pool,
+							bool backward, vector<double>* ncc)
+{
+	TrackBatch batch;
+	int n = (int)points.size();
+
+	disp.resize( n );
+	status.resize( n );
+	err.resize( n );
+	if( ncc )
+		ncc->resize( n );
+	batch.flow = this;
+	batch.points = &points;
+	batch.disp = &disp;
+	batch.status = &status;
+	batch.err = &err;
+	batch.ncc = ncc;
+	batch.backward = backward;
+	if( pool )
+	{
+		reserveScratch( pool->getNumWorkers() );
+		pool->parallelFor( 0, n, OPTICAL_FLOW_GRAIN, trackRange, &batch );
+	}
+	else
+		trackRange( &batch, 0, 0, n );
+}
+
+/*
+Tracks a point coarse to fine, iterating the Lucas-Kanade step on every
+level.  Levels where the window leaves the frame or lacks texture are
+skipped; failing on the full resolution level loses the point.
+
+@param p point in the frame tracked from
+@param q output as the point in the frame tracked to
+@param err output as the mean absolute window difference at q; may be NULL
+@param ncc output as the normalized cross-correlation of the windows at p
+	and q; may be NULL
+@param worker index of the window scratch to use
+@param backward true to track from the next frame to the previous one
+
+@return Returns true if the point was tracked
+*/
+bool PyrLKFlow::track(Point2D p, Point2D* q, double* err, double* ncc,
+					  int worker, bool backward)
+{
+	double x, y, gx = 0, gy = 0, vx, vy, dx, dy, bx, by;
+	double a11, a12, a22, det, minEig, scl, sad, mi, mj, sij, sii, sjj;
+	int n = winSize * winSize, l, k, i;
+	int from = ( backward )? 1 - prev : prev, to = 1 - from;
+	float* patchI = scratch + worker * 4 * n;
+	float* patchDx = patchI + n;
+	float* patchDy = patchDx + n;
+	float* patchJ = patchDy + n;
+	bool ok;
+
+	if( numFrames < 2 )
+		return false;
+
+	for( l = nLevels - 1; l >= 0; l-- )
+	{
+		scl = 1.0 / ( 1 << l );
+		x = p.dcol * scl;
+		y = p.drow * scl;
+		vx = vy = 0;
+		ok = samplePatch( pyr[from][l], x, y, patchI );
+		if( ok )
+		{
+			samplePatch( derivX[from][l], x, y, patchDx );
+			samplePatch( derivY[from][l], x, y, patchDy );
+
+			/* spatial gradient matrix, fixed over the iterations */
+			a11 = a12 = a22 = 0;
+			for( i = 0; i < n; i++ )
+			{
+				a11 += patchDx[i] * patchDx[i];
+				a12 += patchDx[i] * patchDy[i];
+				a22 += patchDy[i] * patchDy[i];
+			}
+			a11 *= SCHARR_SCALE * SCHARR_SCALE;
+			a12 *= SCHARR_SCALE * SCHARR_SCALE;
+			a22 *= SCHARR_SCALE * SCHARR_SCALE;
+			det = a11 * a22 - a12 * a12;
+			minEig = ( a11 + a22 - sqrt( ( a11 - a22 ) * ( a11 - a22 ) +
+				4.0 * a12 * a12 ) ) / ( 2.0 * n );
+			ok = ( minEig >= OPTICAL_FLOW_MIN_EIG  &&  det > DBL_EPSILON );
+		}
+
+		for( k = 0; ok  &&  k < maxIter; k++ )
+		{
+			if( ! samplePatch( pyr[to][l], x + gx + vx, y + gy + vy, patchJ ) )
+			{
+				ok = false;
+				break;
+			}
+			mismatch( patchI, patchJ, patchDx, patchDy, n, &bx, &by );
+			bx *= SCHARR_SCALE;
+			by *= SCHARR_SCALE;
+			dx = ( a22 * bx - a12 * by ) / det;
+			dy = ( a11 * by - a12 * bx ) / det;
+			vx += dx;
+			vy += dy;
+			if( dx * dx + dy * dy < epsilon * epsilon )
+				break;
+		}
+
+		if( l == 0 )
+		{
+			if( ! ok )
+				return false;
+			gx += vx;
+			gy += vy;
+		}
+		else if( ok )
+		{
+			gx = 2 * ( gx + vx );
+			gy = 2 * ( gy + vy );
+		}
+		else
+		{
+			gx *= 2;
+			gy *= 2;
+		}
+	}
+
+	if( err  ||  ncc )
+	{
+		if( ! samplePatch( pyr[to][0], p.dcol + gx, p.drow + gy, patchJ ) )
+			return false;
+		sad = mi = mj = 0;
+		for( i = 0; i < n; i++ )
+		{
+			sad += fabs( patchI[i] - patchJ[i] );
+			mi += patchI[i];
+			mj += patchJ[i];
+		}
+		if( err )
+			*err = sad / n;
+		if( ncc )
+		{
+			mi /= n;
+			mj /= n;
+			sij = sii = sjj = 0;
+			for( i = 0; i < n; i++ )
+			{
+				sij += ( patchI[i] - mi ) * ( patchJ[i] - mj );
+				sii += ( patchI[i] - mi ) * ( patchI[i] - mi );
+				sjj += ( patchJ[i] - mj ) * ( patchJ[i] - mj );
+			}
+			*ncc = ( sii > 0  &&  sjj > 0 )? sij / sqrt( sii * sjj ) : 0;
+		}
+	}
+	*q = Point2D( p.drow + gy, p.dcol + gx );
+	return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "Def.h"
+#include "Thread.h"
+
+/*
+Pyramidal iterative Lucas-Kanade point tracker.  The pyramids and Scharr
+derivatives of both frames are built once and shared by every tracked
+point, in either direction.  They live in two slots that pushFrame() swaps
+by index, so a video is tracked with one pyramid build per frame and no
+allocation once the frame size is stable.
+*/
+class PyrLKFlow
+{
+public:
+	PyrLKFlow(int levels = OPTICAL_FLOW_LEVELS, int winHalf = OPTICAL_FLOW_WIN_HALF,
+		int maxIter = OPTICAL_FLOW_MAX_ITER, double epsilon = OPTICAL_FLOW_EPS);
+	~PyrLKFlow(void);
+	void setFrames(IplImage* prev, IplImage* next);
+	void pushFrame(IplImage* frame);
+	bool trackPoint(Point2D p, Point2D* q, double* err = NULL);
+	void trackPoints(const vector<Point2D>& points, vector<Point2D>& disp,
+		vector<uchar>& status, vector<double>& err, ThreadPool* pool = NULL,
+		bool backward = false, vector<double>* ncc = NULL);
+	int getLevels(){return nLevels;};
+
+private:
+	void allocate(CvSize size);
+	void release();
+	void reserveScratch(int workers);
+	void buildPyramid(IplImage* frame, int f);
+	bool samplePatch(IplImage* img, double x, double y, float* patch);
+	bool track(Point2D p, Point2D* q, double* err, double* ncc,
+		int worker, bool backward);
+	static void trackRange(void* arg, int worker, int begin, int end);
+
+	int levels;
+	int nLevels;
+	int winHalf;
+	int winSize;
+	int maxIter;
+	double epsilon;
+	int border;
+	CvSize frameSize;
+	IplImage* gray;
+	IplImage** levelBuf;
+	IplImage** pyr[2];
+	IplImage** derivX[2];
+	IplImage** derivY[2];
+	int prev;
+	int numFrames;
+	float* scratch;
+	int numScratch;
+};
@@ -0,0 +1,169 @@
+#include "StdAfx.h"
+#include "ResultWriter.h"
+
+ResultWriter::ResultWriter(const char* logFile, const char* frameDir, ImagePool* pool,
+	int numThreads, int maxQueued, int batchSize)
+	: encoders(numThreads), logWriter(1)
+{
+	this->log = NULL;
+	this->pool = (pool != NULL) ? pool : ImagePool::global();
+	this->maxQueued = MAX(1, maxQueued);
+	this->batchSize = MAX(1, batchSize);
+	this->batchLines = 0;
+	this->queued = 0;
+	this->numFrames = 0;
+	this->numStalls = 0;
+	this->numDropped = 0;
+	this->numRecords = 0;
+
+	if (frameDir != NULL && frameDir[0] != 0)
+	{
+		this->frameDir = frameDir;
+		if (this->frameDir[this->frameDir.size()-1] != '/' && this->frameDir[this->frameDir.size()-1] != '\\')
+			this->frameDir += "/";
+	}
+	if (logFile != NULL && logFile[0] != 0)
+	{
+		log = fopen(logFile, "w");
+		if (log == NULL)
+			printf("cannot write %s, boxes are not saved\n", logFile);
+		else
+			addRecord("frame,target,x,y,width,height,confidence\n");
+	}
+}
+
+ResultWriter::~ResultWriter(void)
+{
+	flush();
+	encoders.wait();
+	logWriter.wait();
+	if (log != NULL)
+		fclose(log);
+}
+
+void ResultWriter::writeBox(int frame, int target, Rect box, double confidence)
+{
+	char line[96];
+
+	sprintf(line, "%d,%d,%d,%d,%d,%d,%.3f\n", frame, target, box.left, box.upper,
+		box.width, box.height, confidence);
+	addRecord(line);
+	numRecords++;
+}
+
+void ResultWriter::writeLost(int frame, int target)
+{
+	char line[64];
+
+	sprintf(line, "%d,%d,0,0,0,0,-1\n", frame, target);
+	addRecord(line);
+	numRecords++;
+}
+
+/* the boxes of all targets of tracker, lost or not */
+void ResultWriter::writeTargets(int frame, MultiTargetTracker* tracker)
+{
+	for (int i=0;i<tracker->getNumTargets();i++)
+	{
+		if (tracker->isLost(i))
+			writeLost(frame, i);
+		else
+			writeBox(frame, i, tracker->getBox(i), tracker->getConfidence(i));
+	}
+}
+
+void ResultWriter::addRecord(const char* line)
+{
+	if (log == NULL)
+		return;
+	batch += line;
+	if (++batchLines >= batchSize)
+		flush();
+}
+
+/* hand the collected log lines to the log thread */
+void ResultWriter::flush()
+{
+	LogJob* job;
+
+	if (batch.empty())
+		return;
+	job = new LogJob;
+	job->self = this;
+	job->text.swap(batch);
+	batchLines = 0;
+	logWriter.submit(logTask, job);
+}
+
+void ResultWriter::logTask(void* arg, int worker)
+{
+	LogJob* job = (LogJob*)arg;
+
+	fwrite(job->text.data(), 1, job->text.size(), job->self->log);
+	delete job;
+}
+
+/*
+Queues img, the frame as painted, for encoding as frame number frame.
+
+@return false if no buffer could be had for the copy and the frame was
+	dropped
+*/
+bool ResultWriter::writeFrame(int frame, const IplImage* img)
+{
+	EncodeJob* job;
+	IplImage* copy;
+	char name[32];
+
+	if (frameDir.empty() || img == NULL)
+		return false;
+
+	mutex.lock();
+	if (queued >= maxQueued)
+	{
+		numStalls++;
+		while (queued >= maxQueued)
+			encoded.wait(mutex);
+	}
+	mutex.unlock();
+
+	copy = pool->clone(img);
+	if (copy == NULL)
+	{
+		/* the pool's cap is taken, let the queued frames give buffers back */
+		encoders.wait();
+		copy = pool->clone(img);
+	}
+	if (copy == NULL)
+	{
+		numDropped++;
+		return false;
+	}
+
+	sprintf(name, "frame%08d.jpg", frame);
+	job = new EncodeJob;
+	job->self = this;
+	job->image = FrameView(copy, pool);
+	job->filename = frameDir + name;
+	mutex.lock();
+	queued++;
+	mutex.unlock();
+	numFrames++;
+	encoders.submit(encodeTask, job);
+	return true;
+}
+
+void ResultWriter::encodeTask(void* arg, int worker)
+{
+	EncodeJob* job = (EncodeJob*)arg;
+	ResultWriter* self = job->self;
+
+	cvSaveImage(job->filename.c_str(), job->image.get());
+	/* the buffer goes back to the pool with the view */
+	delete job;
+
+	self->mutex.lock();
+	self->queued--;
+	self->encoded.signal();
+	self->mutex.unlock();
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "Thread.h"
+#include "FrameView.h"
+#include "Regions.h"
+#include <string>
+
+class ImagePool;
+class MultiTargetTracker;
+
+/*
+Writes tracking results off the tracking thread.  Annotated frames are
+copied into pool buffers and encoded as frameNNNNNNNN.jpg by worker
+threads; at most maxQueued frames wait for encoding, beyond that
+writeFrame() waits for a worker (a stall).  Boxes go to a CSV trajectory
+log, one "frame,target,x,y,width,height,confidence" line per target and
+frame, lost targets as zeros with a confidence of -1; lines are collected
+and written by a log thread batchSize lines at a time.  Everything queued
+is written when the writer is deleted.
+*/
+class ResultWriter
+{
+public:
+	/* logFile or frameDir of NULL or "" writes no log or no frames; pool of
+	NULL takes frame copies from the global pool */
+	ResultWriter(const char* logFile, const char* frameDir, ImagePool* pool = NULL,
+		int numThreads = 2, int maxQueued = 8, int batchSize = 64);
+	~ResultWriter(void);
+	bool isLogOpen(){return log != NULL;};
+	bool writesFrames(){return !frameDir.empty();};
+	void writeBox(int frame, int target, Rect box, double confidence);
+	void writeLost(int frame, int target);
+	void writeTargets(int frame, MultiTargetTracker* tracker);
+	bool writeFrame(int frame, const IplImage* img);
+	void flush();
+
+	int getNumFrames(){return numFrames;};
+	int getNumStalls(){return numStalls;};
+	int getNumDropped(){return numDropped;};
+	int getNumRecords(){return numRecords;};
+
+private:
+	struct EncodeJob
+	{
+		ResultWriter* self;
+		FrameView image;
+		std::string filename;
+	};
+	struct LogJob
+	{
+		ResultWriter* self;
+		std::string text;
+	};
+	void addRecord(const char* line);
+	static void encodeTask(void* arg, int worker);
+	static void logTask(void* arg, int worker);
+
+	FILE* log;
+	std::string frameDir;
+	ImagePool* pool;
+	int maxQueued;
+	int batchSize;
+	/* log lines not yet handed to the log thread */
+	std::string batch;
+	int batchLines;
+	int queued;
+	int numFrames;
+	int numStalls;
+	int numDropped;
+	int numRecords;
+	Mutex mutex;
+	Condition encoded;
+	ThreadPool encoders;
+	/* one thread, so batches reach the file in order */
+	ThreadPool logWriter;
+};
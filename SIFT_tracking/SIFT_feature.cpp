@@ -2,27 +2,76 @@
 #include "SIFT_feature.h"
 #include "utils.h"
 
+#include <limits.h>
+#if SIFT_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+/*
+Gets the pool the detector allocates its temporary images from
+
+@param opts detector options
+
+@return Returns opts->pool, or the global pool if opts names none
+*/
+static ImagePool* sift_pool( const struct sift_options* opts )
+{
+	return ( opts->pool )? opts->pool : ImagePool::global();
+}
+
+/*
+Takes an image from a pool.  Running out of the pool's memory cap only
+fails the detection at hand: the caller gives back what it took and the
+detector ends with no features, so other streams sharing the process
+carry on.
+
+@param pool image pool
+@param size image size
+@param depth image depth
+@param channels number of channels
+
+@return Returns an image of the pool, or NULL if the pool's cap is reached
+*/
+static IplImage* pool_create( ImagePool* pool, CvSize size, int depth,
+							 int channels )
+{
+	return pool->create( size, depth, channels );
+}
+
 SIFT_feature::SIFT_feature(void)
 {
+	init_sift_options( &opts );
 }
 
 SIFT_feature::~SIFT_feature(void)
 {
 }
 
-SIFT_feature::SIFT_feature(IplImage * img)
+SIFT_feature::SIFT_feature(IplImage * img, const struct sift_options* opts)
 {
+	if( opts )
+		this->opts = *opts;
+	else
+		init_sift_options( &this->opts );
 	sift_features(img);
 }
 
-SIFT_feature::SIFT_feature(IplImage *img,Rect trackingROI)
+SIFT_feature::SIFT_feature(IplImage *img,Rect trackingROI, const struct sift_options* opts)
 {
 	IplImage* Tracking_template;
-	Tracking_template = cvCreateImage(cvSize(trackingROI.width,trackingROI.height),
-		img->depth,
-		img->nChannels);
-	ConvertImage(img,Tracking_template,trackingROI);
-	sift_features(Tracking_template);
+	if( opts )
+		this->opts = *opts;
+	else
+		init_sift_options( &this->opts );
+	Tracking_template = pool_create( sift_pool( &this->opts ),
+		cvSize(trackingROI.width,trackingROI.height), img->depth, img->nChannels );
+	/* no template without room in the pool; the target gets no features */
+	if( Tracking_template )
+	{
+		ConvertImage(img,Tracking_template,trackingROI);
+		sift_features(Tracking_template);
+		sift_pool( &this->opts )->release( &Tracking_template );
+	}
 	this->MatchCount.assign((this->feat.end()-this->feat.begin()),0);
 }
 SIFT_feature_unit* SIFT_feature::GetFeat(int pos)
@@ -44,6 +93,111 @@ int SIFT_feature::GetMatchCount(int i)
 {
 	return this->MatchCount[i];
 }
+
+/* records t as the time feature i was last matched */
+void SIFT_feature::SetLastMatch(int i,int t)
+{
+	if (this->LastMatch.size()!=this->feat.size())
+		this->LastMatch.resize(this->feat.size(),0);
+	this->LastMatch[i] = t;
+}
+
+int SIFT_feature::GetLastMatch(int i)
+{
+	return (i<(int)this->LastMatch.size())? this->LastMatch[i] : 0;
+}
+
+/* appends a feature, unmatched so far, first seen at time t */
+void SIFT_feature::AddFeat(const struct SIFT_feature_unit& f,int t)
+{
+	this->MatchCount.resize(this->feat.size(),0);
+	this->LastMatch.resize(this->feat.size(),0);
+	this->feat.push_back(f);
+	this->MatchCount.push_back(0);
+	this->LastMatch.push_back(t);
+}
+
+/* removes a feature; the last feature takes its index */
+void SIFT_feature::RemoveFeat(int pos)
+{
+	int last = this->feat.size()-1;
+
+	this->MatchCount.resize(this->feat.size(),0);
+	this->LastMatch.resize(this->feat.size(),0);
+	this->feat[pos] = this->feat[last];
+	this->MatchCount[pos] = this->MatchCount[last];
+	this->LastMatch[pos] = this->LastMatch[last];
+	this->feat.pop_back();
+	this->MatchCount.pop_back();
+	this->LastMatch.pop_back();
+}
+
+/*
+Fills a set of detector options with the defaults from Def.h
+
+@param opts options to initialize
+*/
+void init_sift_options( struct sift_options* opts )
+{
+	opts->max_feats = SIFT_MAX_FEATS;
+	opts->budget_grid = SIFT_BUDGET_GRID;
+	opts->img_dbl = SIFT_IMG_DBL;
+	opts->obj_size = 0;
+	opts->obj_size_max = 0;
+	opts->fixed_point = SIFT_FIXED_POINT;
+	opts->stream = SIFT_STREAM;
+	opts->aa_decimate = SIFT_AA_DECIMATE;
+	opts->pool = NULL;
+}
+
+/*
+Measures how well a feature set reproduces a reference set, e.g. the
+fixed-point pyramid against the float one on the same frame.  A reference
+feature is repeated if a test feature lies within max_dist pixels of it
+at a scale within a factor of 1.5.
+
+@param ref reference features
+@param test features to validate
+@param max_dist maximum keypoint position error in pixels
+@param mean_descr_dist output as the mean descriptor distance of the
+	repeated features; may be NULL
+
+@return Returns the fraction of reference features that are repeated
+*/
+double feature_repeatability( SIFT_feature* ref, SIFT_feature* test,
+							 double max_dist, double* mean_descr_dist )
+{
+	struct SIFT_feature_unit* f1, * f2, * best;
+	double d, best_d, descr_sum = 0;
+	int i, j, m = 0;
+
+	for( i = 0; i < ref->GetLength(); i++ )
+	{
+		f1 = ref->GetFeat( i );
+		best = NULL;
+		best_d = max_dist * max_dist;
+		for( j = 0; j < test->GetLength(); j++ )
+		{
+			f2 = test->GetFeat( j );
+			d = ( f1->x - f2->x ) * ( f1->x - f2->x ) +
+				( f1->y - f2->y ) * ( f1->y - f2->y );
+			if( d <= best_d  &&  f2->scl < 1.5 * f1->scl  &&  f1->scl < 1.5 * f2->scl )
+			{
+				best_d = d;
+				best = f2;
+			}
+		}
+		if( best )
+		{
+			descr_sum += sqrt( descr_dist_sq( f1, best ) );
+			m++;
+		}
+	}
+
+	if( mean_descr_dist )
+		*mean_descr_dist = ( m )? descr_sum / m : 0;
+	return ( ref->GetLength() )? (double)m / ref->GetLength() : 0;
+}
 /*
 Reads image features from file.  The file should be formatted as from
 the code provided by the Visual Geometry Group at Oxford:
@@ -65,11 +219,20 @@ http://www.cs.ubc.ca/~lowe/keypoints
 @return Returns the number of features imported from filename or -1 on error
 */
 
-IplImage* create_init_img( IplImage*, int, double );
-IplImage* convert_to_gray32( IplImage* );
-IplImage*** build_gauss_pyr( IplImage*, int, int, double );
-IplImage* downsample( IplImage* );
-IplImage*** build_dog_pyr( IplImage***, int, int );
+void choose_scale_range( int, int, double, int, double*, int* );
+IplImage* create_init_img( IplImage*, double, double, int, ImagePool* );
+IplImage* convert_to_gray32( IplImage*, ImagePool* );
+IplImage* convert_to_gray16( IplImage*, ImagePool* );
+int smooth_level( IplImage*, IplImage*, double, ImagePool* );
+int smooth_fix( IplImage*, IplImage*, double, ImagePool* );
+static int smooth_fix_row( const short*, const int*, int, short*, int );
+static void smooth_fix_col( const short*, const short*, int, int, int*, int );
+IplImage*** build_gauss_pyr( IplImage*, int, int, double, int, ImagePool* );
+void decimate_2x( IplImage*, IplImage*, int );
+void decimate_row_32f( const float*, const float*, float*, int, int );
+void decimate_row_16s( const short*, const short*, short*, int, int );
+static int check_decimate_level( IplImage*, int, int );
+IplImage*** build_dog_pyr( IplImage***, int, int, ImagePool* );
 int is_extremum( IplImage***, int, int, int, int );
 struct SIFT_feature_unit* interp_extremum( IplImage***, int, int, int, int, int, double);
 void interp_step( IplImage***, int, int, int, int, double*, double*, double* );
@@ -91,7 +254,26 @@ void hist_to_descr( double***, int, int, struct SIFT_feature_unit* );
 void normalize_descr( struct SIFT_feature_unit* );
 bool feature_cmp( struct SIFT_feature_unit , struct SIFT_feature_unit );
 void release_descr_hist( double****, int );
-void release_pyr( IplImage****, int, int );
+void release_pyr( IplImage****, int, int, ImagePool* );
+
+/* 0 to run the pyramid kernels on the scalar code only, for checking */
+static int pyr_simd = 1;
+
+/*
+Reads a pyramid level pixel on the 32-bit float scale, whatever the depth
+of the level.  16-bit fixed-point levels are rescaled by SIFT_FIX_ONE.
+
+@param img a 32-bit float or 16-bit fixed-point pyramid level
+@param r row
+@param c column
+@return Returns the value of the pixel at (\a r, \a c) in \a img
+*/
+static __inline float pyr_pixval( IplImage* img, int r, int c )
+{
+	if( img->depth == IPL_DEPTH_16S )
+		return pixval16s( img, r, c ) / (float)SIFT_FIX_ONE;
+	return pixval32f( img, r, c );
+}
 
 int SIFT_feature::import_features( char* filename, int type)
 {
@@ -730,22 +912,36 @@ void SIFT_feature::draw_lowe_feature( ImageHandler* imgh, unsigned pos, CvScalar
 	imgh->paintLine(end,h2,Color(color.val[0],color.val[1],color.val[2]),1);
 }
 
+/*
+Detects features with the detector chosen by the options.  When the image
+pool cannot hold the whole pyramid, the streaming detector, whose bands
+only grow with the image width, is tried instead; if that does not fit
+either, the image gets no features.
+
+@param img the image in which to detect features
+*/
 void SIFT_feature::sift_features( IplImage* img )
 {
-	 sift_features( img, SIFT_INTVLS, SIFT_SIGMA, SIFT_CONTR_THR,
-		SIFT_CURV_THR, SIFT_IMG_DBL, SIFT_DESCR_WIDTH,
-		SIFT_DESCR_HIST_BINS );
+	if( ! opts.stream  &&
+		sift_features( img, SIFT_INTVLS, SIFT_SIGMA, SIFT_CONTR_THR,
+			SIFT_CURV_THR, opts.img_dbl, SIFT_DESCR_WIDTH,
+			SIFT_DESCR_HIST_BINS ) )
+		return;
+	sift_features_stream( img, SIFT_INTVLS, SIFT_SIGMA, SIFT_CONTR_THR,
+		SIFT_CURV_THR, SIFT_DESCR_WIDTH, SIFT_DESCR_HIST_BINS );
 }
 
-void SIFT_feature::sift_features( IplImage* img, int intvls,
+int SIFT_feature::sift_features( IplImage* img, int intvls,
 				   double sigma, double contr_thr, int curv_thr,
 				   int img_dbl, int descr_width, int descr_hist_bins )
 {
 	IplImage* init_img;
 	IplImage*** gauss_pyr, *** dog_pyr;
+	ImagePool* pool = sift_pool( &opts );
 	CvMemStorage* storage;
 	//CvSeq* features;
-	int octvs, i, n = 0;
+	int octvs, max_octvs, min_size, i, n = 0;
+	double img_scl;
 	double start_time;
 	double during_time;
 
@@ -756,17 +952,45 @@ void SIFT_feature::sift_features( IplImage* img, int intvls,
 	/*if( ! feat )
 		fatal_error( "NULL pointer error, %s, line %d",  __FILE__, __LINE__ );*/
 
+	/* pick the scale of the pyramid base relative to img */
+	if( img_dbl == SIFT_IMG_DBL_ADAPTIVE )
+	{
+		min_size = ( opts.obj_size > 0 )? opts.obj_size : MIN( img->width, img->height );
+		choose_scale_range( min_size, MAX( min_size, opts.obj_size_max ), sigma, intvls,
+			&img_scl, &max_octvs );
+	}
+	else
+	{
+		img_scl = ( img_dbl )? 2.0 : 1.0;
+		max_octvs = INT_MAX;
+	}
+
 	/* build scale space pyramid; smallest dimension of top level is ~4 pixels */
-	init_img = create_init_img( img, img_dbl, sigma );
+	init_img = create_init_img( img, img_scl, sigma, opts.fixed_point, pool );
+	if( ! init_img )
+		return 0;
 	octvs = (int)log( (double)MIN( init_img->width, init_img->height ) ) / log(2.0) - 2;
+	octvs = MAX( 1, MIN( octvs, max_octvs ) );
 
 	start_time = clock();
-	gauss_pyr = build_gauss_pyr( init_img, octvs, intvls, sigma );
+	gauss_pyr = build_gauss_pyr( init_img, octvs, intvls, sigma,
+		opts.aa_decimate, pool );
+	if( ! gauss_pyr )
+	{
+		pool->release( &init_img );
+		return 0;
+	}
 	during_time = (clock() - start_time)/CLOCKS_PER_SEC;
 	printf("time of build gauss_pyr:%f\n",during_time);
 
 	start_time = clock();
-	dog_pyr = build_dog_pyr( gauss_pyr, octvs, intvls );
+	dog_pyr = build_dog_pyr( gauss_pyr, octvs, intvls, pool );
+	if( ! dog_pyr )
+	{
+		pool->release( &init_img );
+		release_pyr( &gauss_pyr, octvs, intvls + 3, pool );
+		return 0;
+	}
 	during_time = (clock() - start_time)/CLOCKS_PER_SEC;
 	printf("time of build dob_pyr:%f\n",during_time);
 
@@ -777,12 +1001,20 @@ void SIFT_feature::sift_features( IplImage* img, int intvls,
 	during_time = (clock() - start_time)/CLOCKS_PER_SEC;
 	printf("time of scale_space_extrema:%f\n",during_time);
 
+	/* keep the budgeted keypoints before orientations and descriptors */
+	select_budget_features( opts.max_feats, opts.budget_grid,
+		init_img->width, init_img->height );
+
 	start_time = clock();
 	calc_feature_scales( sigma, intvls );
 
-	if( img_dbl )
-		adjust_for_img_dbl(  );
+	if( img_scl != 1.0 )
+		adjust_for_img_scl( img_scl );
 	calc_feature_oris(  gauss_pyr );
+
+	/* extra orientations may have pushed the count over the budget again */
+	select_budget_features( opts.max_feats, opts.budget_grid,
+		img->width, img->height );
 	compute_descriptors( gauss_pyr, descr_width, descr_hist_bins );
 	during_time = (clock() - start_time)/CLOCKS_PER_SEC;
 	printf("time of compute_descriptors:%f\n",during_time);
@@ -800,52 +1032,888 @@ void SIFT_feature::sift_features( IplImage* img, int intvls,
 	}
 
 	cvReleaseMemStorage( &storage );
-	cvReleaseImage( &init_img );
-	release_pyr( &gauss_pyr, octvs, intvls + 3 );
-	release_pyr( &dog_pyr, octvs, intvls + 2 );
-//	return n;
+	pool->release( &init_img );
+	release_pyr( &gauss_pyr, octvs, intvls + 3, pool );
+	release_pyr( &dog_pyr, octvs, intvls + 2, pool );
+	return 1;
 }
 
-IplImage* create_init_img( IplImage* img, int img_dbl, double sigma )
+/*
+Sliding row band of one octave of the streaming detector.  Every band of
+the octave holds the same octave rows, starting at row top.
+*/
+struct stream_octave
 {
-	IplImage* gray, * dbl;
-	float sig_diff;
+	int w, h;                      /**< size of the whole octave */
+	int top;                       /**< octave row held in row 0 of the bands */
+	int raw_front;                 /**< input rows pushed so far (octave 0 only) */
+	int* front;                    /**< rows computed so far per Gaussian level */
+	int dog_front;                 /**< rows computed so far in the DoG levels */
+	int det;                       /**< next row to scan for extrema */
+	IplImage* raw;                 /**< unsmoothed input band (octave 0 only) */
+	IplImage** gauss;              /**< intvls + 3 Gaussian level bands */
+	IplImage** dog;                /**< intvls + 2 DoG level bands */
+};
+
+/* state of the streaming detector shared by all octaves */
+struct stream_state
+{
+	int octvs;                     /**< number of octaves */
+	int intvls;                    /**< intervals per octave */
+	int cap;                       /**< rows per band */
+	int support;                   /**< rows needed around a keypoint */
+	int* rad;                      /**< kernel radius per level, rad[0] for the initial blur */
+	float** kern;                  /**< Gaussian kernels of 2 * rad + 1 taps */
+	float* tmp;                    /**< one vertically filtered row plus padding */
+	IplImage* views;               /**< headers behind gview and dview */
+	IplImage*** gview;             /**< Gaussian bands indexed like a pyramid */
+	IplImage*** dview;             /**< DoG bands indexed like a pyramid */
+	struct stream_octave* oct;     /**< octave bands */
+	ImagePool* pool;               /**< pool of the bands */
+};
+
+/*
+Reflects an index into [0, n) the way cvSmooth() extends image borders.
+
+@param x index
+@param n number of valid indices
+
+@return Returns the reflected index
+*/
+static int reflect101( int x, int n )
+{
+	if( n == 1 )
+		return 0;
+	while( x < 0  ||  x >= n )
+		x = ( x < 0 )? -x : 2 * n - 2 - x;
+	return x;
+}
+
+/*
+Returns a pointer to a row of a 32-bit float band
+*/
+static __inline float* stream_row( IplImage* band, int r )
+{
+	return (float*)( band->imageData + band->widthStep * r );
+}
+
+/*
+Builds a normalized 1D Gaussian kernel of the size cvSmooth() picks for
+32-bit float images.
+
+@param sig standard deviation of the Gaussian
+@param rad output as the kernel radius
+
+@return Returns a kernel of 2 * rad + 1 taps
+*/
+static float* stream_kernel( double sig, int* rad )
+{
+	float* kern;
+	double sum = 0;
+	int i;
+
+	*rad = ( cvRound( sig * 4 * 2 + 1 ) | 1 ) / 2;
+	kern = (float*)malloc( ( 2 * *rad + 1 ) * sizeof(float) );
+	for( i = -*rad; i <= *rad; i++ )
+	{
+		kern[i + *rad] = (float)exp( -i * i / ( 2.0 * sig * sig ) );
+		sum += kern[i + *rad];
+	}
+	for( i = 0; i <= 2 * *rad; i++ )
+		kern[i] = (float)( kern[i] / sum );
+	return kern;
+}
+
+/*
+Computes one row of a smoothed level from the band of the level below.
+
+@param st streaming detector state
+@param src source band
+@param so octave of src
+@param y octave row to compute
+@param l level whose kernel is applied
+@param dst output row
+*/
+static void stream_blur_row( struct stream_state* st, IplImage* src,
+							struct stream_octave* so, int y, int l, float* dst )
+{
+	const float* kern = st->kern[l];
+	const float* in;
+	float* t = st->tmp + st->rad[l];
+	float v;
+	int rad = st->rad[l], w = so->w, c, k;
+
+	/* vertical pass into a padded row */
+	for( c = 0; c < w; c++ )
+		t[c] = 0;
+	for( k = -rad; k <= rad; k++ )
+	{
+		in = stream_row( src, reflect101( y + k, so->h ) - so->top );
+		for( c = 0; c < w; c++ )
+			t[c] += kern[k + rad] * in[c];
+	}
+	for( k = 1; k <= rad; k++ )
+	{
+		t[-k] = t[ reflect101( -k, w ) ];
+		t[w - 1 + k] = t[ reflect101( w - 1 + k, w ) ];
+	}
 
-	gray = convert_to_gray32( img );
-	if( img_dbl )
+	/* horizontal pass */
+	for( c = 0; c < w; c++ )
+	{
+		for( k = 0, v = 0; k <= 2 * rad; k++ )
+			v += kern[k] * t[c + k - rad];
+		dst[c] = v;
+	}
+}
+
+/*
+Drops rows that no consumer of an octave needs any more so that octave row
+\a row fits in its band.
+
+@param st streaming detector state
+@param o octave
+@param row octave row about to be written
+*/
+static void stream_room( struct stream_state* st, int o, int row )
+{
+	struct stream_octave* so = st->oct + o;
+	int keep, shift, l, levels = st->intvls + 3;
+
+	if( row - so->top < st->cap )
+		return;
+
+	/* keypoint support, the next row of every blur, DoG and next octave */
+	keep = row;
+	if( so->det < so->h - SIFT_IMG_BORDER )
+		keep = MIN( keep, so->det - st->support );
+	if( so->raw  &&  so->front[0] < so->h )
+		keep = MIN( keep, so->front[0] - st->rad[0] );
+	for( l = 1; l < levels; l++ )
+		if( so->front[l] < so->h )
+			keep = MIN( keep, so->front[l] - st->rad[l] );
+	keep = MIN( keep, so->dog_front );
+	if( o + 1 < st->octvs  &&  st->oct[o+1].front[0] < st->oct[o+1].h )
+		keep = MIN( keep, 2 * st->oct[o+1].front[0] );
+	if( keep <= so->top  ||  row - keep >= st->cap )
+		fatal_error( "stream band too small, %s, line %d", __FILE__, __LINE__ );
+
+	shift = ( keep - so->top ) * so->gauss[0]->widthStep;
+	if( so->raw )
+		memmove( so->raw->imageData, so->raw->imageData + shift,
+			( so->raw_front - keep ) * so->raw->widthStep );
+	for( l = 0; l < levels; l++ )
+		memmove( so->gauss[l]->imageData, so->gauss[l]->imageData + shift,
+			( so->front[l] - keep ) * so->gauss[l]->widthStep );
+	for( l = 0; l < levels - 1; l++ )
+		memmove( so->dog[l]->imageData, so->dog[l]->imageData + shift,
+			( so->dog_front - keep ) * so->dog[l]->widthStep );
+	so->top = keep;
+}
+
+/*
+Computes every row of an octave that the rows pushed so far allow: the
+Gaussian levels, the DoG levels and the base rows of the next octave.
+
+@param st streaming detector state
+@param o octave
+*/
+static void stream_produce( struct stream_state* st, int o )
+{
+	struct stream_octave* so = st->oct + o, * next;
+	float* a, * b, * d;
+	int l, c, levels = st->intvls + 3;
+
+	/* octave 0 starts from the raw input rows */
+	if( so->raw )
+		while( so->front[0] < so->h  &&
+			so->raw_front >= MIN( so->front[0] + st->rad[0] + 1, so->h ) )
+		{
+			stream_room( st, o, so->front[0] );
+			stream_blur_row( st, so->raw, so, so->front[0], 0,
+				stream_row( so->gauss[0], so->front[0] - so->top ) );
+			so->front[0]++;
+		}
+
+	/* blur each level's rows into the next one */
+	for( l = 1; l < levels; l++ )
+		while( so->front[l] < so->h  &&
+			so->front[l-1] >= MIN( so->front[l] + st->rad[l] + 1, so->h ) )
+		{
+			stream_room( st, o, so->front[l] );
+			stream_blur_row( st, so->gauss[l-1], so, so->front[l], l,
+				stream_row( so->gauss[l], so->front[l] - so->top ) );
+			so->front[l]++;
+		}
+
+	/* a DoG row needs the row in every Gaussian level */
+	while( so->dog_front < so->front[levels-1] )
+	{
+		stream_room( st, o, so->dog_front );
+		for( l = 0; l < levels - 1; l++ )
+		{
+			a = stream_row( so->gauss[l+1], so->dog_front - so->top );
+			b = stream_row( so->gauss[l], so->dog_front - so->top );
+			d = stream_row( so->dog[l], so->dog_front - so->top );
+			for( c = 0; c < so->w; c++ )
+				d[c] = a[c] - b[c];
+		}
+		so->dog_front++;
+	}
+
+	/* base of the next octave is every other row and column of level intvls */
+	if( o + 1 < st->octvs )
+	{
+		next = so + 1;
+		while( next->front[0] < next->h  &&
+			2 * next->front[0] < so->front[st->intvls] )
+		{
+			stream_room( st, o + 1, next->front[0] );
+			a = stream_row( so->gauss[st->intvls], 2 * next->front[0] - so->top );
+			d = stream_row( next->gauss[0], next->front[0] - next->top );
+			decimate_row_32f( a, a, d, next->w, 0 );
+			next->front[0]++;
+		}
+	}
+}
+
+/*
+Points an image header at the valid rows of a band
+*/
+static void stream_view( IplImage* view, IplImage* band, int w, int rows )
+{
+	cvInitImageHeader( view, cvSize( w, rows ), IPL_DEPTH_32F, 1, IPL_ORIGIN_TL, 4 );
+	view->widthStep = band->widthStep;
+	view->imageSize = band->widthStep * rows;
+	view->imageData = view->imageDataOrigin = band->imageData;
+}
+
+/*
+Refreshes the pyramid views of an octave after its bands changed
+
+@param st streaming detector state
+@param o octave
+*/
+static void stream_views( struct stream_state* st, int o )
+{
+	struct stream_octave* so = st->oct + o;
+	int l, levels = st->intvls + 3;
+
+	for( l = 0; l < levels; l++ )
+		stream_view( st->gview[o][l], so->gauss[l], so->w, so->front[l] - so->top );
+	for( l = 0; l < levels - 1; l++ )
+		stream_view( st->dview[o][l], so->dog[l], so->w, so->dog_front - so->top );
+}
+
+/*
+Allocates the bands of the streaming detector.  Band height depends only
+on the detector parameters, so memory grows with image width, not area.
+
+@param st streaming detector state to initialize
+@param w image width
+@param h image height
+@param octvs number of octaves
+@param intvls intervals per octave
+@param sigma amount of Gaussian smoothing per octave
+@param descr_width width of the descriptor's histogram array
+@param pool pool to take the bands from
+
+@return Returns 1 on success or 0 if the pool could not supply every band;
+	the state is to be released with stream_release() either way
+*/
+static int stream_init( struct stream_state* st, int w, int h, int octvs,
+						int intvls, double sigma, int descr_width,
+						ImagePool* pool )
+{
+	struct stream_octave* so;
+	double sig, sig_prev, sig_total, k, scl_max;
+	int levels = intvls + 3, rad_sum = 0, rad_max = 0, ok = 1, o, l;
+
+	st->octvs = octvs;
+	st->intvls = intvls;
+	st->pool = pool;
+	st->rad = (int*)calloc( levels, sizeof(int) );
+	st->kern = (float**)calloc( levels, sizeof(float*) );
+
+	/* same sigmas as create_init_img() and build_gauss_pyr() */
+	k = pow( 2.0, 1.0 / intvls );
+	for( l = 0; l < levels; l++ )
+	{
+		if( l == 0 )
+			sig = sqrt( sigma * sigma - SIFT_INIT_SIGMA * SIFT_INIT_SIGMA );
+		else
+		{
+			sig_prev = pow( k, l - 1 ) * sigma;
+			sig_total = sig_prev * k;
+			sig = sqrt( sig_total * sig_total - sig_prev * sig_prev );
+		}
+		st->kern[l] = stream_kernel( sig, &st->rad[l] );
+		rad_sum += st->rad[l];
+		rad_max = MAX( rad_max, st->rad[l] );
+	}
+
+	/* descriptor and orientation support of the coarsest keypoint scale */
+	scl_max = sigma * pow( 2.0, ( intvls + 0.5 ) / intvls );
+	st->support = cvCeil( MAX( SIFT_DESCR_SCL_FCTR * scl_max * sqrt( 2.0 ) *
+		( descr_width + 1.0 ) * 0.5 + 1, SIFT_ORI_RADIUS * scl_max ) ) +
+		SIFT_MAX_INTERP_STEPS + 2;
+	st->cap = 4 * st->support + 2 * rad_sum;
+
+	st->tmp = (float*)malloc( ( w + 2 * rad_max ) * sizeof(float) );
+	st->oct = (struct stream_octave*)calloc( octvs, sizeof(struct stream_octave) );
+	st->views = (IplImage*)calloc( octvs * ( 2 * levels - 1 ), sizeof(IplImage) );
+	st->gview = (IplImage***)calloc( octvs, sizeof(IplImage**) );
+	st->dview = (IplImage***)calloc( octvs, sizeof(IplImage**) );
+	for( o = 0; o < octvs; o++ )
+	{
+		so = st->oct + o;
+		so->w = ( o == 0 )? w : st->oct[o-1].w / 2;
+		so->h = ( o == 0 )? h : st->oct[o-1].h / 2;
+		so->det = SIFT_IMG_BORDER;
+		so->front = (int*)calloc( levels, sizeof(int) );
+		so->gauss = (IplImage**)calloc( levels, sizeof(IplImage*) );
+		so->dog = (IplImage**)calloc( levels - 1, sizeof(IplImage*) );
+		for( l = 0; l < levels; l++ )
+			ok &= ( so->gauss[l] = pool_create( pool, cvSize( so->w, st->cap ),
+				IPL_DEPTH_32F, 1 ) ) != NULL;
+		for( l = 0; l < levels - 1; l++ )
+			ok &= ( so->dog[l] = pool_create( pool, cvSize( so->w, st->cap ),
+				IPL_DEPTH_32F, 1 ) ) != NULL;
+		if( o == 0 )
+			ok &= ( so->raw = pool_create( pool, cvSize( so->w, st->cap ),
+				IPL_DEPTH_32F, 1 ) ) != NULL;
+
+		st->gview[o] = (IplImage**)calloc( levels, sizeof(IplImage*) );
+		st->dview[o] = (IplImage**)calloc( levels - 1, sizeof(IplImage*) );
+		for( l = 0; l < levels; l++ )
+			st->gview[o][l] = st->views + o * ( 2 * levels - 1 ) + l;
+		for( l = 0; l < levels - 1; l++ )
+			st->dview[o][l] = st->views + o * ( 2 * levels - 1 ) + levels + l;
+	}
+	return ok;
+}
+
+/*
+Releases the bands of the streaming detector
+
+@param st streaming detector state
+*/
+static void stream_release( struct stream_state* st )
+{
+	struct stream_octave* so;
+	int levels = st->intvls + 3, o, l;
+
+	for( o = 0; o < st->octvs; o++ )
+	{
+		so = st->oct + o;
+		for( l = 0; l < levels; l++ )
+			st->pool->release( &so->gauss[l] );
+		for( l = 0; l < levels - 1; l++ )
+			st->pool->release( &so->dog[l] );
+		if( so->raw )
+			st->pool->release( &so->raw );
+		free( so->gauss );
+		free( so->dog );
+		free( so->front );
+		free( st->gview[o] );
+		free( st->dview[o] );
+	}
+	for( l = 0; l < levels; l++ )
+		free( st->kern[l] );
+	free( st->kern );
+	free( st->rad );
+	free( st->tmp );
+	free( st->views );
+	free( st->gview );
+	free( st->dview );
+	free( st->oct );
+}
+
+/*
+Streaming version of sift_features() for large images.  Rows of the input
+move down through sliding bands of every octave, and keypoints are
+detected, oriented and described as soon as the rows around them are in
+the bands, so peak memory is proportional to the image width.  The
+pyramid is built from the input at its native resolution with 32-bit
+float levels; img_dbl and fixed_point do not apply.  The keypoint budget
+is applied once all bands have been scanned.
+
+@param img the image in which to detect features
+@param intvls the number of intervals sampled per octave of scale space
+@param sigma the amount of Gaussian smoothing applied to each image level
+	before building the scale space representation for an octave
+@param contr_thr a threshold on the value of the scale space function
+	\f$\left|D(\hat{x})\right|\f$
+@param curv_thr threshold on a feature's ratio of principle curvatures
+@param descr_width the width, \f$n\f$, of the \f$n \times n\f$ array of
+	orientation histograms used to compute a feature's descriptor
+@param descr_hist_bins the number of orientations in each of the
+	histograms in the array used to compute a feature's descriptor
+
+@return Returns 1, or 0 if the image pool could not hold the bands and no
+	features were detected
+*/
+int SIFT_feature::sift_features_stream( IplImage* img, int intvls,
+				   double sigma, double contr_thr, int curv_thr,
+				   int descr_width, int descr_hist_bins )
+{
+	struct stream_state st;
+	struct stream_octave* so;
+	vector<struct SIFT_feature_unit> done;
+	IplImage* gray8, row_hdr, img_row;
+	int octvs, levels = intvls + 3, o, i, y;
+
+	/* check arguments */
+	if( ! img )
+		fatal_error( "NULL pointer error, %s, line %d",  __FILE__, __LINE__ );
+
+	octvs = (int)log( (double)MIN( img->width, img->height ) ) / log(2.0) - 2;
+	octvs = MAX( 1, octvs );
+	if( ! stream_init( &st, img->width, img->height, octvs, intvls, sigma,
+		descr_width, sift_pool( &opts ) ) )
+	{
+		stream_release( &st );
+		return 0;
+	}
+	gray8 = pool_create( st.pool, cvSize( img->width, 1 ), IPL_DEPTH_8U, 1 );
+	if( ! gray8 )
+	{
+		stream_release( &st );
+		return 0;
+	}
+	done.swap( feat );
+
+	for( y = 0; y < img->height; y++ )
+	{
+		/* push one input row, converted as in convert_to_gray32() */
+		so = st.oct;
+		stream_room( &st, 0, y );
+		stream_view( &row_hdr, so->raw, so->w, 1 );
+		row_hdr.imageData += ( y - so->top ) * so->raw->widthStep;
+		/* a header on row y leaves the caller's image untouched */
+		cvInitImageHeader( &img_row, cvSize( img->width, 1 ), img->depth,
+			img->nChannels, img->origin, img->align );
+		img_row.widthStep = img->widthStep;
+		img_row.imageSize = img->widthStep;
+		img_row.imageData = img_row.imageDataOrigin = img->imageData + y * img->widthStep;
+		if( img->nChannels == 1 )
+			cvCopy( &img_row, gray8, NULL );
+		else
+			cvCvtColor( &img_row, gray8, CV_RGB2GRAY );
+		cvConvertScale( gray8, &row_hdr, 1.0 / 255.0, 0 );
+		so->raw_front++;
+
+		for( o = 0; o < octvs; o++ )
+		{
+			so = st.oct + o;
+			stream_produce( &st, o );
+
+			/* scan every row whose keypoint support is complete */
+			while( so->det < so->h - SIFT_IMG_BORDER  &&
+				so->dog_front >= MIN( so->det + st.support + 1, so->h ) )
+			{
+				stream_views( &st, o );
+				for( i = 1; i <= intvls; i++ )
+					scan_extrema_row( st.dview, o, i, so->det - so->top,
+						intvls, contr_thr, curv_thr );
+				if( ! feat.empty() )
+					finish_band_features( st.gview, sigma, intvls, descr_width,
+						descr_hist_bins, o, so->top, done );
+				so->det++;
+			}
+		}
+	}
+
+	feat.swap( done );
+	select_budget_features( opts.max_feats, opts.budget_grid,
+		img->width, img->height );
+	sort( feat.begin(), feat.end(), feature_cmp );
+
+	st.pool->release( &gray8 );
+	stream_release( &st );
+	return 1;
+}
+
+/*
+Gives the features detected in a band their scales, orientations and
+descriptors, maps them from band rows to octave rows and moves them to
+an output array.
+
+@param gauss_pyr Gaussian band views indexed like a pyramid
+@param sigma amount of Gaussian smoothing per octave of scale space
+@param intvls intervals per octave of scale space
+@param d width of 2D array of orientation histograms
+@param n number of bins per orientation histogram
+@param octv octave of the band
+@param top octave row held in row 0 of the band
+@param out array receiving the finished features
+*/
+void SIFT_feature::finish_band_features( IplImage*** gauss_pyr, double sigma,
+										int intvls, int d, int n, int octv, int top,
+										vector<struct SIFT_feature_unit>& out )
+{
+	struct detection_data* ddata;
+	double offset = top * pow( 2.0, octv );
+
+	calc_feature_scales( sigma, intvls );
+	calc_feature_oris( gauss_pyr );
+	compute_descriptors( gauss_pyr, d, n );
+	for( unsigned i = 0; i < feat.size(); i++ )
 	{
-		sig_diff = sqrt( sigma * sigma - SIFT_INIT_SIGMA * SIFT_INIT_SIGMA * 4 );
-		dbl = cvCreateImage( cvSize( img->width*2, img->height*2 ),
-			IPL_DEPTH_32F, 1 );
-		cvResize( gray, dbl, CV_INTER_CUBIC );
-		cvSmooth( dbl, dbl, CV_GAUSSIAN, 0, 0, sig_diff, sig_diff );
-		cvReleaseImage( &gray );
-		return dbl;
+		ddata = feat_detection_data( (&feat[i]) );
+		ddata->r += top;
+		feat[i].y += offset;
+		feat[i].img_pt.y += offset;
 	}
+	out.insert( out.end(), feat.begin(), feat.end() );
+	feat.clear();
+}
+
+/*
+Picks the scale of the pyramid base and the number of octaves worth
+building for objects within a range of sizes.  Small objects are doubled
+as usual; large ones start at native or half resolution, since their
+finest-scale keypoints are too small to survive tracking anyway.  Octaves
+whose keypoints would exceed SIFT_ADAPT_MAX_SCL of the object are skipped.
+When one pass serves several objects, the smallest picks the base scale
+and the largest the octaves, so each gets the scales it would get alone.
+
+@param min_size short side of the smallest object in input pixels
+@param max_size short side of the largest object in input pixels
+@param sigma amount of Gaussian smoothing per octave
+@param intvls number of intervals per octave
+@param img_scl output as the scale of the pyramid base relative to the input
+@param max_octvs output as the largest useful number of octaves
+*/
+void choose_scale_range( int min_size, int max_size, double sigma, int intvls,
+						double* img_scl, int* max_octvs )
+{
+	double max_scl;
+
+	if( min_size < SIFT_ADAPT_DBL_SIZE )
+		*img_scl = 2.0;
+	else if( min_size < SIFT_ADAPT_HALF_SIZE )
+		*img_scl = 1.0;
 	else
+		*img_scl = 0.5;
+
+	/* octave o holds scales sigma * 2^o up to sigma * 2^(o+1), in base pixels */
+	max_scl = SIFT_ADAPT_MAX_SCL * max_size * *img_scl;
+	*max_octvs = ( max_scl > sigma )?
+		cvFloor( log( max_scl / sigma ) / log( 2.0 ) ) + 1 : 1;
+}
+
+/*
+Converts an image to 32-bit grayscale, resamples it to the pyramid base
+scale and smooths it to the initial pyramid sigma.  With \a fixed_point
+set the base is a 16-bit fixed-point image instead, and so is every level
+of the pyramids built from it.
+
+@param img input image
+@param img_scl scale of the pyramid base relative to img: 2 doubles img,
+	1 keeps it, and 0.5 halves it
+@param sigma amount of Gaussian smoothing per octave
+@param fixed_point 1 to build a 16-bit fixed-point base
+@param pool pool of the returned image and of the temporaries
+
+@return Returns the base image of the scale space pyramid, or NULL if the
+	pool's cap is reached
+*/
+IplImage* create_init_img( IplImage* img, double img_scl, double sigma,
+						  int fixed_point, ImagePool* pool )
+{
+	IplImage* gray, * base;
+	float sig_diff;
+
+	gray = ( fixed_point )? convert_to_gray16( img, pool ) :
+		convert_to_gray32( img, pool );
+	if( ! gray )
+		return NULL;
+	sig_diff = sqrt( sigma * sigma -
+		SIFT_INIT_SIGMA * SIFT_INIT_SIGMA * img_scl * img_scl );
+	if( img_scl != 1.0 )
 	{
-		sig_diff = sqrt( sigma * sigma - SIFT_INIT_SIGMA * SIFT_INIT_SIGMA );
-		cvSmooth( gray, gray, CV_GAUSSIAN, 0, 0, sig_diff, sig_diff );
-		return gray;
+		base = pool_create( pool, cvSize( cvRound( img->width * img_scl ),
+			cvRound( img->height * img_scl ) ), gray->depth, 1 );
+		if( ! base )
+		{
+			pool->release( &gray );
+			return NULL;
+		}
+		cvResize( gray, base, ( img_scl > 1.0 )? CV_INTER_CUBIC : CV_INTER_AREA );
+		pool->release( &gray );
 	}
+	else
+		base = gray;
+
+	if( ! smooth_level( base, base, sig_diff, pool ) )
+		pool->release( &base );
+	return base;
 }
 
-IplImage* convert_to_gray32( IplImage* img )
+/*
+Converts an image to 32-bit grayscale with gray levels in [0, 1]
+
+@param img an image
+@param pool pool of the returned image and of the temporaries
+
+@return Returns a 32-bit float grayscale version of img, or NULL if the
+	pool's cap is reached
+*/
+IplImage* convert_to_gray32( IplImage* img, ImagePool* pool )
 {
 	IplImage* gray8, * gray32;
-	int r, c;
 
-	gray8 = cvCreateImage( cvGetSize(img), IPL_DEPTH_8U, 1 );
-	gray32 = cvCreateImage( cvGetSize(img), IPL_DEPTH_32F, 1 );
+	gray32 = pool_create( pool, cvGetSize(img), IPL_DEPTH_32F, 1 );
+	if( ! gray32 )
+		return NULL;
+	if( img->nChannels == 1 )
+		cvConvertScale( img, gray32, 1.0 / 255.0, 0 );
+	else
+	{
+		gray8 = pool_create( pool, cvGetSize(img), IPL_DEPTH_8U, 1 );
+		if( ! gray8 )
+		{
+			pool->release( &gray32 );
+			return NULL;
+		}
+		cvCvtColor( img, gray8, CV_RGB2GRAY );
+		cvConvertScale( gray8, gray32, 1.0 / 255.0, 0 );
+		pool->release( &gray8 );
+	}
+	return gray32;
+}
+
+/*
+Converts an image to 16-bit fixed-point grayscale.  Gray levels keep
+SIFT_FIX_SHIFT fractional bits, so 255 maps to SIFT_FIX_ONE.
+
+@param img an image
+@param pool pool of the returned image and of the temporaries
 
+@return Returns a 16-bit signed grayscale version of img, or NULL if the
+	pool's cap is reached
+*/
+IplImage* convert_to_gray16( IplImage* img, ImagePool* pool )
+{
+	IplImage* gray8, * gray16;
+
+	gray16 = pool_create( pool, cvGetSize(img), IPL_DEPTH_16S, 1 );
+	if( ! gray16 )
+		return NULL;
 	if( img->nChannels == 1 )
-		gray8 = (IplImage*)cvClone( img );
+		cvConvertScale( img, gray16, 1 << SIFT_FIX_SHIFT, 0 );
 	else
+	{
+		gray8 = pool_create( pool, cvGetSize(img), IPL_DEPTH_8U, 1 );
+		if( ! gray8 )
+		{
+			pool->release( &gray16 );
+			return NULL;
+		}
 		cvCvtColor( img, gray8, CV_RGB2GRAY );
-	cvConvertScale( gray8, gray32, 1.0 / 255.0, 0 );
+		cvConvertScale( gray8, gray16, 1 << SIFT_FIX_SHIFT, 0 );
+		pool->release( &gray8 );
+	}
+	return gray16;
+}
 
-	cvReleaseImage( &gray8 );
-	return gray32;
+/*
+Gaussian smooths a pyramid level, using cvSmooth() on 32-bit float levels
+and the integer filter smooth_fix() on 16-bit fixed-point levels.
+
+@param src source level
+@param dst destination level of the same size and depth; may be src
+@param sig standard deviation of the Gaussian
+@param pool pool of the temporaries
+
+@return Returns 1, or 0 if the pool's cap left no room for the temporaries
+*/
+int smooth_level( IplImage* src, IplImage* dst, double sig, ImagePool* pool )
+{
+	if( src->depth == IPL_DEPTH_16S )
+		return smooth_fix( src, dst, sig, pool );
+	cvSmooth( src, dst, CV_GAUSSIAN, 0, 0, sig, sig );
+	return 1;
+}
+
+/*
+Separable Gaussian filter for 16-bit fixed-point levels, with the kernel
+size cvSmooth() picks for 32-bit float levels so that both pyramids are
+blurred alike.  The kernel is quantized to SIFT_FIX_KERN_SHIFT fractional
+bits and corrected so that it sums to exactly 1, and both passes
+accumulate in 32-bit integers, two taps at a time with SSE2.  Borders are
+replicated.  Row buffers come from the pool.
+
+@param src source level, IPL_DEPTH_16S
+@param dst destination level, IPL_DEPTH_16S; may be src
+@param sig standard deviation of the Gaussian
+@param pool pool of the temporaries
+
+@return Returns 1, or 0 if the pool's cap left no room for the temporaries
+*/
+int smooth_fix( IplImage* src, IplImage* dst, double sig, ImagePool* pool )
+{
+	IplImage* tmp, * kbuf, * rbuf, * abuf;
+	const short* p0, * p1;
+	short* row, * out;
+	int* kern, * acc;
+	double sum;
+	int rad, ksize, ktaps, isum, r, c, i;
+	int w = src->width, h = src->height;
+	int rnd = 1 << ( SIFT_FIX_KERN_SHIFT - 1 );
+
+	/* taps are taken in pairs, so an odd kernel gets a zero tap at its end */
+	rad = ( cvRound( sig * 4 * 2 + 1 ) | 1 ) / 2;
+	ksize = 2 * rad + 1;
+	ktaps = ksize + 1;
+	tmp = pool_create( pool, cvGetSize(src), IPL_DEPTH_16S, 1 );
+	kbuf = pool_create( pool, cvSize( ktaps, 1 ), IPL_DEPTH_32S, 1 );
+	rbuf = pool_create( pool, cvSize( w + ktaps, 1 ), IPL_DEPTH_16S, 1 );
+	abuf = pool_create( pool, cvSize( w, 1 ), IPL_DEPTH_32S, 1 );
+	if( ! tmp  ||  ! kbuf  ||  ! rbuf  ||  ! abuf )
+	{
+		pool->release( &tmp );
+		pool->release( &kbuf );
+		pool->release( &rbuf );
+		pool->release( &abuf );
+		return 0;
+	}
+	kern = (int*)kbuf->imageData;
+	row = (short*)rbuf->imageData;
+	acc = (int*)abuf->imageData;
+
+	for( i = 0, sum = 0; i < ksize; i++ )
+		sum += exp( -( i - rad ) * ( i - rad ) / ( 2.0 * sig * sig ) );
+	for( i = 0, isum = 0; i < ksize; i++ )
+	{
+		kern[i] = cvRound( exp( -( i - rad ) * ( i - rad ) / ( 2.0 * sig * sig ) )
+			/ sum * ( 1 << SIFT_FIX_KERN_SHIFT ) );
+		isum += kern[i];
+	}
+	kern[rad] += ( 1 << SIFT_FIX_KERN_SHIFT ) - isum;
+	kern[ksize] = 0;
+
+	/* horizontal pass over a border-replicated copy of each row */
+	for( r = 0; r < h; r++ )
+	{
+		const short* in = (const short*)( src->imageData + src->widthStep * r );
+		out = (short*)( tmp->imageData + tmp->widthStep * r );
+		for( c = -rad; c < w + rad + 1; c++ )
+			row[c+rad] = in[ MIN( MAX( c, 0 ), w - 1 ) ];
+		c = smooth_fix_row( row, kern, ktaps, out, w );
+		for( ; c < w; c++ )
+		{
+			for( i = 0, isum = rnd; i < ksize; i++ )
+				isum += kern[i] * row[c+i];
+			out[c] = (short)( isum >> SIFT_FIX_KERN_SHIFT );
+		}
+	}
+
+	/* vertical pass, accumulating one pair of clamped rows at a time */
+	for( r = 0; r < h; r++ )
+	{
+		for( c = 0; c < w; c++ )
+			acc[c] = rnd;
+		for( i = 0; i < ktaps; i += 2 )
+		{
+			p0 = (const short*)( tmp->imageData +
+				tmp->widthStep * MIN( MAX( r + i - rad, 0 ), h - 1 ) );
+			p1 = (const short*)( tmp->imageData +
+				tmp->widthStep * MIN( MAX( r + i + 1 - rad, 0 ), h - 1 ) );
+			smooth_fix_col( p0, p1, kern[i], kern[i+1], acc, w );
+		}
+		out = (short*)( dst->imageData + dst->widthStep * r );
+		for( c = 0; c < w; c++ )
+			out[c] = (short)( acc[c] >> SIFT_FIX_KERN_SHIFT );
+	}
+
+	pool->release( &tmp );
+	pool->release( &kbuf );
+	pool->release( &rbuf );
+	pool->release( &abuf );
+	return 1;
+}
+
+/*
+Filters the leading columns of one border-replicated row with an integer
+kernel, eight at a time.
+
+@param row source row, padded by the kernel radius on the left and by
+	radius + 1 pixels on the right
+@param kern kernel of ktaps taps
+@param ktaps an even number of taps
+@param out destination row
+@param w destination width
+
+@return Returns the number of columns done; the caller finishes the rest
+*/
+static int smooth_fix_row( const short* row, const int* kern, int ktaps,
+						  short* out, int w )
+{
+	int c = 0;
+
+#if SIFT_USE_SSE2
+	__m128i x0, x1, k, lo, hi, rnd = _mm_set1_epi32( 1 << ( SIFT_FIX_KERN_SHIFT - 1 ) );
+	int i;
+
+	if( pyr_simd )
+		for( ; c <= w - 8; c += 8 )
+		{
+			lo = hi = rnd;
+			for( i = 0; i < ktaps; i += 2 )
+			{
+				/* pairs of neighbouring taps, multiplied and summed by madd */
+				k = _mm_set1_epi32( ( kern[i+1] << 16 ) | ( kern[i] & 0xffff ) );
+				x0 = _mm_loadu_si128( (const __m128i*)( row + c + i ) );
+				x1 = _mm_loadu_si128( (const __m128i*)( row + c + i + 1 ) );
+				lo = _mm_add_epi32( lo, _mm_madd_epi16( _mm_unpacklo_epi16( x0, x1 ), k ) );
+				hi = _mm_add_epi32( hi, _mm_madd_epi16( _mm_unpackhi_epi16( x0, x1 ), k ) );
+			}
+			_mm_storeu_si128( (__m128i*)( out + c ), _mm_packs_epi32(
+				_mm_srai_epi32( lo, SIFT_FIX_KERN_SHIFT ),
+				_mm_srai_epi32( hi, SIFT_FIX_KERN_SHIFT ) ) );
+		}
+#endif
+
+	return c;
+}
+
+/*
+Adds two rows weighted by two taps of an integer kernel to a row of
+32-bit accumulators.
+
+@param p0 row of the first tap
+@param p1 row of the second tap
+@param k0 first tap
+@param k1 second tap
+@param acc accumulators
+@param w row width
+*/
+static void smooth_fix_col( const short* p0, const short* p1, int k0, int k1,
+						   int* acc, int w )
+{
+	int c = 0;
+
+#if SIFT_USE_SSE2
+	__m128i x0, x1, k = _mm_set1_epi32( ( k1 << 16 ) | ( k0 & 0xffff ) );
+
+	if( pyr_simd )
+		for( ; c <= w - 8; c += 8 )
+		{
+			x0 = _mm_loadu_si128( (const __m128i*)( p0 + c ) );
+			x1 = _mm_loadu_si128( (const __m128i*)( p1 + c ) );
+			_mm_storeu_si128( (__m128i*)( acc + c ), _mm_add_epi32(
+				_mm_loadu_si128( (const __m128i*)( acc + c ) ),
+				_mm_madd_epi16( _mm_unpacklo_epi16( x0, x1 ), k ) ) );
+			_mm_storeu_si128( (__m128i*)( acc + c + 4 ), _mm_add_epi32(
+				_mm_loadu_si128( (const __m128i*)( acc + c + 4 ) ),
+				_mm_madd_epi16( _mm_unpackhi_epi16( x0, x1 ), k ) ) );
+		}
+#endif
+
+	for( ; c < w; c++ )
+		acc[c] += k0 * p0[c] + k1 * p1[c];
 }
 
 /*
@@ -855,16 +1923,20 @@ Builds Gaussian scale space pyramid from an image
 @param octvs number of octaves of scale space
 @param intvls number of intervals per octave
 @param sigma amount of Gaussian smoothing per octave
+@param aa 1 to average 2x2 blocks into each octave base instead of
+	sampling every other pixel
+@param pool pool of the pyramid levels
 
-@return Returns a Gaussian scale space pyramid as an octvs x (intvls + 3) array
+@return Returns a Gaussian scale space pyramid as an octvs x (intvls + 3)
+	array, or NULL if the pool's cap is reached
 */
 IplImage*** build_gauss_pyr( IplImage* base, int octvs,
-							int intvls, double sigma )
+							int intvls, double sigma, int aa, ImagePool* pool )
 {
 	IplImage*** gauss_pyr;
 	double* sig = (double*)calloc( intvls + 3, sizeof(double));
 	double sig_total, sig_prev, k;
-	int i, o;
+	int i, o, ok = 1;
 
 	gauss_pyr = (IplImage***)calloc( octvs, sizeof( IplImage** ) );
 	for( i = 0; i < octvs; i++ )
@@ -884,45 +1956,256 @@ IplImage*** build_gauss_pyr( IplImage* base, int octvs,
 		sig[i] = sqrt( sig_total * sig_total - sig_prev * sig_prev );
 	}
 
-	for( o = 0; o < octvs; o++ )
-		for( i = 0; i < intvls + 3; i++ )
+	for( o = 0; o < octvs  &&  ok; o++ )
+		for( i = 0; i < intvls + 3  &&  ok; i++ )
 		{
 			if( o == 0  &&  i == 0 )
-				gauss_pyr[o][i] = cvCloneImage(base);
+			{
+				gauss_pyr[o][i] = pool_create( pool, cvGetSize(base), base->depth, 1 );
+				if( ( ok = gauss_pyr[o][i] != NULL ) )
+					cvCopy( base, gauss_pyr[o][i], NULL );
+			}
 
 			/* base of new octvave is halved image from end of previous octave */
 			else if( i == 0 )
-				gauss_pyr[o][i] = downsample( gauss_pyr[o-1][intvls] );
+			{
+				gauss_pyr[o][i] = pool_create( pool,
+					cvSize( gauss_pyr[o-1][intvls]->width / 2,
+					gauss_pyr[o-1][intvls]->height / 2 ), base->depth, 1 );
+				if( ( ok = gauss_pyr[o][i] != NULL ) )
+					decimate_2x( gauss_pyr[o-1][intvls], gauss_pyr[o][i], aa );
+			}
 
 			/* blur the current octave's last image to create the next one */
 			else
 			{
-				gauss_pyr[o][i] = cvCreateImage( cvGetSize(gauss_pyr[o][i-1]),
-					IPL_DEPTH_32F, 1 );
-				cvSmooth( gauss_pyr[o][i-1], gauss_pyr[o][i],
-					CV_GAUSSIAN, 0, 0, sig[i], sig[i] );
+				gauss_pyr[o][i] = pool_create( pool, cvGetSize(gauss_pyr[o][i-1]),
+					base->depth, 1 );
+				if( ( ok = gauss_pyr[o][i] != NULL ) )
+					ok = smooth_level( gauss_pyr[o][i-1], gauss_pyr[o][i], sig[i], pool );
 			}
 		}
 
 		free( sig );
+		/* a level is missing: give back the ones taken so far */
+		if( ! ok )
+			release_pyr( &gauss_pyr, octvs, intvls + 3, pool );
 		return gauss_pyr;
 }
 
 /*
-Downsamples an image to a quarter of its size (half in each dimension)
-using nearest-neighbor interpolation
+Downsamples a pyramid level to half its size in each dimension, writing
+into a preallocated level.  By default every other pixel is sampled,
+which gives the same result as cvResize() with CV_INTER_NN; with \a aa
+set each destination pixel is the mean of a 2x2 block instead.
+
+@param src a 32-bit float or 16-bit fixed-point level
+@param dst level of size src / 2 and the depth of src
+@param aa 1 to average 2x2 blocks, 0 to sample every other pixel
+*/
+void decimate_2x( IplImage* src, IplImage* dst, int aa )
+{
+	char* s, * d;
+	int r;
+
+	for( r = 0; r < dst->height; r++ )
+	{
+		s = src->imageData + src->widthStep * 2 * r;
+		d = dst->imageData + dst->widthStep * r;
+		if( src->depth == IPL_DEPTH_16S )
+			decimate_row_16s( (short*)s, (short*)( s + src->widthStep ),
+				(short*)d, dst->width, aa );
+		else
+			decimate_row_32f( (float*)s, (float*)( s + src->widthStep ),
+				(float*)d, dst->width, aa );
+	}
+}
+
+/*
+Decimates one pair of 32-bit float rows.
 
-@param img an image
+@param s0 even source row
+@param s1 odd source row, only read when aa is set
+@param d destination row
+@param w destination width
+@param aa 1 to average 2x2 blocks, 0 to take the even pixels of s0
+*/
+void decimate_row_32f( const float* s0, const float* s1, float* d, int w, int aa )
+{
+	int c = 0;
+
+#if SIFT_USE_SSE2
+	__m128 a, b, q = _mm_set1_ps( 0.25f );
+
+	if( pyr_simd  &&  aa )
+		for( ; c <= w - 4; c += 4 )
+		{
+			a = _mm_add_ps( _mm_loadu_ps( s0 + 2*c ), _mm_loadu_ps( s1 + 2*c ) );
+			b = _mm_add_ps( _mm_loadu_ps( s0 + 2*c + 4 ), _mm_loadu_ps( s1 + 2*c + 4 ) );
+			_mm_storeu_ps( d + c, _mm_mul_ps( q, _mm_add_ps(
+				_mm_shuffle_ps( a, b, _MM_SHUFFLE( 2, 0, 2, 0 ) ),
+				_mm_shuffle_ps( a, b, _MM_SHUFFLE( 3, 1, 3, 1 ) ) ) ) );
+		}
+	else if( pyr_simd )
+		for( ; c <= w - 4; c += 4 )
+		{
+			a = _mm_loadu_ps( s0 + 2*c );
+			b = _mm_loadu_ps( s0 + 2*c + 4 );
+			_mm_storeu_ps( d + c, _mm_shuffle_ps( a, b, _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+		}
+#endif
+
+	if( aa )
+		for( ; c < w; c++ )
+			d[c] = 0.25f * ( ( s0[2*c] + s1[2*c] ) + ( s0[2*c+1] + s1[2*c+1] ) );
+	else
+		for( ; c < w; c++ )
+			d[c] = s0[2*c];
+}
+
+/*
+Decimates one pair of 16-bit fixed-point rows.  Averages are rounded to
+nearest.
+
+@param s0 even source row
+@param s1 odd source row, only read when aa is set
+@param d destination row
+@param w destination width
+@param aa 1 to average 2x2 blocks, 0 to take the even pixels of s0
+*/
+void decimate_row_16s( const short* s0, const short* s1, short* d, int w, int aa )
+{
+	int c = 0;
+
+#if SIFT_USE_SSE2
+	__m128i a, b, one = _mm_set1_epi16( 1 ), two = _mm_set1_epi32( 2 );
+
+	if( pyr_simd  &&  aa )
+		for( ; c <= w - 8; c += 8 )
+		{
+			/* madd with ones sums horizontal pairs into 32 bits */
+			a = _mm_add_epi32( _mm_madd_epi16( _mm_loadu_si128( (const __m128i*)( s0 + 2*c ) ), one ),
+				_mm_madd_epi16( _mm_loadu_si128( (const __m128i*)( s1 + 2*c ) ), one ) );
+			b = _mm_add_epi32( _mm_madd_epi16( _mm_loadu_si128( (const __m128i*)( s0 + 2*c + 8 ) ), one ),
+				_mm_madd_epi16( _mm_loadu_si128( (const __m128i*)( s1 + 2*c + 8 ) ), one ) );
+			a = _mm_srai_epi32( _mm_add_epi32( a, two ), 2 );
+			b = _mm_srai_epi32( _mm_add_epi32( b, two ), 2 );
+			_mm_storeu_si128( (__m128i*)( d + c ), _mm_packs_epi32( a, b ) );
+		}
+	else if( pyr_simd )
+		for( ; c <= w - 8; c += 8 )
+		{
+			/* sign-extend the even pixels to 32 bits, then pack them back */
+			a = _mm_srai_epi32( _mm_slli_epi32( _mm_loadu_si128( (const __m128i*)( s0 + 2*c ) ), 16 ), 16 );
+			b = _mm_srai_epi32( _mm_slli_epi32( _mm_loadu_si128( (const __m128i*)( s0 + 2*c + 8 ) ), 16 ), 16 );
+			_mm_storeu_si128( (__m128i*)( d + c ), _mm_packs_epi32( a, b ) );
+		}
+#endif
 
-@return Returns an image whose dimensions are half those of img
+	if( aa )
+		for( ; c < w; c++ )
+			d[c] = (short)( ( s0[2*c] + s0[2*c+1] + s1[2*c] + s1[2*c+1] + 2 ) >> 2 );
+	else
+		for( ; c < w; c++ )
+			d[c] = s0[2*c];
+}
+
+/*
+Checks decimate_2x() on 32-bit float and 16-bit fixed-point levels of odd
+and even widths and heights, once through the SSE2 rows and once through
+the scalar code alone.  Sampling must give exactly what cvResize() with
+CV_INTER_NN gives, and averaging must give the mean of each 2x2 block.
+Mismatches are printed.
+
+@return Returns the number of failed cases, 0 if all passed
 */
-IplImage* downsample( IplImage* img )
+int check_decimation( void )
 {
-	IplImage* smaller = cvCreateImage( cvSize(img->width / 2, img->height / 2),
-		img->depth, img->nChannels );
-	cvResize( img, smaller, CV_INTER_NN );
+	static const int sizes[][2] = { { 70, 50 }, { 71, 50 }, { 70, 51 },
+		{ 71, 51 }, { 9, 7 }, { 3, 2 } };
+	static const int depths[] = { IPL_DEPTH_32F, IPL_DEPTH_16S };
+	IplImage* src;
+	int failed = 0, simd, s, d, aa, r, c;
+
+	srand( 1 );
+	for( s = 0; s < (int)( sizeof(sizes) / sizeof(sizes[0]) ); s++ )
+		for( d = 0; d < 2; d++ )
+		{
+			src = cvCreateImage( cvSize( sizes[s][0], sizes[s][1] ), depths[d], 1 );
+			for( r = 0; r < src->height; r++ )
+				for( c = 0; c < src->width; c++ )
+					if( depths[d] == IPL_DEPTH_16S )
+						( (short*)( src->imageData + src->widthStep * r ) )[c] =
+						(short)( rand() % ( 256 * SIFT_FIX_ONE ) - 128 * SIFT_FIX_ONE );
+					else
+						( (float*)( src->imageData + src->widthStep * r ) )[c] =
+						rand() / (float)RAND_MAX - 0.5f;
+			for( simd = 0; simd < 2; simd++ )
+				for( aa = 0; aa < 2; aa++ )
+				{
+					pyr_simd = simd;
+					if( ! check_decimate_level( src, aa, simd ) )
+						failed++;
+				}
+			cvReleaseImage( &src );
+		}
+	pyr_simd = 1;
+	printf( "decimation: %d of %d cases failed\n", failed,
+		(int)( sizeof(sizes) / sizeof(sizes[0]) ) * 2 * 2 * 2 );
+	return failed;
+}
+
+/*
+Decimates one level and compares the result with cvResize() when sampling
+or with a scalar 2x2 mean when averaging.
 
-	return smaller;
+@param src a 32-bit float or 16-bit fixed-point level
+@param aa 1 to check averaging, 0 to check sampling
+@param simd whether the SSE2 rows were enabled, for the report
+
+@return Returns 1 if the result matched, 0 otherwise
+*/
+static int check_decimate_level( IplImage* src, int aa, int simd )
+{
+	IplImage* dst, * ref;
+	double v, e;
+	int r, c, bad = 0;
+
+	dst = cvCreateImage( cvSize( src->width / 2, src->height / 2 ), src->depth, 1 );
+	ref = cvCreateImage( cvGetSize(dst), src->depth, 1 );
+	decimate_2x( src, dst, aa );
+	if( ! aa )
+		cvResize( src, ref, CV_INTER_NN );
+
+	for( r = 0; r < dst->height; r++ )
+		for( c = 0; c < dst->width; c++ )
+		{
+			if( src->depth == IPL_DEPTH_16S )
+			{
+				v = pixval16s( dst, r, c );
+				e = ( aa )? ( pixval16s( src, 2*r, 2*c ) + pixval16s( src, 2*r, 2*c+1 ) +
+					pixval16s( src, 2*r+1, 2*c ) + pixval16s( src, 2*r+1, 2*c+1 ) + 2 ) >> 2 :
+					pixval16s( ref, r, c );
+			}
+			else
+			{
+				v = pixval32f( dst, r, c );
+				e = ( aa )? 0.25 * ( pixval32f( src, 2*r, 2*c ) + pixval32f( src, 2*r, 2*c+1 ) +
+					pixval32f( src, 2*r+1, 2*c ) + pixval32f( src, 2*r+1, 2*c+1 ) ) :
+					pixval32f( ref, r, c );
+			}
+			if( fabs( v - e ) > 1e-6 )
+				bad++;
+		}
+
+	if( bad )
+		printf( "decimation %s, %s, %dx%d, %s: %d of %d pixels differ\n",
+			( src->depth == IPL_DEPTH_16S )? "16S" : "32F", ( aa )? "2x2 mean" : "sampling",
+			src->width, src->height, ( simd )? "SSE2" : "scalar", bad,
+			dst->width * dst->height );
+	cvReleaseImage( &dst );
+	cvReleaseImage( &ref );
+	return bad == 0;
 }
 
 /*
@@ -932,27 +2215,32 @@ intervals of a Gaussian pyramid
 @param gauss_pyr Gaussian scale-space pyramid
 @param octvs number of octaves of scale space
 @param intvls number of intervals per octave
+@param pool pool of the pyramid levels
 
 @return Returns a difference of Gaussians scale space pyramid as an
-octvs x (intvls + 2) array
+octvs x (intvls + 2) array, or NULL if the pool's cap is reached
 */
-IplImage*** build_dog_pyr( IplImage*** gauss_pyr, int octvs, int intvls )
+IplImage*** build_dog_pyr( IplImage*** gauss_pyr, int octvs, int intvls,
+						  ImagePool* pool )
 {
 	IplImage*** dog_pyr;
-	int i, o;
+	int i, o, ok = 1;
 
 	dog_pyr = (IplImage***)calloc( octvs, sizeof( IplImage** ) );
 	for( i = 0; i < octvs; i++ )
 		dog_pyr[i] = (IplImage**)calloc( intvls + 2, sizeof(IplImage*) );
 
-	for( o = 0; o < octvs; o++ )
-		for( i = 0; i < intvls + 2; i++ )
+	for( o = 0; o < octvs  &&  ok; o++ )
+		for( i = 0; i < intvls + 2  &&  ok; i++ )
 		{
-			dog_pyr[o][i] = cvCreateImage( cvGetSize(gauss_pyr[o][i]),
-				IPL_DEPTH_32F, 1 );
-			cvSub( gauss_pyr[o][i+1], gauss_pyr[o][i], dog_pyr[o][i], NULL );
+			dog_pyr[o][i] = pool_create( pool, cvGetSize(gauss_pyr[o][i]),
+				gauss_pyr[o][i]->depth, 1 );
+			if( ( ok = dog_pyr[o][i] != NULL ) )
+				cvSub( gauss_pyr[o][i+1], gauss_pyr[o][i], dog_pyr[o][i], NULL );
 		}
 
+		if( ! ok )
+			release_pyr( &dog_pyr, octvs, intvls + 2, pool );
 		return dog_pyr;
 }
 
@@ -975,39 +2263,140 @@ void SIFT_feature::scale_space_extrema( IplImage*** dog_pyr, int octvs, int intv
 						   CvMemStorage* storage )
 {
 	//CvSeq* features;
-	double prelim_contr_thr = 0.5 * contr_thr / intvls;
-	struct SIFT_feature_unit* feature;
-	struct detection_data * ddata;
-	int o, i, r, c, w, h;
+	int o, i, r;
 
 	//features = cvCreateSeq( 0, sizeof(CvSeq), sizeof(struct feature), storage );
 	for( o = 0; o < octvs; o++ )
 		for( i = 1; i <= intvls; i++ )
 			for(r = SIFT_IMG_BORDER; r < dog_pyr[o][0]->height-SIFT_IMG_BORDER; r++)
-				for(c = SIFT_IMG_BORDER; c < dog_pyr[o][0]->width-SIFT_IMG_BORDER; c++)
-					/* perform preliminary check on contrast */
-					if( ABS( pixval32f( dog_pyr[o][i], r, c ) ) > prelim_contr_thr )
-						if( is_extremum( dog_pyr, o, i, r, c ) )
-						{
-							feature = interp_extremum(dog_pyr, o, i, r, c, intvls, contr_thr);
-							if( feature )
-							{
-								ddata = (detection_data*)feature->feature_data ;
-								if( ! is_too_edge_like( dog_pyr[ddata->octv][ddata->intvl],
-									ddata->r, ddata->c, curv_thr ) )
-								{
-									//cvSeqPush( features, feat );
-									feat.insert(feat.begin(),*feature);
-								}
-								else
-									free( ddata );
-								free( feature );
-							}
-						}
+				scan_extrema_row( dog_pyr, o, i, r, intvls, contr_thr, curv_thr );
 
 //	return features;
 }
 
+/*
+Detects features at extrema along one row of one DoG level.  Bad features
+are discarded based on contrast and ratio of principal curvatures.
+
+@param dog_pyr DoG scale space pyramid
+@param o octave of the row
+@param i interval of the row
+@param r row
+@param intvls intervals per octave
+@param contr_thr low threshold on feature contrast
+@param curv_thr high threshold on feature ratio of principal curvatures
+*/
+void SIFT_feature::scan_extrema_row( IplImage*** dog_pyr, int o, int i, int r,
+									int intvls, double contr_thr, int curv_thr )
+{
+	double prelim_contr_thr = 0.5 * contr_thr / intvls;
+	int prelim_contr_fix = cvFloor( prelim_contr_thr * SIFT_FIX_ONE );
+	struct SIFT_feature_unit* feature;
+	struct detection_data * ddata;
+	int c, fix = ( dog_pyr[o][i]->depth == IPL_DEPTH_16S );
+
+	for(c = SIFT_IMG_BORDER; c < dog_pyr[o][0]->width-SIFT_IMG_BORDER; c++)
+		/* perform preliminary check on contrast */
+		if( ( fix )?
+			ABS( pixval16s( dog_pyr[o][i], r, c ) ) > prelim_contr_fix :
+			ABS( pixval32f( dog_pyr[o][i], r, c ) ) > prelim_contr_thr )
+			if( is_extremum( dog_pyr, o, i, r, c ) )
+			{
+				feature = interp_extremum(dog_pyr, o, i, r, c, intvls, contr_thr);
+				if( feature )
+				{
+					ddata = (detection_data*)feature->feature_data ;
+					if( ! is_too_edge_like( dog_pyr[ddata->octv][ddata->intvl],
+						ddata->r, ddata->c, curv_thr ) )
+					{
+						//cvSeqPush( features, feat );
+						feat.insert(feat.begin(),*feature);
+					}
+					else
+						free( ddata );
+					free( feature );
+				}
+			}
+}
+
+/*
+Enforces a keypoint budget.  Features are bucketed into a grid x grid array
+of cells and ranked by the absolute interpolated contrast computed in
+interp_extremum().  The budget is then filled one rank at a time, taking
+the best feature of every cell before the second best of any cell, so that
+a single highly textured area cannot use up the whole budget.  Dropped
+features release their detection data.
+
+@param max_feats maximum number of features to keep; 0 keeps them all
+@param grid number of cells per side of the bucketing grid
+@param width width of the image the feature coordinates refer to
+@param height height of the image the feature coordinates refer to
+*/
+void SIFT_feature::select_budget_features( int max_feats, int grid,
+										  int width, int height )
+{
+	vector< pair<double, int> > ranked, round;
+	vector< vector<int> > cells;
+	vector<struct SIFT_feature_unit> kept;
+	vector<bool> keep;
+	struct detection_data* ddata;
+	int n = feat.size(), cell, cx, cy, depth, count = 0;
+	unsigned i, j;
+	bool more = true;
+
+	if( max_feats <= 0  ||  n <= max_feats )
+		return;
+	if( grid < 1 )
+		grid = 1;
+
+	/* rank all candidates by decreasing contrast */
+	for( i = 0; i < (unsigned)n; i++ )
+	{
+		ddata = feat_detection_data( (&feat[i]) );
+		ranked.push_back( make_pair( ABS( ddata->contr ), (int)i ) );
+	}
+	sort( ranked.begin(), ranked.end() );
+
+	/* cells list their features strongest first */
+	cells.resize( grid * grid );
+	for( i = ranked.size(); i > 0; i-- )
+	{
+		j = ranked[i-1].second;
+		cx = MIN( grid - 1, MAX( 0, (int)( feat[j].x * grid / width ) ) );
+		cy = MIN( grid - 1, MAX( 0, (int)( feat[j].y * grid / height ) ) );
+		cells[cy * grid + cx].push_back( j );
+	}
+
+	/* take the depth-th best feature of every cell, strongest cells first */
+	keep.assign( n, false );
+	for( depth = 0; more  &&  count < max_feats; depth++ )
+	{
+		more = false;
+		round.clear();
+		for( cell = 0; cell < grid * grid; cell++ )
+			if( depth < (int)cells[cell].size() )
+			{
+				j = cells[cell][depth];
+				round.push_back( make_pair( ABS( feat_detection_data( (&feat[j]) )->contr ), (int)j ) );
+				more = true;
+			}
+		sort( round.begin(), round.end() );
+		for( i = round.size(); i > 0  &&  count < max_feats; i-- )
+		{
+			keep[round[i-1].second] = true;
+			count++;
+		}
+	}
+
+	kept.reserve( count );
+	for( i = 0; i < (unsigned)n; i++ )
+		if( keep[i] )
+			kept.push_back( feat[i] );
+		else
+			free( feat[i].feature_data );
+	feat.swap( kept );
+}
+
 /*
 Determines whether a pixel is a scale-space extremum by comparing it to it's
 3x3x3 pixel neighborhood.
@@ -1023,8 +2412,24 @@ it's 3x3x3 pixel neighborhood.
 */
 int is_extremum( IplImage*** dog_pyr, int octv, int intvl, int r, int c )
 {
-	float val = pixval32f( dog_pyr[octv][intvl], r, c );
-	int i, j, k;
+	float val;
+	int i, j, k, ival;
+
+	/* 16-bit fixed-point levels compare in integers */
+	if( dog_pyr[octv][intvl]->depth == IPL_DEPTH_16S )
+	{
+		ival = pixval16s( dog_pyr[octv][intvl], r, c );
+		for( i = -1; i <= 1; i++ )
+			for( j = -1; j <= 1; j++ )
+				for( k = -1; k <= 1; k++ )
+					if( ( ival > 0 )?
+						ival < pixval16s( dog_pyr[octv][intvl+i], r + j, c + k ) :
+						ival > pixval16s( dog_pyr[octv][intvl+i], r + j, c + k ) )
+						return 0;
+		return 1;
+	}
+
+	val = pixval32f( dog_pyr[octv][intvl], r, c );
 
 	/* check for maximum */
 	if( val > 0 )
@@ -1115,6 +2520,7 @@ struct SIFT_feature_unit* interp_extremum( IplImage*** dog_pyr, int octv, int in
 	ddata->octv = octv;
 	ddata->intvl = intvl;
 	ddata->subintvl = xi;
+	ddata->contr = contr;
 
 	return feat;
 }
@@ -1173,12 +2579,12 @@ CvMat* deriv_3D( IplImage*** dog_pyr, int octv, int intvl, int r, int c )
 	CvMat* dI;
 	double dx, dy, ds;
 
-	dx = ( pixval32f( dog_pyr[octv][intvl], r, c+1 ) -
-		pixval32f( dog_pyr[octv][intvl], r, c-1 ) ) / 2.0;
-	dy = ( pixval32f( dog_pyr[octv][intvl], r+1, c ) -
-		pixval32f( dog_pyr[octv][intvl], r-1, c ) ) / 2.0;
-	ds = ( pixval32f( dog_pyr[octv][intvl+1], r, c ) -
-		pixval32f( dog_pyr[octv][intvl-1], r, c ) ) / 2.0;
+	dx = ( pyr_pixval( dog_pyr[octv][intvl], r, c+1 ) -
+		pyr_pixval( dog_pyr[octv][intvl], r, c-1 ) ) / 2.0;
+	dy = ( pyr_pixval( dog_pyr[octv][intvl], r+1, c ) -
+		pyr_pixval( dog_pyr[octv][intvl], r-1, c ) ) / 2.0;
+	ds = ( pyr_pixval( dog_pyr[octv][intvl+1], r, c ) -
+		pyr_pixval( dog_pyr[octv][intvl-1], r, c ) ) / 2.0;
 
 	dI = cvCreateMat( 3, 1, CV_64FC1 );
 	cvmSet( dI, 0, 0, dx );
@@ -1208,25 +2614,25 @@ CvMat* hessian_3D( IplImage*** dog_pyr, int octv, int intvl, int r, int c )
 	CvMat* H;
 	double v, dxx, dyy, dss, dxy, dxs, dys;
 
-	v = pixval32f( dog_pyr[octv][intvl], r, c );
-	dxx = ( pixval32f( dog_pyr[octv][intvl], r, c+1 ) + 
-		pixval32f( dog_pyr[octv][intvl], r, c-1 ) - 2 * v );
-	dyy = ( pixval32f( dog_pyr[octv][intvl], r+1, c ) +
-		pixval32f( dog_pyr[octv][intvl], r-1, c ) - 2 * v );
-	dss = ( pixval32f( dog_pyr[octv][intvl+1], r, c ) +
-		pixval32f( dog_pyr[octv][intvl-1], r, c ) - 2 * v );
-	dxy = ( pixval32f( dog_pyr[octv][intvl], r+1, c+1 ) -
-		pixval32f( dog_pyr[octv][intvl], r+1, c-1 ) -
-		pixval32f( dog_pyr[octv][intvl], r-1, c+1 ) +
-		pixval32f( dog_pyr[octv][intvl], r-1, c-1 ) ) / 4.0;
-	dxs = ( pixval32f( dog_pyr[octv][intvl+1], r, c+1 ) -
-		pixval32f( dog_pyr[octv][intvl+1], r, c-1 ) -
-		pixval32f( dog_pyr[octv][intvl-1], r, c+1 ) +
-		pixval32f( dog_pyr[octv][intvl-1], r, c-1 ) ) / 4.0;
-	dys = ( pixval32f( dog_pyr[octv][intvl+1], r+1, c ) -
-		pixval32f( dog_pyr[octv][intvl+1], r-1, c ) -
-		pixval32f( dog_pyr[octv][intvl-1], r+1, c ) +
-		pixval32f( dog_pyr[octv][intvl-1], r-1, c ) ) / 4.0;
+	v = pyr_pixval( dog_pyr[octv][intvl], r, c );
+	dxx = ( pyr_pixval( dog_pyr[octv][intvl], r, c+1 ) + 
+		pyr_pixval( dog_pyr[octv][intvl], r, c-1 ) - 2 * v );
+	dyy = ( pyr_pixval( dog_pyr[octv][intvl], r+1, c ) +
+		pyr_pixval( dog_pyr[octv][intvl], r-1, c ) - 2 * v );
+	dss = ( pyr_pixval( dog_pyr[octv][intvl+1], r, c ) +
+		pyr_pixval( dog_pyr[octv][intvl-1], r, c ) - 2 * v );
+	dxy = ( pyr_pixval( dog_pyr[octv][intvl], r+1, c+1 ) -
+		pyr_pixval( dog_pyr[octv][intvl], r+1, c-1 ) -
+		pyr_pixval( dog_pyr[octv][intvl], r-1, c+1 ) +
+		pyr_pixval( dog_pyr[octv][intvl], r-1, c-1 ) ) / 4.0;
+	dxs = ( pyr_pixval( dog_pyr[octv][intvl+1], r, c+1 ) -
+		pyr_pixval( dog_pyr[octv][intvl+1], r, c-1 ) -
+		pyr_pixval( dog_pyr[octv][intvl-1], r, c+1 ) +
+		pyr_pixval( dog_pyr[octv][intvl-1], r, c-1 ) ) / 4.0;
+	dys = ( pyr_pixval( dog_pyr[octv][intvl+1], r+1, c ) -
+		pyr_pixval( dog_pyr[octv][intvl+1], r-1, c ) -
+		pyr_pixval( dog_pyr[octv][intvl-1], r+1, c ) +
+		pyr_pixval( dog_pyr[octv][intvl-1], r-1, c ) ) / 4.0;
 
 	H = cvCreateMat( 3, 3, CV_64FC1 );
 	cvmSet( H, 0, 0, dxx );
@@ -1268,7 +2674,7 @@ double interp_contr( IplImage*** dog_pyr, int octv, int intvl, int r,
 	cvGEMM( dD, &X, 1, NULL, 0, &T,  CV_GEMM_A_T );
 	cvReleaseMat( &dD );
 
-	return pixval32f( dog_pyr[octv][intvl], r, c ) + t[0] * 0.5;
+	return pyr_pixval( dog_pyr[octv][intvl], r, c ) + t[0] * 0.5;
 }
 
 /*
@@ -1309,11 +2715,11 @@ int is_too_edge_like( IplImage* dog_img, int r, int c, int curv_thr )
 	double d, dxx, dyy, dxy, tr, det;
 
 	/* principal curvatures are computed using the trace and det of Hessian */
-	d = pixval32f(dog_img, r, c);
-	dxx = pixval32f( dog_img, r, c+1 ) + pixval32f( dog_img, r, c-1 ) - 2 * d;
-	dyy = pixval32f( dog_img, r+1, c ) + pixval32f( dog_img, r-1, c ) - 2 * d;
-	dxy = ( pixval32f(dog_img, r+1, c+1) - pixval32f(dog_img, r+1, c-1) -
-		pixval32f(dog_img, r-1, c+1) + pixval32f(dog_img, r-1, c-1) ) / 4.0;
+	d = pyr_pixval(dog_img, r, c);
+	dxx = pyr_pixval( dog_img, r, c+1 ) + pyr_pixval( dog_img, r, c-1 ) - 2 * d;
+	dyy = pyr_pixval( dog_img, r+1, c ) + pyr_pixval( dog_img, r-1, c ) - 2 * d;
+	dxy = ( pyr_pixval(dog_img, r+1, c+1) - pyr_pixval(dog_img, r+1, c-1) -
+		pyr_pixval(dog_img, r-1, c+1) + pyr_pixval(dog_img, r-1, c-1) ) / 4.0;
 	tr = dxx + dyy;
 	det = dxx * dyy - dxy * dxy;
 
@@ -1351,12 +2757,12 @@ void SIFT_feature::calc_feature_scales( double sigma, int intvls )
 }
 
 /*
-Halves feature coordinates and scale in case the input image was doubled
-prior to scale space construction.
+Maps feature coordinates and scale back to the input image in case it was
+resampled (e.g. doubled) prior to scale space construction.
 
-@param features array of features
+@param img_scl scale of the pyramid base relative to the input image
 */
-void SIFT_feature::adjust_for_img_dbl()
+void SIFT_feature::adjust_for_img_scl( double img_scl )
 {
 	
 //	int i, n;
@@ -1365,11 +2771,11 @@ void SIFT_feature::adjust_for_img_dbl()
 	for( unsigned i = 0; i < feat.size(); i++ )
 	{
 		//feat = CV_GET_SEQ_ELEM( struct feature, features, i );
-		feat[i].x /= 2.0;
-		feat[i].y /= 2.0;
-		feat[i].scl /= 2.0;
-		feat[i].img_pt.x /= 2.0;
-		feat[i].img_pt.y /= 2.0;
+		feat[i].x /= img_scl;
+		feat[i].y /= img_scl;
+		feat[i].scl /= img_scl;
+		feat[i].img_pt.x /= img_scl;
+		feat[i].img_pt.y /= img_scl;
 	}
 }
 
@@ -1388,9 +2794,11 @@ void SIFT_feature::calc_feature_oris( IplImage*** gauss_pyr )
 	struct detection_data* ddata;
 	double* hist;
 	double omax;
+	unsigned n = feat.size();
 	//int i, j;
 
-	for( unsigned i = 0; i < feat.size(); i++ )
+	/* new features are inserted at the front, so visit exactly the n originals */
+	for( unsigned i = 0; i < n; i++ )
 	{
 		feature = (struct SIFT_feature_unit*)malloc( sizeof( struct SIFT_feature_unit ) );
 		*feature = feat.back();
@@ -1465,8 +2873,8 @@ int calc_grad_mag_ori( IplImage* img, int r, int c, double* mag, double* ori )
 
 	if( r > 0  &&  r < img->height - 1  &&  c > 0  &&  c < img->width - 1 )
 	{
-		dx = pixval32f( img, r, c+1 ) - pixval32f( img, r, c-1 );
-		dy = pixval32f( img, r-1, c ) - pixval32f( img, r+1, c );
+		dx = pyr_pixval( img, r, c+1 ) - pyr_pixval( img, r, c-1 );
+		dy = pyr_pixval( img, r-1, c ) - pyr_pixval( img, r+1, c );
 		*mag = sqrt( dx*dx + dy*dy );
 		*ori = atan2( dy, dx );
 		return 1;
@@ -1844,37 +3252,34 @@ De-allocates memory held by a scale space pyramid
 @param pyr scale space pyramid
 @param octvs number of octaves of scale space
 @param n number of images per octave
+@param pool pool the pyramid levels were taken from
 */
-void release_pyr( IplImage**** pyr, int octvs, int n )
+void release_pyr( IplImage**** pyr, int octvs, int n, ImagePool* pool )
 {
 	int i, j;
 	for( i = 0; i < octvs; i++ )
 	{
 		for( j = 0; j < n; j++ )
-			cvReleaseImage( &(*pyr)[i][j] );
+			pool->release( &(*pyr)[i][j] );
 		free( (*pyr)[i] );
 	}
 	free( *pyr );
 	*pyr = NULL;
 }
 //////////////////////////////////////////////////////////////////////////
-// Convert Image with bounded rect
+// Convert Image with bounded rect, for images of any channel count
 //////////////////////////////////////////////////////////////////////////
 void ConvertImage(IplImage* source,IplImage* target,Rect Roi)
 {
-	
+	int pixelBytes = source->nChannels * ((source->depth & 255) / 8);
+
 	if (source->imageSize < target->imageSize)
 	{
 		for (int nLine = Roi.upper; nLine < Roi.upper + Roi.height; nLine++)
 		{
 			uchar* ptr_source = (uchar*)(source->imageData + (nLine-Roi.upper) * source->widthStep);
 			uchar* ptr_destination = (uchar*)(target->imageData + nLine * target->widthStep);
-			for (int nCol = Roi.left; nCol < Roi.left + Roi.width; nCol++)
-			{
-				ptr_destination[3*(nCol)+0] = ptr_source[3*(nCol-Roi.left)+0];
-				ptr_destination[3*(nCol)+1] = ptr_source[3*(nCol-Roi.left)+1];
-				ptr_destination[3*(nCol)+2] = ptr_source[3*(nCol-Roi.left)+2];
-			}
+			memcpy(ptr_destination + Roi.left*pixelBytes, ptr_source, Roi.width*pixelBytes);
 		}
 
 
@@ -1885,12 +3290,7 @@ void ConvertImage(IplImage* source,IplImage* target,Rect Roi)
 		{
 			uchar* ptr_source = (uchar*)(source->imageData + nLine * source->widthStep);
 			uchar* ptr_destination = (uchar*)(target->imageData + (nLine - Roi.upper) * target->widthStep);
-			for (int nCol = Roi.left; nCol < Roi.left + Roi.width; nCol++)
-			{
-				ptr_destination[3*(nCol-Roi.left)+0] = ptr_source[3*nCol+0];
-				ptr_destination[3*(nCol-Roi.left)+1] = ptr_source[3*nCol+1];
-				ptr_destination[3*(nCol-Roi.left)+2] = ptr_source[3*nCol+2];
-			}
+			memcpy(ptr_destination, ptr_source + Roi.left*pixelBytes, Roi.width*pixelBytes);
 		}
 
 	}
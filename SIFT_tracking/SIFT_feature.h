@@ -2,14 +2,20 @@
 #include "Def.h"
 #include "utils.h"
 
+void init_sift_options( struct sift_options* opts );
+
+class SIFT_feature;
+double feature_repeatability( SIFT_feature* ref, SIFT_feature* test,
+	double max_dist, double* mean_descr_dist );
+int check_decimation( void );
 
 class SIFT_feature
 {
 public:
 	SIFT_feature(void);
 	~SIFT_feature(void);
-	SIFT_feature(IplImage *);
-	SIFT_feature(IplImage *,Rect);
+	SIFT_feature(IplImage *, const struct sift_options* opts = NULL);
+	SIFT_feature(IplImage *,Rect, const struct sift_options* opts = NULL);
 	int import_features( char* filename, int type);
 	int export_features( char* filename);
 	void draw_features( IplImage* img);
@@ -31,12 +37,19 @@ public:
 	
 	void sift_features( IplImage* img );
 
-	void sift_features( IplImage* img, int intvls,
+	int sift_features( IplImage* img, int intvls,
 		double sigma, double contr_thr, int curv_thr,
 		int img_dbl, int descr_width, int descr_hist_bins );
+	int sift_features_stream( IplImage* img, int intvls,
+		double sigma, double contr_thr, int curv_thr,
+		int descr_width, int descr_hist_bins );
 	void scale_space_extrema( IplImage***, int, int, double, int, CvMemStorage*);
+	void scan_extrema_row( IplImage***, int, int, int, int, double, int );
+	void finish_band_features( IplImage***, double, int, int, int, int, int,
+		vector<struct SIFT_feature_unit>& );
+	void select_budget_features( int, int, int, int );
 	void calc_feature_scales( double, int );
-	void adjust_for_img_dbl( );
+	void adjust_for_img_scl( double );
 	void calc_feature_oris( IplImage*** );
 	void add_good_ori_features( double*, int, double, struct SIFT_feature_unit* );
 	void compute_descriptors( IplImage***, int, int );
@@ -44,8 +57,14 @@ public:
 	int GetLength();
 	void AddMatchCount(int i);
 	int GetMatchCount(int i);
+	void SetLastMatch(int i,int t);
+	int GetLastMatch(int i);
+	void AddFeat(const struct SIFT_feature_unit& f,int t);
+	void RemoveFeat(int pos);
 private:
 	vector<struct SIFT_feature_unit> feat;
 	vector<int> MatchCount;
+	vector<int> LastMatch;
+	struct sift_options opts;
 };
 
@@ -0,0 +1,176 @@
+#include "StdAfx.h"
+#include "SIFT_matcher.h"
+
+#if SIFT_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+/*
+@param ratio max ratio of the squared distances to the nearest and second
+	nearest template features
+@param cross_check true to also require the query feature to be the
+	nearest one of its template feature
+*/
+SIFT_matcher::SIFT_matcher(double ratio, bool cross_check)
+{
+	this->ratio = ratio;
+	this->cross_check = cross_check;
+	this->d = 0;
+	this->stride = 0;
+	this->n_tmpl = 0;
+}
+
+/*
+Packs feature descriptors into zero padded float rows of the template's
+descriptor length.  Features with another descriptor length get an
+all-zero row; match() skips them.
+*/
+void SIFT_matcher::pack( struct SIFT_feature_unit** feats, int n, vector<float>& rows )
+{
+	float* row;
+	int i, k;
+
+	rows.assign( n * stride, 0.0f );
+	for( i = 0; i < n; i++ )
+	{
+		if( feats[i]->d != d )
+			continue;
+		row = &rows[i * stride];
+		for( k = 0; k < d; k++ )
+			row[k] = (float)feats[i]->descr[k];
+	}
+}
+
+/* squared distance of two packed rows; n is a multiple of 4 */
+float SIFT_matcher::dist_sq( const float* a, const float* b, int n )
+{
+	float s = 0, e;
+	int k = 0;
+
+#if SIFT_USE_SSE2
+	float t[4];
+	__m128 acc = _mm_setzero_ps(), v;
+
+	for( ; k < n; k += 4 )
+	{
+		v = _mm_sub_ps( _mm_loadu_ps( a + k ), _mm_loadu_ps( b + k ) );
+		acc = _mm_add_ps( acc, _mm_mul_ps( v, v ) );
+	}
+	_mm_storeu_ps( t, acc );
+	s = ( t[0] + t[1] ) + ( t[2] + t[3] );
+#endif
+
+	for( ; k < n; k++ )
+	{
+		e = a[k] - b[k];
+		s += e * e;
+	}
+	return s;
+}
+
+/*
+Sets the features later queries are matched against.  The features are
+copied, so the template may be released or reordered afterwards.
+
+@param feats template features
+@param n number of features
+*/
+void SIFT_matcher::set_template( struct SIFT_feature_unit** feats, int n )
+{
+	n_tmpl = n;
+	d = ( n > 0 )? feats[0]->d : 0;
+	stride = ( d + 3 ) & ~3;
+	pack( feats, n, tmpl_rows );
+}
+
+void SIFT_matcher::set_template( SIFT_feature* sfeat )
+{
+	int i;
+
+	ptrs.resize( sfeat->GetLength() );
+	for( i = 0; i < sfeat->GetLength(); i++ )
+		ptrs[i] = sfeat->GetFeat( i );
+	set_template( ( ptrs.empty() )? NULL : &ptrs[0], (int)ptrs.size() );
+}
+
+/*
+Matches query features against the template.
+
+@param feats query features
+@param n number of features
+@param matches output as the accepted matches, in query order
+
+@return Returns the number of matches
+*/
+int SIFT_matcher::match( struct SIFT_feature_unit** feats, int n,
+						vector<struct sift_match>& matches )
+{
+	struct sift_match m;
+	const float* q;
+	float d0, d1, dist;
+	int i, j, best;
+
+	matches.clear();
+	if( n_tmpl < 2  ||  n <= 0 )
+		return 0;
+	pack( feats, n, query_rows );
+	if( cross_check )
+	{
+		col_best.assign( n_tmpl, FLT_MAX );
+		col_idx.assign( n_tmpl, -1 );
+	}
+
+	for( i = 0; i < n; i++ )
+	{
+		if( feats[i]->d != d )
+			continue;
+		q = &query_rows[i * stride];
+		d0 = d1 = FLT_MAX;
+		best = -1;
+		for( j = 0; j < n_tmpl; j++ )
+		{
+			dist = dist_sq( q, &tmpl_rows[j * stride], stride );
+			if( dist < d0 )
+			{
+				d1 = d0;
+				d0 = dist;
+				best = j;
+			}
+			else if( dist < d1 )
+				d1 = dist;
+			if( cross_check  &&  dist < col_best[j] )
+			{
+				col_best[j] = dist;
+				col_idx[j] = i;
+			}
+		}
+		if( d0 < d1 * ratio )
+		{
+			m.query = i;
+			m.train = best;
+			m.dist_sq = d0;
+			m.score = 1.0f - d0 / d1;
+			matches.push_back( m );
+		}
+	}
+
+	/* keep matches whose template feature points back at the query */
+	if( cross_check )
+	{
+		for( i = 0, j = 0; i < (int)matches.size(); i++ )
+			if( col_idx[matches[i].train] == matches[i].query )
+				matches[j++] = matches[i];
+		matches.resize( j );
+	}
+	return (int)matches.size();
+}
+
+int SIFT_matcher::match( SIFT_feature* sfeat, vector<struct sift_match>& matches )
+{
+	int i;
+
+	ptrs.resize( sfeat->GetLength() );
+	for( i = 0; i < sfeat->GetLength(); i++ )
+		ptrs[i] = sfeat->GetFeat( i );
+	return match( ( ptrs.empty() )? NULL : &ptrs[0], (int)ptrs.size(), matches );
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "SIFT_feature.h"
+
+/** a descriptor match between a query feature and a template feature */
+struct sift_match
+{
+	int query;                     /**< index of the query feature */
+	int train;                     /**< index of its nearest template feature */
+	float dist_sq;                 /**< squared descriptor distance of the pair */
+	float score;                   /**< 1 - dist_sq over the second nearest
+										dist_sq; higher is more distinctive */
+};
+
+/*
+Exhaustive nearest neighbour matching of SIFT descriptors against a fixed
+template.  Descriptors are packed once into float rows so that distances
+run four dimensions per SSE2 step.  A match is kept if it passes the
+ratio test and, optionally, if the template feature's nearest query
+feature is the query feature itself.
+*/
+class SIFT_matcher
+{
+public:
+	SIFT_matcher(double ratio = SIFT_MATCH_RATIO, bool cross_check = SIFT_MATCH_CROSS_CHECK);
+	void set_template(struct SIFT_feature_unit** feats, int n);
+	void set_template(SIFT_feature* sfeat);
+	int match(struct SIFT_feature_unit** feats, int n, vector<struct sift_match>& matches);
+	int match(SIFT_feature* sfeat, vector<struct sift_match>& matches);
+	int get_template_size(){return n_tmpl;};
+
+private:
+	void pack(struct SIFT_feature_unit** feats, int n, vector<float>& rows);
+	static float dist_sq(const float* a, const float* b, int n);
+
+	double ratio;
+	bool cross_check;
+	int d;
+	int stride;
+	int n_tmpl;
+	vector<float> tmpl_rows;
+	vector<float> query_rows;
+	vector<struct SIFT_feature_unit*> ptrs;
+	vector<float> col_best;
+	vector<int> col_idx;
+};
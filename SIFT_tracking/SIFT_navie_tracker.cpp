@@ -8,58 +8,44 @@ SIFT_navie_tracker::SIFT_navie_tracker(void)
 SIFT_navie_tracker::~SIFT_navie_tracker(void)
 {
 }
+//////////////////////////////////////////////////////////////////////////
+//match the frame keypoints to the template and fit a motion to the
+//matches; the box moves and scales with the motion
+//////////////////////////////////////////////////////////////////////////
 bool SIFT_navie_tracker::tracking(ImageHandler* imhdr,SIFT_feature *Sfeat, int Sfeat_num_fp,Rect *trackingWindow,Rect *trackingRect)
 {
-	int count=0;
-	struct SIFT_feature_unit *feat_cmp;
-	struct SIFT_feature_unit **nbrs;
-	int k = 0;
-	double d0,d1;
-	Point2D MovingVector(0,0);
-	Point2D TempMovingVector(0,0);
-	double MovingVectorx,MovingVectory,TempMovingVectorx,TempMovingVectory;
-	double MaxMove=0;
-	double TempMoveScale = 0;
-	for (int i = 0;i<Sfeat_num_fp;i++)
+	struct SIFT_feature_unit *feat_cmp,*tmpl;
+	double sy,sx;
+	Point2D from,to;
+	Motion2D motion;
+
+	/* template keypoints are placed in the current box */
+	sy = (double)trackingRect->height/tmplHeight;
+	sx = (double)trackingRect->width/tmplWidth;
+	matchFrom.clear();
+	matchTo.clear();
+	matchQuality.clear();
+	matcher.match(Sfeat,matches);
+	for (int i = 0;i<(int)matches.size();i++)
 	{
-		feat_cmp = Sfeat->GetFeat(i);
-		k = kdtree_bbf_knn(kd_root,feat_cmp,2,&nbrs,200);
-		if (k==2)
+		feat_cmp = Sfeat->GetFeat(matches[i].query);
+		tmpl = tracking_template->GetFeat(matches[i].train);
+		from = Point2D(tmpl->y*sy+trackingRect->upper,tmpl->x*sx+trackingRect->left);
+		to = Point2D(feat_cmp->y+trackingWindow->upper,feat_cmp->x+trackingWindow->left);
+		if ((fabs(to.dcol-from.dcol)<=trackingRect->width/5.0)&&(fabs(to.drow-from.drow)<=trackingRect->height/5.0) )
 		{
-			d0 = descr_dist_sq(feat_cmp,nbrs[0]);
-			d1 = descr_dist_sq(feat_cmp,nbrs[1]);
-			if(d0<d1 * 0.5)
-			{
-				//TempMovingVector = Point2D(feat_cmp->img_pt.x-nbrs[0]->img_pt.x,feat_cmp->img_pt.y-nbrs[0]->img_pt.y);
-				TempMovingVectorx = feat_cmp->img_pt.x-(nbrs[0]->img_pt.x+(trackingRect->left-trackingWindow->left));
-				TempMovingVectory = feat_cmp->img_pt.y-(nbrs[0]->img_pt.y+(trackingRect->upper-trackingWindow->upper));
-				if ((abs(TempMovingVectory)<=trackingRect->width/5.0)&&(abs(TempMovingVectorx)<=trackingRect->height/5.0) )
-				{
-					TempMoveScale = sqrt((double)(TempMovingVectorx*TempMovingVectorx+TempMovingVectory*TempMovingVectory));
-					if (TempMoveScale>MaxMove)
-					{
-						MovingVectorx = TempMovingVectorx;
-						MovingVectory = TempMovingVectory;
-						MaxMove = TempMoveScale;
-					}
-					feat_cmp->fwd_match = nbrs[0];
-					imhdr->paintPoint(Point2D(nbrs[0]->y+trackingRect->upper,nbrs[0]->x+trackingRect->left),Color(0,255,0),3);
-					imhdr->paintPoint(Point2D(feat_cmp->y+trackingWindow->upper,feat_cmp->x+trackingWindow->left),Color(255,0,0),3);
-					count++;
-				}
-			}
+			imhdr->paintPoint(from,Color(0,255,0),3);
+			imhdr->paintPoint(to,Color(255,0,0),3);
+			matchFrom.push_back(from);
+			matchTo.push_back(to);
+			/* distinctive matches are sampled first */
+			matchQuality.push_back(matches[i].score);
 		}
-		free(nbrs);
 	}
-	if((double)count/(double)this->Sfeat_num<=0)
+	if (!estimator.estimate(matchFrom,matchTo,&motion,NULL,&matchQuality))
 		return false;
-	
-	if (sqrt((double)(MovingVectorx*MovingVectorx+MovingVectory*MovingVectory))>TRACKING_PIXEL_THR)
-	{
-		MovingVector = Point2D(cvRound(MovingVectory),cvRound(MovingVectorx));
-		*trackingRect = *trackingRect+MovingVector; 
-	}
-	
+
+	*trackingRect = motion.mapRect(*trackingRect);
 	imhdr->paintRectangle(*trackingRect);
 	imhdr->paintRectangle(*trackingWindow);
 	return true;
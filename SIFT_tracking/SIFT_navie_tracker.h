@@ -1,7 +1,7 @@
 #pragma once
 #include "SIFT_feature.h"
-#include "kdtree.h"
-#include "minpq.h"
+#include "SIFT_matcher.h"
+#include "MotionEstimator.h"
 
 class SIFT_navie_tracker
 {
@@ -12,7 +12,9 @@ public:
 	{
 		tracking_template = Sfeat;
 		this->Sfeat_num = Sfeat_num_fp;
-		kd_root = kdtree_build(Sfeat->GetFeat(0),this->Sfeat_num);
+		matcher.set_template(Sfeat);
+		this->tmplHeight = trackingRect.height;
+		this->tmplWidth = trackingRect.width;
 		this->TrackingWindow.upper = trackingRect.upper-cvRound(TRACKING_WINDOW_SIZE*trackingRect.height);
 		this->TrackingWindow.left = trackingRect.left-cvRound(TRACKING_WINDOW_SIZE*trackingRect.width);
 		this->TrackingWindow.width = trackingRect.width+cvRound(TRACKING_WINDOW_SIZE*trackingRect.width);
@@ -24,9 +26,15 @@ public:
 
 private:
 	int Sfeat_num;
-	kd_node *kd_root;
+	SIFT_matcher matcher;
+	vector<struct sift_match> matches;
 	SIFT_feature *tracking_template;
 	Rect TrackingWindow;
-
-	
+	/* template size; template keypoints scale with the box */
+	int tmplHeight;
+	int tmplWidth;
+	MotionEstimator estimator;
+	vector<Point2D> matchFrom;
+	vector<Point2D> matchTo;
+	vector<double> matchQuality;
 };
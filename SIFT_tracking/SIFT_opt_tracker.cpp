@@ -3,91 +3,191 @@
 
 SIFT_opt_tracker::SIFT_opt_tracker(void)
 {
+	boxRow = boxCol = boxHeight = boxWidth = 0;
+	flow = NULL;
+	pool = NULL;
+	ownEngine = false;
 }
 
 SIFT_opt_tracker::~SIFT_opt_tracker(void)
 {
+	if (ownEngine)
+	{
+		delete flow;
+		delete pool;
+	}
 }
 
-bool SIFT_opt_tracker::tracking(ImageHandler* imhdr,SIFT_feature *Sfeat, int Sfeat_num_fp,Rect *trackingWindow,Rect *trackingRect)
+void SIFT_opt_tracker::replenish(SIFT_feature *Sfeat,Rect *featWindow,Rect *trackingRect)
 {
-	int count=0;
-	/*struct SIFT_feature_unit *feat_cmp;
-	struct SIFT_feature_unit **nbrs;
-	int k = 0;
-	double d0,d1;*/
-	Point2D MovingVector(0,0);
-	Point2D GlobalCoor(0,0);
-	Point2D TempMovingVector(0,0);
-	double MovingVectorx,MovingVectory,TempMovingVectorx,TempMovingVectory;
-	double MaxMove=0;
-	double TempMoveScale = 0;
-	double theta=0.0;
-	double orghistogram[12];
-	memset(orghistogram,0,12);
-	IplImage* temp;
-	temp = cvCloneImage(imhdr->getIplGrayImage());
-	for (int i = 0;i<this->optflow.size();i++)
-	{
-		//GlobalCoor = Point2D(tracking_template->GetFeat(i)->y+trackingRect->upper,tracking_template->GetFeat(i)->x+trackingRect->left);
-		MovingVector = getOptFlow(imhdr->getIplGrayImage(),optflow[i],this->preFrame);
-		GlobalCoor = optflow[i]+MovingVector;
-		orghistogram[(int)(atan((double)MovingVector.drow/(double)MovingVector.dcol)/(PI/6.0))] +=(sqrt((double)(MovingVector.dcol*MovingVector.dcol+MovingVector.drow*MovingVector.drow)));
-		imhdr->paintPoint(optflow[i],Color(0,255,0));
-		imhdr->paintPoint(GlobalCoor,Color(255,0,0));
-		this->optflow[i] = GlobalCoor;
-		//feat_cmp = Sfeat->GetFeat(i);
-		//k = kdtree_bbf_knn(kd_root,feat_cmp,2,&nbrs,200);
-		//if (k==2)
-		//{
-		//	d0 = descr_dist_sq(feat_cmp,nbrs[0]);
-		//	d1 = descr_dist_sq(feat_cmp,nbrs[1]);
-		//	if(d0<d1 * 0.5)
-		//	{
-		//		//TempMovingVector = Point2D(feat_cmp->img_pt.x-nbrs[0]->img_pt.x,feat_cmp->img_pt.y-nbrs[0]->img_pt.y);
-		//		TempMovingVectorx = feat_cmp->img_pt.x-(nbrs[0]->img_pt.x+(trackingRect->left-trackingWindow->left));
-		//		TempMovingVectory = feat_cmp->img_pt.y-(nbrs[0]->img_pt.y+(trackingRect->upper-trackingWindow->upper));
-		//		if ((abs(TempMovingVectory)<=trackingRect->width/5.0)&&(abs(TempMovingVectorx)<=trackingRect->height/5.0) )
-		//		{
-		//			TempMoveScale = sqrt((double)(TempMovingVectorx*TempMovingVectorx+TempMovingVectory*TempMovingVectory));
-		//			if (TempMoveScale>MaxMove)
-		//			{
-		//				MovingVectorx = TempMovingVectorx;
-		//				MovingVectory = TempMovingVectory;
-		//				MaxMove = TempMoveScale;
-		//			}
-		//			feat_cmp->fwd_match = nbrs[0];
-		//			imhdr->paintPoint(Point2D(nbrs[0]->y+trackingRect->upper,nbrs[0]->x+trackingRect->left),Color(0,255,0),3);
-		//			imhdr->paintPoint(Point2D(feat_cmp->y+trackingWindow->upper,feat_cmp->x+trackingWindow->left),Color(255,0,0),3);
-		//			count++;
-		//		}
-		//	}
-		//}
-		//free(nbrs);
-	}
-	/*double MaxDirection=0,MaxDirectionI;
-	for (int i=0;i<12;i++)
+	featPtrs.resize(Sfeat->GetLength());
+	for (int i=0;i<Sfeat->GetLength();i++)
+		featPtrs[i] = Sfeat->GetFeat(i);
+	replenish((featPtrs.empty())? NULL : &featPtrs[0],(int)featPtrs.size(),featWindow,trackingRect);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//add keypoints lying inside trackingRect as new flow points, away from
+//the points already tracked, until the point budget is reached.
+//featWindow is the region the keypoints were detected in.
+//////////////////////////////////////////////////////////////////////////
+void SIFT_opt_tracker::replenish(struct SIFT_feature_unit **feats,int n,Rect *featWindow,Rect *trackingRect)
+{
+	Point2D p;
+	double dr,dc;
+	int i,j;
+
+	for (i=0;i<n&&(int)optflow.size()<TRACKING_FLOW_POINTS;i++)
 	{
-		if(orghistogram[i]>MaxDirection)
+		p = Point2D(feats[i]->y+featWindow->upper,feats[i]->x+featWindow->left);
+		if (p.drow<trackingRect->upper||p.drow>=trackingRect->upper+trackingRect->height||
+			p.dcol<trackingRect->left||p.dcol>=trackingRect->left+trackingRect->width)
+			continue;
+		for (j=0;j<(int)optflow.size();j++)
 		{
-			MaxDirection = orghistogram[i];
-			MaxDirectionI = i;
+			dr = p.drow-optflow[j].drow;
+			dc = p.dcol-optflow[j].dcol;
+			if (dr*dr+dc*dc<OPTICAL_FLOW_MIN_DIST*OPTICAL_FLOW_MIN_DIST)
+				break;
 		}
+		if (j==(int)optflow.size())
+			optflow.push_back(p);
 	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+//move the sub-pixel box with the motion of its points and write it back
+//rounded to trackingRect
+//////////////////////////////////////////////////////////////////////////
+void SIFT_opt_tracker::updateBox(Motion2D* motion,Rect *trackingRect)
+{
+	Point2D c = motion->map(Point2D(boxRow,boxCol));
+
+	boxRow = c.drow;
+	boxCol = c.dcol;
+	boxHeight *= motion->scaleY();
+	boxWidth *= motion->scaleX();
+	trackingRect->height = MAX(1,cvRound(boxHeight));
+	trackingRect->width = MAX(1,cvRound(boxWidth));
+	trackingRect->upper = cvRound(boxRow-boxHeight/2.0);
+	trackingRect->left = cvRound(boxCol-boxWidth/2.0);
+}
 
-	MovingVectorx = 
-	if((double)count/(double)this->tracking_template->GetLength()<=0)
+//////////////////////////////////////////////////////////////////////////
+//track the flow points into the current frame, keep those passing the
+//forward-backward and NCC checks and fit a motion to them; the box moves
+//with the motion and the points consistent with it are topped up with
+//keypoints of Sfeat, if given. Returns false when too few points survive.
+//////////////////////////////////////////////////////////////////////////
+bool SIFT_opt_tracker::tracking(ImageHandler* imhdr,SIFT_feature *Sfeat, int Sfeat_num_fp,Rect *trackingWindow,Rect *trackingRect)
+{
+	Motion2D motion;
+	double fbr,fbc;
+	int n = (int)this->optflow.size(),tracked = n,healthy = 0,i;
+
+	/* the previous frame's pyramid is reused; only this frame's is built */
+	if (ownEngine)
+		flow->pushFrame(imhdr->getIplGrayImage());
+	flow->trackPoints(this->optflow,flowDisp,flowStatus,flowErr,pool,false,&flowNcc);
+	flowNext.resize(n);
+	for (i=0;i<n;i++)
+		flowNext[i] = optflow[i]+flowDisp[i];
+	/* a consistent point tracked back lands where it started */
+	flow->trackPoints(flowNext,backDisp,backStatus,backErr,pool,true);
+
+	healthyFrom.clear();
+	for (i=0;i<n;i++)
+	{
+		if (!flowStatus[i]||!backStatus[i]||flowNcc[i]<OPTICAL_FLOW_NCC_THR)
+			continue;
+		fbr = flowDisp[i].drow+backDisp[i].drow;
+		fbc = flowDisp[i].dcol+backDisp[i].dcol;
+		if (fbr*fbr+fbc*fbc>OPTICAL_FLOW_FB_THR*OPTICAL_FLOW_FB_THR)
+			continue;
+		imhdr->paintPoint(optflow[i],Color(0,255,0));
+		imhdr->paintPoint(flowNext[i],Color(255,0,0));
+		healthyFrom.push_back(optflow[i]);
+		flowNext[healthy++] = flowNext[i];
+	}
+	flowNext.resize(healthy);
+	confidence = 0;
+	if (healthy<TRACKING_MIN_POINTS||!estimator.estimate(healthyFrom,flowNext,&motion,&inliers))
+	{
+		optflow.clear();
 		return false;
+	}
 
-	if (sqrt((double)(MovingVectorx*MovingVectorx+MovingVectory*MovingVectory))>TRACKING_PIXEL_THR)
+	/* points off the object's motion are dropped like lost ones */
+	for (i=0,n=0;i<healthy;i++)
+	{
+		if (inliers[i])
+			flowNext[n++] = flowNext[i];
+	}
+	flowNext.resize(n);
+	if (n<TRACKING_MIN_POINTS)
 	{
-		MovingVector = Point2D(cvRound(MovingVectory),cvRound(MovingVectorx));
-		*trackingRect = *trackingRect+MovingVector; 
+		optflow.clear();
+		return false;
 	}
-	
+
+	confidence = (double)n/tracked;
+	updateBox(&motion,trackingRect);
+	optflow.swap(flowNext);
+	if (Sfeat)
+		replenish(Sfeat,trackingWindow,trackingRect);
 	imhdr->paintRectangle(*trackingRect);
-	imhdr->paintRectangle(*trackingWindow);*/
-	this->preFrame = cvCloneImage(temp);
-	//delete temp;
 	return true;
-}
\ No newline at end of file
+}
+
+bool SIFT_opt_tracker::relocate(ImageHandler* imhdr,SIFT_feature *Sfeat,Rect *trackingWindow,Rect *trackingRect)
+{
+	featPtrs.resize(Sfeat->GetLength());
+	for (int i=0;i<Sfeat->GetLength();i++)
+		featPtrs[i] = Sfeat->GetFeat(i);
+	return relocate(imhdr,(featPtrs.empty())? NULL : &featPtrs[0],(int)featPtrs.size(),trackingWindow,trackingRect);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//match keypoints detected in the current frame against the template and
+//re-anchor the box on the template, which removes the drift flow has
+//accumulated; the template learns from the match and the flow points are
+//then topped up with the keypoints. featWindow is the region the keypoints
+//were detected in. Returns false, leaving the box alone, if the template
+//is not found.
+//////////////////////////////////////////////////////////////////////////
+bool SIFT_opt_tracker::relocate(ImageHandler* imhdr,struct SIFT_feature_unit **feats,int n,Rect *featWindow,Rect *trackingRect)
+{
+	struct SIFT_feature_unit *feat,*tmpl;
+	Motion2D motion;
+	bool found;
+
+	matcher.match(feats,n,matches);
+	matchFrom.clear();
+	matchTo.clear();
+	matchQuality.clear();
+	for (int i=0;i<(int)matches.size();i++)
+	{
+		feat = feats[matches[i].query];
+		tmpl = tracking_template->GetFeat(matches[i].train);
+		matchFrom.push_back(Point2D(tmpl->y+tmplRect.upper,tmpl->x+tmplRect.left));
+		matchTo.push_back(Point2D(feat->y+featWindow->upper,feat->x+featWindow->left));
+		matchQuality.push_back(matches[i].score);
+	}
+	found = (int)matches.size()>=TRACKING_MIN_POINTS&&
+		estimator.estimate(matchFrom,matchTo,&motion,&inliers,&matchQuality)&&
+		estimator.getNumInliers()>=TRACKING_MIN_POINTS;
+	if (found)
+	{
+		boxRow = tmplRect.upper+tmplRect.height/2.0;
+		boxCol = tmplRect.left+tmplRect.width/2.0;
+		boxHeight = tmplRect.height;
+		boxWidth = tmplRect.width;
+		updateBox(&motion,trackingRect);
+		imhdr->paintRectangle(*trackingRect,Color(0,255,255));
+		if (store.update(feats,n,featWindow,matches,inliers,&motion,trackingRect))
+			matcher.set_template(tracking_template);
+	}
+	if (found||!optflow.empty())
+		replenish(feats,n,featWindow,trackingRect);
+	return found;
+}
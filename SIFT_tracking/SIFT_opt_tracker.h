@@ -1,38 +1,86 @@
 #pragma once
 #include "SIFT_feature.h"
-#include "kdtree.h"
-#include "minpq.h"
+#include "PyrLKFlow.h"
+#include "MotionEstimator.h"
+#include "SIFT_matcher.h"
+#include "TemplateStore.h"
 
 class SIFT_opt_tracker
 {
 public:
 	SIFT_opt_tracker(void);
 	~SIFT_opt_tracker(void);
-	SIFT_opt_tracker(SIFT_feature* Sfeat,IplImage* preF,int Sfeat_num_fp,Rect trackingRect)
+	/* trackers of one video may share a flow engine and pool; whoever owns
+	   a shared engine pushes each frame into it once */
+	SIFT_opt_tracker(SIFT_feature* Sfeat,IplImage* preF,int Sfeat_num_fp,Rect trackingRect,
+		PyrLKFlow* sharedFlow = NULL,ThreadPool* sharedPool = NULL)
 	{
 		tracking_template = Sfeat;
 		//this->Sfeat_num = Sfeat_num_fp;
-		kd_root = kdtree_build(Sfeat->GetFeat(0),tracking_template->GetLength());
 		this->TrackingWindow.upper = trackingRect.upper-cvRound(TRACKING_WINDOW_SIZE*trackingRect.height);
 		this->TrackingWindow.left = trackingRect.left-cvRound(TRACKING_WINDOW_SIZE*trackingRect.width);
 		this->TrackingWindow.width = trackingRect.width+cvRound(TRACKING_WINDOW_SIZE*trackingRect.width);
 		this->TrackingWindow.height = trackingRect.height+cvRound(TRACKING_WINDOW_SIZE*trackingRect.height);
-		for (int i=0;i<tracking_template->GetLength();i++)
-		{
-			optflow.push_back(Point2D(tracking_template->GetFeat(i)->y+trackingRect.upper,tracking_template->GetFeat(i)->x+trackingRect.left));
-		}
-		this->preFrame = cvCloneImage(preF);
+		this->boxRow = trackingRect.upper+trackingRect.height/2.0;
+		this->boxCol = trackingRect.left+trackingRect.width/2.0;
+		this->boxHeight = trackingRect.height;
+		this->boxWidth = trackingRect.width;
+		this->tmplRect = trackingRect;
+		this->confidence = 1.0;
+		store.init(Sfeat,trackingRect);
+		matcher.set_template(Sfeat);
+		replenish(Sfeat,&trackingRect,&trackingRect);
+		this->ownEngine = (sharedFlow==NULL);
+		this->flow = (ownEngine)? new PyrLKFlow : sharedFlow;
+		this->pool = (ownEngine)? new ThreadPool(TRACKING_FLOW_THREADS) : sharedPool;
+		if (ownEngine)
+			flow->pushFrame(preF);
 	};
 	bool tracking(ImageHandler* imhdr,SIFT_feature *Sfeat, int Sfeat_num_fp, Rect *trackingwindow,Rect *trackingRect);
+	bool relocate(ImageHandler* imhdr,SIFT_feature *Sfeat,Rect *trackingWindow,Rect *trackingRect);
+	bool relocate(ImageHandler* imhdr,struct SIFT_feature_unit **feats,int n,Rect *featWindow,Rect *trackingRect);
+	double getConfidence(){return confidence;};
 	Point2D CaculatePointVector(SIFT_feature_unit sfu,IplImage ipim);
 	/*Point2D GetCentroid();
 	double GetDensity();*/
 
 private:
+	void replenish(SIFT_feature *Sfeat,Rect *featWindow,Rect *trackingRect);
+	void replenish(struct SIFT_feature_unit **feats,int n,Rect *featWindow,Rect *trackingRect);
+	void updateBox(Motion2D* motion,Rect *trackingRect);
+
 	//int Sfeat_num;
-	kd_node *kd_root;
 	SIFT_feature *tracking_template;
-	IplImage* preFrame;
 	Rect TrackingWindow;
 	vector<Point2D> optflow;
+	PyrLKFlow* flow;
+	ThreadPool* pool;
+	bool ownEngine;
+	vector<struct SIFT_feature_unit*> featPtrs;
+	vector<Point2D> flowDisp;
+	vector<uchar> flowStatus;
+	vector<double> flowErr;
+	vector<double> flowNcc;
+	vector<Point2D> flowNext;
+	vector<Point2D> backDisp;
+	vector<uchar> backStatus;
+	vector<double> backErr;
+	vector<Point2D> healthyFrom;
+	MotionEstimator estimator;
+	vector<uchar> inliers;
+	SIFT_matcher matcher;
+	vector<struct sift_match> matches;
+	vector<Point2D> matchFrom;
+	vector<Point2D> matchTo;
+	vector<double> matchQuality;
+	TemplateStore store;
+	/* box the template was cut from */
+	Rect tmplRect;
+	/* share of the tracked points that survived the last frame */
+	double confidence;
+	/* sub-pixel tracking box, kept apart from the integer trackingRect */
+	double boxRow;
+	double boxCol;
+	double boxHeight;
+	double boxWidth;
 };
@@ -11,8 +11,33 @@ int mouse_value;
 bool mouse_exit;
 Rect* trackingRect = new Rect;
 
-int _tmain()
+int _tmain(int argc, _TCHAR* argv[])
 {
+	/* with arguments, track headless and exit */
+	if (argc > 1)
+	{
+		vector<string> args(argc);
+		vector<char*> argp(argc);
+		for (int i=0;i<argc;i++)
+		{
+#ifdef _UNICODE
+			char arg[MAX_PATH*4];
+			WideCharToMultiByte(CP_ACP, 0, argv[i], -1, arg, sizeof(arg), NULL, NULL);
+			args[i] = arg;
+#else
+			args[i] = argv[i];
+#endif
+			argp[i] = &args[i][0];
+		}
+		BatchRunner runner;
+		if (!runner.parseArgs(argc, &argp[0]))
+		{
+			BatchRunner::printUsage();
+			return 1;
+		}
+		return runner.run();
+	}
+
 	cout<<"//////////////////////////////////////////////////////////////////////////"<<endl;
     cout<<"online boosting with SIFT"<<endl;
 	cout<<"//////////////////////////////////////////////////////////////////////////"<<endl;
@@ -68,24 +93,20 @@ void track(ImageSource::InputDevice input, int numBaseClassifier, int searchFact
 {
 	IplImage* curFrame=NULL;
 	int key;
+	/* frame buffers and detector temporaries of this stream, under one cap */
+	ImagePool* framePool = new ImagePool((size_t)IMAGE_POOL_MAX_MB*1024*1024);
 	//choose the image source
 	ImageSource *imageSequenceSource;
-	switch (input)
+	ImageSourcePrefetch *prefetch;
+	imageSequenceSource = BatchRunner::openSource(input, source, framePool, &prefetch);
+	if (imageSequenceSource == NULL)
 	{
-	case ImageSource::AVI:
-		imageSequenceSource = new ImageSourceAVIFile(source);
-		break;
-	case ImageSource::DIRECTORY:
-		imageSequenceSource = new ImageSourceDir(source);
-		break;
-	case ImageSource::USB:
-		imageSequenceSource = new ImageSourceUSBCam();
-		break;
-	default:
+		delete framePool;
 		return;
 	}
+	double latency, latencySum = 0.0, latencyMax = 0.0;
 
-	ImageHandler* imageSequence = new ImageHandler (imageSequenceSource);
+	ImageHandler* imageSequence = new ImageHandler (imageSequenceSource, framePool);
 	imageSequence->getImage();
 
 	imageSequence->viewImage ("Tracking...", false);
@@ -155,31 +176,34 @@ void track(ImageSource::InputDevice input, int numBaseClassifier, int searchFact
 	//SIFTBoostingTracker* tracker;
 	//tracker = new SIFTBoostingTracker (curFrameRep,imageSequence->getIplGrayImage(), trackingRect, wholeImage, numBaseClassifier);
 	
-	SIFT_feature* trackingTemplateRep = new SIFT_feature(curFrame,*trackingRect); 
+	/* template and frames share the object-driven scale range */
+	struct sift_options tmplOpts;
+	init_sift_options( &tmplOpts );
+	tmplOpts.img_dbl = SIFT_IMG_DBL_ADAPTIVE;
+	tmplOpts.pool = framePool;
 	//SIFT_navie_tracker *tracker;
 	//tracker = new SIFT_navie_tracker(trackingTemplateRep,trackingTemplateRep->GetLength(),*trackingRect);
-	SIFT_opt_tracker * tracker;
-	tracker = new SIFT_opt_tracker(trackingTemplateRep,imageSequence->getIplGrayImage(),trackingTemplateRep->GetLength(),*trackingRect);
+	/* targets share one flow pyramid and one SIFT pass per frame */
+	MultiTargetTracker* tracker;
+	tracker = new MultiTargetTracker(wholeImage,&tmplOpts);
+	tracker->addTarget(imageSequence,*trackingRect);
 	cout<<" done"<<endl;
 
 	Size trackingRectSize;
 	trackingRectSize = *trackingRect;
 	cout<<"start tracking (stop by pressing any key)..."<<endl;
 
-	FILE* resultStream;
+	/* boxes and painted frames are written on the writer's threads */
+	ResultWriter* results = NULL;
 	if (resultDir[0]!=0)
 	{
-		char *myBuff = new char[255];
-		sprintf_s(myBuff, 255,"%s/SIFTTracker.txt", resultDir);
-		resultStream = fopen(myBuff, "w");
-		delete[] myBuff;
+		char logFile[255];
+		sprintf_s(logFile, 255,"%s/SIFTTracker.txt", resultDir);
+		results = new ResultWriter(logFile, resultDir, framePool,
+			RESULT_WRITER_THREADS, RESULT_WRITER_QUEUE, RESULT_LOG_BATCH);
 	}
 
 	int counter= 0;
-	IplImage* tracktemplate;
-	tracktemplate = cvCreateImage(cvSize(trackingRect->width,trackingRect->height),
-		curFrame->depth,
-		curFrame->nChannels);
 	bool trackerLost = false;
 //	ConvertImage(curFrame,tracktemplate,trackingRect);
 //	curFrameRep->draw_features(imageSequence,trackingRect);
@@ -271,10 +295,6 @@ void track(ImageSource::InputDevice input, int numBaseClassifier, int searchFact
 
 	//clean up
 	key=(char)-1;
-	SIFT_feature *curFrameRep;
-	Rect TrackingWindow;
-	/* tracking window initialized */
-	ModifyTrackingWindows(*trackingRect,&TrackingWindow,wholeImage);
 	/*TrackingWindow.upper = trackingRect.upper-cvRound(TRACKING_WINDOW_SIZE*trackingRect.height);
 	TrackingWindow.left = trackingRect.left-cvRound(TRACKING_WINDOW_SIZE*trackingRect.width);
 	TrackingWindow.width = trackingRect.width+cvRound(TRACKING_WINDOW_SIZE*trackingRect.width);
@@ -293,11 +313,7 @@ void track(ImageSource::InputDevice input, int numBaseClassifier, int searchFact
 			delete[] curFrame;
 		}*/
 		//preFrame = (IplImage*)imageSequence->getIplGrayImage();
-		imageSequence->getImage();
-		curFrame = (IplImage*)imageSequence->getIplImage();
-		curFrameRep = new SIFT_feature(curFrame,TrackingWindow);
-
-		if (curFrame == NULL)
+		if (!imageSequence->getImage())
 		{
 			break;
 		}
@@ -307,38 +323,45 @@ void track(ImageSource::InputDevice input, int numBaseClassifier, int searchFact
 			cout<<"tracking lost!!!"<<endl;
 			break;
 		}*/
-		if (!tracker->tracking(imageSequence,curFrameRep,curFrameRep->GetLength(),&TrackingWindow,trackingRect))
+		if (tracker->track(imageSequence)==0)
 		{
 			cout<<"tracking lost!!!"<<endl;
 			break;
 		}
+		*trackingRect = tracker->getBox(0);
 		/*curFrameRep->draw_features(imageSequence,trackingRect);
 		trackingTemplateRep->draw_features(imageSequence,trackingRect);*/
-		ModifyTrackingWindows(*trackingRect,&TrackingWindow,wholeImage);
 		imageSequence->viewImage("Tracking...",false);
-		if (resultDir[0]!=0)
+		/* capture to display */
+		if (prefetch != NULL)
 		{
-						/*if (trackerLost)
-							fprintf (resultStream, "%8d 0 0 0 0 -1\n", counter);
-						else
-							fprintf (resultStream, "%8d %3d %3d %3d %3d %5.3f\n", counter, tracker->getTrackedPatch().left, tracker->getTrackedPatch().upper, tracker->getTrackedPatch().width, tracker->getTrackedPatch().height, tracker->getConfidence());*/
-			
-				char *myBuff = new char[255];
-				int flag = sprintf (myBuff, "%sframe%08d.jpg", resultDir, counter+2);
-				imageSequence->saveImage(myBuff);
+			latency = wallTime() - prefetch->getCaptureTime();
+			latencySum += latency;
+			latencyMax = MAX(latencyMax, latency);
 		}
-		counter++;
-		cvWaitKey(20);
-		if (curFrameRep)
+		if (results != NULL)
 		{
-			delete curFrameRep;
+			results->writeTargets(counter+2, tracker);
+			results->writeFrame(counter+2, imageSequence->getPaintedImage());
 		}
-
+		counter++;
+		/* a live camera is not slowed down beyond what HighGUI needs */
+		cvWaitKey((input == ImageSource::USB)? 1 : 20);
 	}
-	//delete tracker;
-	delete imageSequenceSource;
+	cout<<"SIFT detection on "<<tracker->getNumDetections()<<" of "<<tracker->getNumFrames()<<" frames"<<endl;
+	if (prefetch != NULL && counter > 0)
+		cout<<"frames dropped: "<<prefetch->getNumDropped()<<", latency queue "<<prefetch->getMeanQueueLatency()*1000
+			<<" ms (max "<<prefetch->getMaxQueueLatency()*1000<<"), end to end "<<latencySum/counter*1000
+			<<" ms (max "<<latencyMax*1000<<")"<<endl;
+	/* waits for the queued results */
+	delete results;
+	delete tracker;
+	/* the handler's frame views go back to the source */
 	delete imageSequence;
-	if (curFrame == NULL)
-		delete[] curFrame;
+	delete imageSequenceSource;
+	cvReleaseImage(&curFrame);
+	cout<<"image pool: "<<framePool->getNumHits()<<" hits, "<<framePool->getNumMisses()<<" misses, "
+		<<framePool->getNumFailures()<<" failures, "<<framePool->getNumUnpooled()<<" unpooled, peak "<<framePool->getPeakBytes()/1024<<" KB"<<endl;
+	delete framePool;
 	//delete curFrameRep;
 }
\ No newline at end of file
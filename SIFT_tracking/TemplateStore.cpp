@@ -0,0 +1,162 @@
+#include "StdAfx.h"
+#include "TemplateStore.h"
+
+TemplateStore::TemplateStore(int capacity, int maxAge)
+{
+	this->tmpl = NULL;
+	this->capacity = MAX(1,capacity);
+	this->maxAge = maxAge;
+	this->numUpdates = 0;
+	this->numAdded = 0;
+	this->numEvicted = 0;
+}
+
+void TemplateStore::init(SIFT_feature* tmpl, Rect tmplRect)
+{
+	this->tmpl = tmpl;
+	this->tmplRect = tmplRect;
+	this->numUpdates = 0;
+	for (int i=0;i<tmpl->GetLength();i++)
+		tmpl->SetLastMatch(i,0);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//fold one successful relocation into the template. matches index feats
+//and the template, inliers flags the matches consistent with motion, the
+//template to frame motion, and box is the relocated box. Returns true if
+//keypoints were learned or evicted, in which case the template's indices
+//have changed and the matcher must be given the template again.
+//////////////////////////////////////////////////////////////////////////
+bool TemplateStore::update(struct SIFT_feature_unit** feats, int n, Rect* featWindow,
+						   const vector<struct sift_match>& matches, const vector<uchar>& inliers,
+						   Motion2D* motion, Rect* box)
+{
+	int numInliers = 0,changed = 0;
+
+	if (tmpl==NULL)
+		return false;
+	numUpdates++;
+	matched.assign(n,0);
+	for (int i=0;i<(int)matches.size();i++)
+	{
+		matched[matches[i].query] = 1;
+		if (!inliers[i])
+			continue;
+		tmpl->AddMatchCount(matches[i].train);
+		tmpl->SetLastMatch(matches[i].train,numUpdates);
+		numInliers++;
+	}
+
+	/* only learn from frames where the template is found beyond doubt */
+	if (numInliers>=TEMPLATE_ADD_MIN_INLIERS&&numInliers>=TEMPLATE_ADD_MIN_RATIO*matches.size())
+		changed += learn(feats,n,featWindow,motion,box);
+	changed += evictStale();
+	changed += evictOverCapacity();
+	return changed>0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//add unmatched keypoints lying in the box, mapped into template
+//coordinates; keypoints close to one the template holds are skipped.
+//Returns the number of keypoints added.
+//////////////////////////////////////////////////////////////////////////
+int TemplateStore::learn(struct SIFT_feature_unit** feats, int n, Rect* featWindow, Motion2D* motion, Rect* box)
+{
+	Motion2D back = motion->inverse();
+	double scale = sqrt(fabs(motion->a[0]*motion->a[4]-motion->a[1]*motion->a[3]));
+	double rot = atan2(motion->a[3],motion->a[0]);
+	double minDist = TEMPLATE_MIN_DIST*TEMPLATE_MIN_DIST,dr,dc;
+	struct SIFT_feature_unit f;
+	Point2D p;
+	int added = 0,m = tmpl->GetLength(),i,k;
+
+	if (scale<DBL_EPSILON)
+		return 0;
+	for (i=0;i<n&&added<TEMPLATE_MAX_ADD;i++)
+	{
+		if (matched[i])
+			continue;
+		p = Point2D(feats[i]->y+featWindow->upper,feats[i]->x+featWindow->left);
+		if (p.drow<box->upper||p.drow>=box->upper+box->height||
+			p.dcol<box->left||p.dcol>=box->left+box->width)
+			continue;
+		p = back.map(p);
+		p.drow -= tmplRect.upper;
+		p.dcol -= tmplRect.left;
+
+		for (k=0;k<m;k++)
+		{
+			dr = tmpl->GetFeat(k)->y-p.drow;
+			dc = tmpl->GetFeat(k)->x-p.dcol;
+			if (dr*dr+dc*dc<minDist)
+				break;
+		}
+		if (k<m)
+			continue;
+
+		f = *feats[i];
+		f.x = f.img_pt.x = p.dcol;
+		f.y = f.img_pt.y = p.drow;
+		f.scl /= scale;
+		/* orientations count counterclockwise with the row axis pointing up */
+		f.ori += rot;
+		while (f.ori>=CV_PI)
+			f.ori -= 2*CV_PI;
+		while (f.ori<-CV_PI)
+			f.ori += 2*CV_PI;
+		f.fwd_match = f.bck_match = f.mdl_match = NULL;
+		f.feature_data = NULL;
+		tmpl->AddFeat(f,numUpdates);
+		added++;
+		m++;
+	}
+	numAdded += added;
+	return added;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//drop keypoints unmatched for more than maxAge updates
+//////////////////////////////////////////////////////////////////////////
+int TemplateStore::evictStale()
+{
+	int evicted = 0;
+
+	if (maxAge<=0)
+		return 0;
+	/* removal moves the last keypoint into the hole, so walk backwards */
+	for (int i=tmpl->GetLength()-1;i>=0;i--)
+	{
+		if (numUpdates-tmpl->GetLastMatch(i)>maxAge)
+		{
+			tmpl->RemoveFeat(i);
+			evicted++;
+		}
+	}
+	numEvicted += evicted;
+	return evicted;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//drop the least recently matched keypoints, the least matched among
+//equals, until the template is within capacity
+//////////////////////////////////////////////////////////////////////////
+int TemplateStore::evictOverCapacity()
+{
+	int evicted = 0,worst,i;
+
+	while (tmpl->GetLength()>capacity)
+	{
+		worst = 0;
+		for (i=1;i<tmpl->GetLength();i++)
+		{
+			if (tmpl->GetLastMatch(i)<tmpl->GetLastMatch(worst)||
+				(tmpl->GetLastMatch(i)==tmpl->GetLastMatch(worst)&&
+				tmpl->GetMatchCount(i)<tmpl->GetMatchCount(worst)))
+				worst = i;
+		}
+		tmpl->RemoveFeat(worst);
+		evicted++;
+	}
+	numEvicted += evicted;
+	return evicted;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "SIFT_feature.h"
+#include "SIFT_matcher.h"
+#include "MotionEstimator.h"
+
+/*
+Keeps the keypoints of a tracking template up to date over a long run.
+Every successful relocation counts a match for each template keypoint
+among its inliers; when the relocation is well supported, keypoints
+detected inside the box that matched nothing are mapped back into the
+template and learned.  Keypoints that went unmatched through maxAge
+relocations are evicted, and the least recently matched ones go first
+when the template grows past its capacity, so matching cost stays bounded.
+Age is counted in relocations, not frames, so an occluded target keeps
+its template.
+*/
+class TemplateStore
+{
+public:
+	TemplateStore(int capacity = TEMPLATE_CAPACITY, int maxAge = TEMPLATE_MAX_AGE);
+	void init(SIFT_feature* tmpl, Rect tmplRect);
+	bool update(struct SIFT_feature_unit** feats, int n, Rect* featWindow,
+		const vector<struct sift_match>& matches, const vector<uchar>& inliers,
+		Motion2D* motion, Rect* box);
+	int getNumUpdates(){return numUpdates;};
+	int getNumAdded(){return numAdded;};
+	int getNumEvicted(){return numEvicted;};
+
+private:
+	int learn(struct SIFT_feature_unit** feats, int n, Rect* featWindow, Motion2D* motion, Rect* box);
+	int evictStale();
+	int evictOverCapacity();
+
+	SIFT_feature* tmpl;
+	/* box the template keypoint coordinates are relative to */
+	Rect tmplRect;
+	int capacity;
+	int maxAge;
+	int numUpdates;
+	int numAdded;
+	int numEvicted;
+	/* 1 for frame keypoints of the current update that matched the template */
+	vector<uchar> matched;
+};
@@ -0,0 +1,362 @@
+#include "StdAfx.h"
+#include "Thread.h"
+
+#if OS_type==2
+#include <process.h>
+#endif
+
+long atomicAdd(volatile long* value, long delta)
+{
+#if OS_type==2
+	return InterlockedExchangeAdd(value, delta) + delta;
+#elif OS_type==1
+	return __sync_add_and_fetch(value, delta);
+#else
+	return *value += delta;
+#endif
+}
+
+double wallTime()
+{
+#if OS_type==2
+	LARGE_INTEGER count, freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (double)count.QuadPart/freq.QuadPart;
+#elif OS_type==1
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+#else
+	return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////
+//Mutex
+//////////////////////////////////////////////////////////////////////////
+
+Mutex::Mutex(void)
+{
+#if OS_type==2
+	InitializeCriticalSection(&cs);
+#elif OS_type==1
+	pthread_mutex_init(&mutex, NULL);
+#endif
+}
+
+Mutex::~Mutex(void)
+{
+#if OS_type==2
+	DeleteCriticalSection(&cs);
+#elif OS_type==1
+	pthread_mutex_destroy(&mutex);
+#endif
+}
+
+void Mutex::lock()
+{
+#if OS_type==2
+	EnterCriticalSection(&cs);
+#elif OS_type==1
+	pthread_mutex_lock(&mutex);
+#endif
+}
+
+void Mutex::unlock()
+{
+#if OS_type==2
+	LeaveCriticalSection(&cs);
+#elif OS_type==1
+	pthread_mutex_unlock(&mutex);
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////
+//Condition
+//////////////////////////////////////////////////////////////////////////
+
+Condition::Condition(void)
+{
+#if OS_type==2
+	InitializeConditionVariable(&cond);
+#elif OS_type==1
+	pthread_cond_init(&cond, NULL);
+#endif
+}
+
+Condition::~Condition(void)
+{
+#if OS_type==1
+	pthread_cond_destroy(&cond);
+#endif
+}
+
+void Condition::wait(Mutex& mutex)
+{
+#if OS_type==2
+	SleepConditionVariableCS(&cond, &mutex.cs, INFINITE);
+#elif OS_type==1
+	pthread_cond_wait(&cond, &mutex.mutex);
+#endif
+}
+
+bool Condition::wait(Mutex& mutex, double seconds)
+{
+#if OS_type==2
+	return SleepConditionVariableCS(&cond, &mutex.cs, (DWORD)MAX(0.0, seconds*1000)) != 0;
+#elif OS_type==1
+	struct timeval now;
+	struct timespec until;
+	double end;
+
+	gettimeofday(&now, NULL);
+	end = now.tv_sec + now.tv_usec*1e-6 + MAX(0.0, seconds);
+	until.tv_sec = (time_t)end;
+	until.tv_nsec = (long)((end - until.tv_sec)*1e9);
+	return pthread_cond_timedwait(&cond, &mutex.mutex, &until) == 0;
+#else
+	return false;
+#endif
+}
+
+void Condition::signal()
+{
+#if OS_type==2
+	WakeConditionVariable(&cond);
+#elif OS_type==1
+	pthread_cond_signal(&cond);
+#endif
+}
+
+void Condition::broadcast()
+{
+#if OS_type==2
+	WakeAllConditionVariable(&cond);
+#elif OS_type==1
+	pthread_cond_broadcast(&cond);
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////
+//Thread
+//////////////////////////////////////////////////////////////////////////
+
+Thread::Thread(void)
+{
+	running = false;
+	func = NULL;
+	arg = NULL;
+}
+
+Thread::~Thread(void)
+{
+	join();
+}
+
+#if OS_type==2
+unsigned __stdcall Thread::entry(void* self)
+{
+	((Thread*)self)->func(((Thread*)self)->arg);
+	return 0;
+}
+#elif OS_type==1
+void* Thread::entry(void* self)
+{
+	((Thread*)self)->func(((Thread*)self)->arg);
+	return NULL;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//start func(arg) on a new thread; returns false if no thread was started
+//////////////////////////////////////////////////////////////////////////
+bool Thread::start(ThreadFunc func, void* arg)
+{
+	if (running)
+		return false;
+	this->func = func;
+	this->arg = arg;
+#if OS_type==2
+	handle = (HANDLE)_beginthreadex(NULL, 0, entry, this, 0, NULL);
+	running = (handle != 0);
+#elif OS_type==1
+	running = (pthread_create(&handle, NULL, entry, this) == 0);
+#endif
+	return running;
+}
+
+void Thread::join()
+{
+	if (!running)
+		return;
+#if OS_type==2
+	WaitForSingleObject(handle, INFINITE);
+	CloseHandle(handle);
+#elif OS_type==1
+	pthread_join(handle, NULL);
+#endif
+	running = false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//ThreadPool
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+//numThreads of 0 starts one worker per core
+//////////////////////////////////////////////////////////////////////////
+ThreadPool::ThreadPool(int numThreads)
+{
+	int i;
+
+	if (numThreads <= 0)
+		numThreads = numCores();
+#if OS_type==0
+	numThreads = 0;
+#endif
+	this->pending = 0;
+	this->stopping = false;
+	this->threads = new Thread[MAX(1, numThreads)];
+	this->workers = new Worker[MAX(1, numThreads)];
+	this->numThreads = 0;
+	for (i = 0; i < numThreads; i++)
+	{
+		workers[i].pool = this;
+		workers[i].index = i;
+		if (!threads[i].start(workerMain, &workers[i]))
+			break;
+		this->numThreads++;
+	}
+}
+
+ThreadPool::~ThreadPool(void)
+{
+	int i;
+
+	mutex.lock();
+	stopping = true;
+	hasJob.broadcast();
+	mutex.unlock();
+	for (i = 0; i < numThreads; i++)
+		threads[i].join();
+	delete[] threads;
+	delete[] workers;
+}
+
+int ThreadPool::numCores()
+{
+#if OS_type==2
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return MAX(1, (int)info.dwNumberOfProcessors);
+#elif OS_type==1
+	return MAX(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+#else
+	return 1;
+#endif
+}
+
+void ThreadPool::workerMain(void* arg)
+{
+	Worker* worker = (Worker*)arg;
+	ThreadPool* pool = worker->pool;
+	Job job;
+
+	pool->mutex.lock();
+	for (;;)
+	{
+		while (pool->jobs.empty() && !pool->stopping)
+			pool->hasJob.wait(pool->mutex);
+		if (pool->jobs.empty())
+			break;
+		job = pool->jobs.front();
+		pool->jobs.pop_front();
+		pool->mutex.unlock();
+
+		job.task(job.arg, worker->index);
+
+		pool->mutex.lock();
+		if (--pool->pending == 0)
+			pool->done.broadcast();
+	}
+	pool->mutex.unlock();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//queue a task; it runs inline when the pool has no threads
+//////////////////////////////////////////////////////////////////////////
+void ThreadPool::submit(ThreadTask task, void* arg)
+{
+	Job job;
+
+	if (numThreads == 0)
+	{
+		task(arg, 0);
+		return;
+	}
+	job.task = task;
+	job.arg = arg;
+	mutex.lock();
+	jobs.push_back(job);
+	pending++;
+	hasJob.signal();
+	mutex.unlock();
+}
+
+//////////////////////////////////////////////////////////////////////////
+//block until every submitted task has finished
+//////////////////////////////////////////////////////////////////////////
+void ThreadPool::wait()
+{
+	mutex.lock();
+	while (pending > 0)
+		done.wait(mutex);
+	mutex.unlock();
+}
+
+struct ParallelChunk
+{
+	ThreadRange range;
+	void* arg;
+	int begin;
+	int end;
+};
+
+static void runChunk(void* arg, int worker)
+{
+	ParallelChunk* chunk = (ParallelChunk*)arg;
+	chunk->range(chunk->arg, worker, chunk->begin, chunk->end);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//split [begin, end) into chunks of at least grain indices, a few per
+//worker so that uneven chunks balance out, and wait for all of them
+//////////////////////////////////////////////////////////////////////////
+void ThreadPool::parallelFor(int begin, int end, int grain, ThreadRange range, void* arg)
+{
+	ParallelChunk* chunks;
+	int n = end - begin, size, count, i;
+
+	if (n <= 0)
+		return;
+	size = MAX(MAX(1, grain), (n + 4 * getNumWorkers() - 1) / (4 * getNumWorkers()));
+	count = (n + size - 1) / size;
+	if (numThreads == 0 || count == 1)
+	{
+		range(arg, 0, begin, end);
+		return;
+	}
+
+	chunks = new ParallelChunk[count];
+	for (i = 0; i < count; i++)
+	{
+		chunks[i].range = range;
+		chunks[i].arg = arg;
+		chunks[i].begin = begin + i * size;
+		chunks[i].end = MIN(end, begin + (i + 1) * size);
+		submit(runChunk, &chunks[i]);
+	}
+	wait();
+	delete[] chunks;
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include "OS_specific.h"
+#include <deque>
+
+#if OS_type==1
+#include <pthread.h>
+#endif
+
+/* entry point of a Thread */
+typedef void (*ThreadFunc)(void* arg);
+
+/* task run by a ThreadPool; worker is the index of the running worker */
+typedef void (*ThreadTask)(void* arg, int worker);
+
+/* body of ThreadPool::parallelFor, called on the index range [begin, end) */
+typedef void (*ThreadRange)(void* arg, int worker, int begin, int end);
+
+/* adds delta to a counter shared between threads; returns the new value */
+long atomicAdd(volatile long* value, long delta);
+
+/* seconds since an arbitrary start, for timing across threads */
+double wallTime();
+
+class Mutex
+{
+public:
+	Mutex(void);
+	~Mutex(void);
+	void lock();
+	void unlock();
+
+private:
+	friend class Condition;
+#if OS_type==2
+	CRITICAL_SECTION cs;
+#elif OS_type==1
+	pthread_mutex_t mutex;
+#endif
+};
+
+class Condition
+{
+public:
+	Condition(void);
+	~Condition(void);
+	void wait(Mutex& mutex);
+	/* false if seconds passed without a wakeup */
+	bool wait(Mutex& mutex, double seconds);
+	void signal();
+	void broadcast();
+
+private:
+#if OS_type==2
+	CONDITION_VARIABLE cond;
+#elif OS_type==1
+	pthread_cond_t cond;
+#endif
+};
+
+class Thread
+{
+public:
+	Thread(void);
+	~Thread(void);
+	bool start(ThreadFunc func, void* arg);
+	void join();
+	bool isRunning(){return running;};
+
+private:
+	bool running;
+	ThreadFunc func;
+	void* arg;
+#if OS_type==2
+	HANDLE handle;
+	static unsigned __stdcall entry(void* self);
+#elif OS_type==1
+	pthread_t handle;
+	static void* entry(void* self);
+#endif
+};
+
+/*
+Fixed set of worker threads serving a task queue.  With no threads (or on
+an unknown OS) tasks run inline on the submitting thread as worker 0.
+*/
+class ThreadPool
+{
+public:
+	ThreadPool(int numThreads = 0);
+	~ThreadPool(void);
+	void submit(ThreadTask task, void* arg);
+	void wait();
+	void parallelFor(int begin, int end, int grain, ThreadRange range, void* arg);
+	int getNumWorkers(){return MAX(1, numThreads);};
+	static int numCores();
+
+private:
+	struct Job
+	{
+		ThreadTask task;
+		void* arg;
+	};
+	struct Worker
+	{
+		ThreadPool* pool;
+		int index;
+	};
+	static void workerMain(void* arg);
+
+	int numThreads;
+	Thread* threads;
+	Worker* workers;
+	std::deque<Job> jobs;
+	int pending;
+	bool stopping;
+	Mutex mutex;
+	Condition hasJob;
+	Condition done;
+};
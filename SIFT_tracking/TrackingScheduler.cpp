@@ -0,0 +1,39 @@
+#include "StdAfx.h"
+#include "TrackingScheduler.h"
+
+TrackingScheduler::TrackingScheduler(int period, double minConfidence)
+{
+	this->period = period;
+	this->minConfidence = minConfidence;
+	this->sinceDetection = 0;
+	this->lastConfidence = 1.0;
+	this->numFrames = 0;
+	this->numDetections = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//whether the coming frame should run detection
+//////////////////////////////////////////////////////////////////////////
+bool TrackingScheduler::detectNow()
+{
+	if (period>0&&sinceDetection+1>=period)
+		return true;
+	return lastConfidence<minConfidence;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//record how a frame was tracked; confidence is the tracker's flow
+//confidence after the frame
+//////////////////////////////////////////////////////////////////////////
+void TrackingScheduler::update(bool detected, double confidence)
+{
+	numFrames++;
+	if (detected)
+	{
+		numDetections++;
+		sinceDetection = 0;
+	}
+	else
+		sinceDetection++;
+	lastConfidence = confidence;
+}
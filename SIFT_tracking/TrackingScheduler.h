@@ -0,0 +1,29 @@
+#pragma once
+#include "Def.h"
+
+/*
+Decides on which frames the tracking loop runs full SIFT detection and
+template re-matching; the other frames only propagate the box with
+optical flow.  Detection runs every period frames and whenever the flow
+confidence of the previous frame fell below minConfidence.  A period of 1
+detects on every frame; a period of 0 or a minConfidence of 0 disables the
+respective trigger.
+*/
+class TrackingScheduler
+{
+public:
+	TrackingScheduler(int period = TRACKING_DETECT_PERIOD,
+		double minConfidence = TRACKING_DETECT_CONFIDENCE);
+	bool detectNow();
+	void update(bool detected, double confidence);
+	int getNumFrames(){return numFrames;};
+	int getNumDetections(){return numDetections;};
+
+private:
+	int period;
+	double minConfidence;
+	int sinceDetection;
+	double lastConfidence;
+	int numFrames;
+	int numDetections;
+};
@@ -0,0 +1,124 @@
+#include "StdAfx.h"
+#include "WindowPredictor.h"
+
+WindowPredictor::WindowPredictor(double gate, double margin)
+{
+	this->gate = gate;
+	this->margin = margin;
+	this->aspect = 1.0;
+	initFilter( &row, 0, 0, 0 );
+	initFilter( &col, 0, 0, 0 );
+	initFilter( &logSize, 0, 0, 0 );
+}
+
+void WindowPredictor::initFilter(Filter* f, double x, double sx, double sv)
+{
+	f->x = x;
+	f->v = 0;
+	f->pxx = sx * sx;
+	f->pxv = 0;
+	f->pvv = sv * sv;
+}
+
+/*
+Advances a filter by one frame.  The velocity is perturbed by a white
+acceleration of standard deviation accel.
+*/
+void WindowPredictor::predictFilter(Filter* f, double accel)
+{
+	double q = accel * accel;
+
+	f->x += f->v;
+	f->pxx += 2 * f->pxv + f->pvv + q / 4;
+	f->pxv += f->pvv + q / 2;
+	f->pvv += q;
+}
+
+/*
+Corrects a filter with a measurement of its value of standard deviation
+meas.
+*/
+void WindowPredictor::correctFilter(Filter* f, double z, double meas)
+{
+	double s = f->pxx + meas * meas, kx = f->pxx / s, kv = f->pxv / s, y = z - f->x;
+
+	f->x += kx * y;
+	f->v += kv * y;
+	f->pvv -= kv * f->pxv;
+	f->pxx *= 1 - kx;
+	f->pxv *= 1 - kx;
+}
+
+/*
+Starts the filters at a box with no motion.  The initial uncertainty makes
+the first window as wide as TRACKING_WINDOW_SIZE grows the box.
+
+@param box box in the current frame
+*/
+void WindowPredictor::init(Rect box)
+{
+	double sr = TRACKING_WINDOW_SIZE * box.height / gate;
+	double sc = TRACKING_WINDOW_SIZE * box.width / gate;
+
+	aspect = (double)box.height / MAX( 1, box.width );
+	initFilter( &row, box.upper + box.height / 2.0, sr, sr );
+	initFilter( &col, box.left + box.width / 2.0, sc, sc );
+	initFilter( &logSize, log( sqrt( (double)MAX( 1, box.height * box.width ) ) ),
+		KALMAN_SCALE_MEAS_NOISE, KALMAN_SCALE_MEAS_NOISE );
+}
+
+/*
+Corrects the filters with the box tracked in the current frame.
+
+@param box tracked box
+*/
+void WindowPredictor::correct(Rect box)
+{
+	aspect = (double)box.height / MAX( 1, box.width );
+	correctFilter( &row, box.upper + box.height / 2.0, KALMAN_MEAS_NOISE );
+	correctFilter( &col, box.left + box.width / 2.0, KALMAN_MEAS_NOISE );
+	correctFilter( &logSize, log( sqrt( (double)MAX( 1, box.height * box.width ) ) ),
+		KALMAN_SCALE_MEAS_NOISE );
+}
+
+/* box at the current prediction */
+Rect WindowPredictor::getPredictedBox()
+{
+	double s = exp( logSize.x ), h = s * sqrt( aspect ), w = s / sqrt( aspect );
+
+	return Rect( cvRound( row.x - h / 2 ), cvRound( col.x - w / 2 ),
+		MAX( 1, cvRound( h ) ), MAX( 1, cvRound( w ) ) );
+}
+
+/*
+Advances the filters to the next frame and computes its search window.
+
+@param window output as the search window, clamped to the image; the whole
+	image if the prediction left it
+@param wholeImage image rectangle
+*/
+void WindowPredictor::predict(Rect* window, Rect wholeImage)
+{
+	double s, h, w, grow, halfH, halfW;
+	int top, bottom, left, right;
+
+	predictFilter( &row, KALMAN_ACCEL_NOISE );
+	predictFilter( &col, KALMAN_ACCEL_NOISE );
+	predictFilter( &logSize, KALMAN_SCALE_NOISE );
+
+	s = exp( logSize.x );
+	h = s * sqrt( aspect );
+	w = s / sqrt( aspect );
+	grow = exp( gate * sqrt( logSize.pxx ) ) + 2 * margin;
+	halfH = h * grow / 2 + gate * sqrt( row.pxx );
+	halfW = w * grow / 2 + gate * sqrt( col.pxx );
+
+	top = MAX( wholeImage.upper, cvFloor( row.x - halfH ) );
+	bottom = MIN( wholeImage.upper + wholeImage.height, cvCeil( row.x + halfH ) );
+	left = MAX( wholeImage.left, cvFloor( col.x - halfW ) );
+	right = MIN( wholeImage.left + wholeImage.width, cvCeil( col.x + halfW ) );
+	if( bottom <= top  ||  right <= left )
+		*window = wholeImage;
+	else
+		*window = Rect( top, left, bottom - top, right - left );
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "Def.h"
+
+/*
+Predicts where the tracked box will be in the next frame and how sure
+that prediction is.  The box centre row, centre column and log size each
+follow an independent constant-velocity Kalman filter; the search window
+covers the predicted box plus KALMAN_GATE standard deviations of its
+position and size, so fast targets get a wide window and steady ones a
+tight one.
+*/
+class WindowPredictor
+{
+public:
+	WindowPredictor(double gate = KALMAN_GATE, double margin = TRACKING_WINDOW_MARGIN);
+	void init(Rect box);
+	void correct(Rect box);
+	void predict(Rect* window, Rect wholeImage);
+	Rect getPredictedBox();
+
+private:
+	/* one constant-velocity filter: value, velocity and their covariance */
+	struct Filter
+	{
+		double x;
+		double v;
+		double pxx;
+		double pxv;
+		double pvv;
+	};
+	static void initFilter(Filter* f, double x, double sx, double sv);
+	static void predictFilter(Filter* f, double accel);
+	static void correctFilter(Filter* f, double z, double meas);
+
+	double gate;
+	double margin;
+	double aspect;
+	Filter row;
+	Filter col;
+	Filter logSize;
+};
@@ -0,0 +1,57 @@
+#include "FrameView.h"
+#include "stdafx.h"
+
+FrameView::FrameView()
+{
+	m_shared = NULL;
+}
+
+FrameView::FrameView(IplImage* img, FrameRecycler* recycler)
+{
+	m_shared = NULL;
+	if (img == NULL)
+		return;
+
+	m_shared = new Shared;
+	m_shared->img = img;
+	m_shared->recycler = recycler;
+	m_shared->refs = 1;
+}
+
+FrameView::FrameView(const FrameView& view)
+{
+	m_shared = view.m_shared;
+	if (m_shared != NULL)
+		atomicAdd(&m_shared->refs, 1);
+}
+
+FrameView::~FrameView()
+{
+	release();
+}
+
+FrameView& FrameView::operator=(const FrameView& view)
+{
+	// take the new reference first, view may share our buffer
+	if (view.m_shared != NULL)
+		atomicAdd(&view.m_shared->refs, 1);
+	release();
+	m_shared = view.m_shared;
+	return *this;
+}
+
+void FrameView::release()
+{
+	if (m_shared == NULL)
+		return;
+
+	if (atomicAdd(&m_shared->refs, -1) == 0)
+	{
+		if (m_shared->recycler != NULL)
+			m_shared->recycler->recycle(m_shared->img);
+		else
+			cvReleaseImage(&m_shared->img);
+		delete m_shared;
+	}
+	m_shared = NULL;
+}
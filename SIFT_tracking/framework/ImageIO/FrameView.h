@@ -0,0 +1,47 @@
+#ifndef FRAME_VIEW_H
+#define FRAME_VIEW_H
+
+#include "opencv2\opencv.hpp"
+#include "Thread.h"
+
+// Takes back frame buffers whose last view went away.
+class FrameRecycler
+{
+public:
+	virtual ~FrameRecycler() {};
+	virtual void recycle(IplImage* img) = 0;
+};
+
+// Reference counted handle on a frame buffer. Copies share the buffer;
+// when the last one is gone the buffer goes back to its recycler, or is
+// released if it has none. The image is borrowed: it stays valid, and
+// unchanged, while any view of it lives. Views must not outlive the
+// recycler that made them.
+class FrameView
+{
+public:
+
+	FrameView();
+	explicit FrameView(IplImage* img, FrameRecycler* recycler = NULL);
+	FrameView(const FrameView& view);
+	~FrameView();
+	FrameView& operator=(const FrameView& view);
+
+	IplImage* get() const { return (m_shared != NULL) ? m_shared->img : NULL; };
+	bool empty() const { return m_shared == NULL; };
+	long getRefCount() const { return (m_shared != NULL) ? m_shared->refs : 0; };
+	void release();
+
+private:
+
+	struct Shared
+	{
+		IplImage* img;
+		FrameRecycler* recycler;
+		volatile long refs;
+	};
+
+	Shared* m_shared;
+};
+
+#endif //FRAME_VIEW_H
@@ -1,11 +1,11 @@
 #include "ImageHandler.h"
 #include "stdafx.h"
-ImageHandler::ImageHandler(ImageSource* imgSrc)
+ImageHandler::ImageHandler(ImageSource* imgSrc, ImagePool* pool)
 {
     this->m_imgSrc = imgSrc;
+    this->m_pool = (pool != NULL) ? pool : ImagePool::global();
     m_windowName = NULL;
-    m_grayImage = NULL;
-    m_rgbImage = NULL;
+    m_drawing = true;
 }
 
 
@@ -15,89 +15,80 @@ ImageHandler::~ImageHandler()
     {
         cvDestroyWindow(m_windowName);
     }
-
-    if (m_grayImage != NULL)
-    {
-        cvReleaseImage(&m_grayImage);
-    }
-    
-    if (m_rgbImage != NULL)
-    {
-        cvReleaseImage(&m_rgbImage);
-    }
 }
 
 
 bool ImageHandler::getImage()
 {
+    m_overlay.clear();
     m_imgSrc->getIplImage();
+    return updateFrame();
+}
 
-    // assign grayImage
-    if (m_grayImage != NULL)
-    {
-        cvReleaseImage(&m_grayImage);
-    }
 
-    if (m_rgbImage != NULL)
-    {
-        cvReleaseImage(&m_rgbImage);
-    }
+bool ImageHandler::getImage(const std::string& fileName)
+{
+    m_overlay.clear();
+    m_imgSrc->getIplImage(fileName);
+    return updateFrame();
+}
 
-    if (!m_imgSrc->isImageAvailable())
-    {
-        m_grayImage = NULL;
-        m_rgbImage = NULL;
-        return false;
-    }
 
-    if (m_imgSrc->curImage->nChannels > 1)
-    {
-        m_grayImage = cvCreateImage(cvGetSize(m_imgSrc->curImage), 8, 1);
-        cvCvtColor(m_imgSrc->curImage, m_grayImage, CV_RGB2GRAY);
-        m_rgbImage = cvCloneImage(m_imgSrc->curImage);
-    }
-    else
+// the buffer of view if nobody else views it and it has the given format,
+// else a pool buffer that view takes over; a full pool is waited out and
+// then the buffer comes from the heap, so this never fails
+IplImage* ImageHandler::writableBuffer(FrameView& view, CvSize size, int depth, int channels)
+{
+    IplImage* img = view.get();
+
+    if (img == NULL || view.getRefCount() > 1 || img->width != size.width ||
+        img->height != size.height || img->depth != depth || img->nChannels != channels)
     {
-        m_grayImage = cvCloneImage(m_imgSrc->curImage);
-        m_rgbImage = NULL;
+        view = m_pool->createViewWaiting(size, depth, channels, FRAME_POOL_WAIT_MS/1000.0);
+        img = view.get();
     }
-
-    return true;
+    return img;
 }
 
 
-bool ImageHandler::getImage(const std::string& fileName)
+// take the source's new frame and its gray version; buffers are only
+// allocated while an earlier frame is still viewed elsewhere
+bool ImageHandler::updateFrame()
 {
-    m_imgSrc->getIplImage(fileName);
-	
-    // assign grayImage
-    if (m_grayImage != NULL)
-    {
-        cvReleaseImage(&m_grayImage);
-    }
-
-    if (m_rgbImage != NULL)
-    {
-        cvReleaseImage(&m_rgbImage);
-    }
+    IplImage* frame;
+    IplImage* copy;
+    IplImage* gray;
+    FrameView view;
 
     if (!m_imgSrc->isImageAvailable())
     {
-        m_grayImage = NULL;
-        m_rgbImage = NULL;
+        m_frame.release();
+        m_gray.release();
         return false;
     }
 
-    if (m_imgSrc->curImage->nChannels > 1)
+    // prefetching sources keep the decoded frame apart from curImage
+    frame = m_imgSrc->curImage;
+    view = m_imgSrc->getFrameView();
+    if (!view.empty())
+        m_frame = view;
+    else
     {
-        m_grayImage = cvCreateImage(cvGetSize(m_imgSrc->curImage), 8, 1);
-        cvCvtColor(m_imgSrc->curImage, m_grayImage, CV_RGB2GRAY);
-        m_rgbImage = cvCloneImage(m_imgSrc->curImage);
+        // keep it from the painting done on curImage
+        copy = writableBuffer(m_frame, cvGetSize(frame), frame->depth, frame->nChannels);
+        cvCopy(frame, copy);
     }
+
+    view = m_imgSrc->getGrayView();
+    if (!view.empty())
+        m_gray = view;
     else
     {
-        m_grayImage = cvCloneImage(m_imgSrc->curImage);
-        m_rgbImage = NULL;
+        gray = writableBuffer(m_gray, cvGetSize(frame), 8, 1);
+        if (frame->nChannels > 1)
+            cvCvtColor(frame, gray, CV_RGB2GRAY);
+        else
+            cvCopy(frame, gray);
     }
 
     return true;
@@ -111,6 +102,7 @@ const char* ImageHandler::getFilename(int idx)
 
 void ImageHandler::reloadImage()
 {
+	m_overlay.clear();
 	m_imgSrc->reloadIplImage();
 }
 
@@ -130,6 +122,7 @@ void ImageHandler::viewImage(char* name, int autoresize)
     {
         cvResizeWindow(name, 75, 75/getImageSize().width*getImageSize().height);
     }
+    renderOverlay();
 	cvShowImage(name, m_imgSrc->curImage);
 	
 }
@@ -146,69 +139,135 @@ void ImageHandler::viewImage(char* name, int autoresize, int width, int height)
 
     cvResizeWindow(name, width, height);
     
+    renderOverlay();
     cvShowImage(name, m_imgSrc->curImage);
     
 }
 
 
 
+void ImageHandler::setDrawing(bool drawing)
+{
+    m_drawing = drawing;
+    if (!drawing)
+        m_overlay.clear();
+}
+
+
+void ImageHandler::addOverlay(Overlay::Kind kind, CvPoint pt1, CvPoint pt2, CvScalar color, int thickness)
+{
+    m_overlay.resize(m_overlay.size()+1);
+    Overlay& item = m_overlay.back();
+
+    item.kind = kind;
+    item.pt1 = pt1;
+    item.pt2 = pt2;
+    item.color = color;
+    item.thickness = thickness;
+}
+
+
+// draw the recorded overlay on the frame, in the order it was painted
+void ImageHandler::renderOverlay()
+{
+    IplImage* img = m_imgSrc->curImage;
+    CvFont font;
+
+    if (img != NULL)
+    {
+        for (int i = 0; i < (int)m_overlay.size(); i++)
+        {
+            const Overlay& item = m_overlay[i];
+            switch (item.kind)
+            {
+            case Overlay::RECTANGLE:
+                cvRectangle(img, item.pt1, item.pt2, item.color, item.thickness);
+                break;
+            case Overlay::LINE:
+                cvLine(img, item.pt1, item.pt2, item.color, item.thickness);
+                break;
+            case Overlay::CIRCLE:
+                cvCircle(img, item.pt1, item.radius, item.color, item.thickness);
+                break;
+            case Overlay::TEXT:
+                cvInitFont( &font, CV_FONT_VECTOR0, item.fontSize, item.fontSize, 0, 1, 20);
+                cvPutText(img, item.text.c_str(), item.pt1, &font, item.color);
+                break;
+            }
+        }
+    }
+    m_overlay.clear();
+}
+
+
 void ImageHandler::paintRectangle(CvRect rect, Color color, int thickness, bool filled)
 {
-	if(m_imgSrc->curImage != NULL)
+	if(m_drawing)
 	{
 	    CvPoint pt1 = { rect.x, rect.y };
         CvPoint pt2 = { rect.x + rect.width, rect.y + rect.height };
 
-		if(filled)
-			cvRectangle(m_imgSrc->curImage, pt1, pt2, CV_RGB(color.red, color.green, color.blue), CV_FILLED);
-		else
-		    cvRectangle(m_imgSrc->curImage, pt1, pt2, CV_RGB(color.red, color.green, color.blue), thickness);
+		addOverlay(Overlay::RECTANGLE, pt1, pt2, CV_RGB(color.red, color.green, color.blue), filled ? CV_FILLED : thickness);
 	}
 }
 
 
 void ImageHandler::paintRectangle(Rect rect, Color color, int thickness, bool filled)
 {
+	if (!m_drawing)
+		return;
+
 	CvPoint pt1 = { rect.left, rect.upper };
     CvPoint pt2 = { rect.left + rect.width, rect.upper + rect.height };
 
-    if(filled)
-		cvRectangle(m_imgSrc->curImage, pt1, pt2, CV_RGB(color.red, color.green, color.blue), CV_FILLED);
-	else
-	    cvRectangle(m_imgSrc->curImage, pt1, pt2, CV_RGB(color.red, color.green, color.blue), thickness);
+	addOverlay(Overlay::RECTANGLE, pt1, pt2, CV_RGB(color.red, color.green, color.blue), filled ? CV_FILLED : thickness);
 }
 
 void ImageHandler::paintCenter(Rect rect, Color color, int thickness)
 {
+	if (!m_drawing)
+		return;
+
 	CvPoint pt = { rect.left + floor(rect.width/2+0.5), rect.upper + floor(rect.height/2+0.5) };
 
-    cvRectangle(m_imgSrc->curImage, pt, pt, CV_RGB(color.red, color.green, color.blue), thickness*2);
+    addOverlay(Overlay::RECTANGLE, pt, pt, CV_RGB(color.red, color.green, color.blue), thickness*2);
 }
 
 void ImageHandler::paintLine(Point2D p1, Point2D p2, Color color, int thickness)
 {
+	if (!m_drawing)
+		return;
+
 	CvPoint pt1 = {p1.col, p1.row};
 	CvPoint pt2 = {p2.col, p2.row};
 
-	cvLine(m_imgSrc->curImage, pt1, pt2, CV_RGB(color.red, color.green, color.blue), thickness);
+	addOverlay(Overlay::LINE, pt1, pt2, CV_RGB(color.red, color.green, color.blue), thickness);
 }
 
 void ImageHandler::paintCircle(Point2D center, int radius, Color color, int thickness)
 {
+	if (!m_drawing)
+		return;
+
 	CvPoint cvCenter = {center.col, center.row};
-	cvCircle( m_imgSrc->curImage, cvCenter, radius, CV_RGB(color.red, color.green, color.blue), thickness);
+	addOverlay(Overlay::CIRCLE, cvCenter, cvCenter, CV_RGB(color.red, color.green, color.blue), thickness);
+	m_overlay.back().radius = radius;
 }
 
 void ImageHandler::paintPoint(Point2D center, Color color, int thickness)
 {
+	if (!m_drawing)
+		return;
+
 	CvPoint pt = { center.col, center.row };
-	cvRectangle(m_imgSrc->curImage, pt, pt, CV_RGB(color.red, color.green, color.blue), thickness*2);
+	addOverlay(Overlay::RECTANGLE, pt, pt, CV_RGB(color.red, color.green, color.blue), thickness*2);
 }
 
 void ImageHandler::saveImage(char* filename)
 {
 	if(m_imgSrc->curImage != NULL)
 	{
+		renderOverlay();
 		cvSaveImage(filename, m_imgSrc->curImage);
 	}
 }
@@ -229,7 +288,19 @@ CvSize ImageHandler::getImageCvSize()
 
 IplImage* ImageHandler::getIplGrayImage()
 {
-    return m_grayImage;
+    return m_gray.get();
+}
+
+
+FrameView ImageHandler::getFrame()
+{
+    return m_frame;
+}
+
+
+FrameView ImageHandler::getGrayFrame()
+{
+    return m_gray;
 }
 
 
@@ -238,88 +309,99 @@ IplImage* ImageHandler::getIplImage()
     if (m_imgSrc->curImage == NULL)
 		return NULL;
 
+	renderOverlay();
 	IplImage* get=cvCloneImage(m_imgSrc->curImage);
 
     return get;
 }
 
 
+IplImage* ImageHandler::getPaintedImage()
+{
+    renderOverlay();
+    return m_imgSrc->curImage;
+}
+
+
+bool ImageHandler::getPlanes(unsigned char* gray, unsigned char* red, unsigned char* green,
+    unsigned char* blue, float* grayF)
+{
+    if (m_imgSrc->curImage == NULL || m_frame.empty())
+        return false;
+
+    // gray frames give their gray as every channel
+    if (m_frame.get()->nChannels == 1)
+    {
+        if (red != NULL)
+            splitPlanes(m_gray.get(), red, NULL, NULL, NULL, NULL);
+        if (green != NULL)
+            splitPlanes(m_gray.get(), green, NULL, NULL, NULL, NULL);
+        if (blue != NULL)
+            splitPlanes(m_gray.get(), blue, NULL, NULL, NULL, NULL);
+    }
+    if (m_frame.get()->nChannels == 1 || (red == NULL && green == NULL && blue == NULL))
+        return splitPlanes(m_gray.get(), gray, NULL, NULL, NULL, grayF);
+    // frames are stored blue, green, red
+    return splitPlanes(m_frame.get(), gray, blue, green, red, grayF);
+}
+
+
+FrameView ImageHandler::getGrayFloatFrame()
+{
+    FrameView view;
+    IplImage* gray = m_gray.get();
+    IplImage* img;
+
+    if (m_imgSrc->curImage == NULL || gray == NULL)
+        return view;
+
+    view = m_pool->createView(cvGetSize(gray), IPL_DEPTH_32F, 1);
+    img = view.get();
+    if (img == NULL)
+        return view;
+    for (int y = 0; y < gray->height; y++)
+        splitRow((unsigned char*)gray->imageData + y*gray->widthStep, 1, gray->width,
+            NULL, NULL, NULL, NULL, (float*)(img->imageData + y*img->widthStep));
+    return view;
+}
+
+
 unsigned char* ImageHandler::getGrayImage()
 {
     if (m_imgSrc->curImage == NULL)
     {
         return NULL;
     }
-    int rows = m_grayImage->height;
-    int cols = m_grayImage->width;
-    int iplCols= m_grayImage->widthStep;
-    
-    unsigned char *dataCh = new unsigned char[rows*cols];
-    unsigned char *buffer = reinterpret_cast<unsigned char*>(m_grayImage->imageData);
+    unsigned char *dataCh = new unsigned char[m_gray.get()->height*m_gray.get()->width];
 
-	for(int i=0; i<rows; i++)
-    {
-        memcpy(dataCh+i*cols, buffer+i*iplCols, sizeof(unsigned char) * cols);
-    }
+    splitPlanes(m_gray.get(), dataCh, NULL, NULL, NULL, NULL);
     return dataCh;
 }
 
 unsigned char* ImageHandler::getB_Channel()
 {
    if (m_imgSrc->curImage == NULL){return NULL;}
-   int rows = m_rgbImage->height;
-   int cols = m_rgbImage->width;
-   int Area = rows*cols;
-   int iplCols= m_rgbImage->widthStep;
-   unsigned char *dataCh = new unsigned char[Area];
-   unsigned char *buffer = reinterpret_cast<unsigned char*>(m_rgbImage->imageData);
-   int DataPtr = 0;
-   for (int x=0; x<rows; x++){
-      for (int y=0; y<cols; y++){
-         dataCh[DataPtr] = buffer[(x*iplCols) + (3*y)];
-         DataPtr++;
-      }
-   }
+   unsigned char *dataCh = new unsigned char[m_frame.get()->height*m_frame.get()->width];
+
+   getPlanes(NULL, NULL, NULL, dataCh);
    return dataCh;
 }
 
 unsigned char* ImageHandler::getG_Channel()
 {
    if (m_imgSrc->curImage == NULL){return NULL;}
-   int rows = m_rgbImage->height;
-   int cols = m_rgbImage->width;
-   int Area = rows*cols;
-   int iplCols= m_rgbImage->widthStep;
-   int Offset = 1; // green channel offset
-   unsigned char *dataCh = new unsigned char[Area];
-   unsigned char *buffer = reinterpret_cast<unsigned char*>(m_rgbImage->imageData);
-   int DataPtr = 0;
-   for (int x=0; x<rows; x++) {
-      for (int y=0; y<cols; y++){
-         dataCh[DataPtr] = buffer[(x*iplCols) + 3*y + Offset];
-         DataPtr++;
-      }
-   }
+   unsigned char *dataCh = new unsigned char[m_frame.get()->height*m_frame.get()->width];
+
+   getPlanes(NULL, NULL, dataCh, NULL);
    return dataCh;
 }
 
 unsigned char* ImageHandler::getR_Channel()
 {
    if (m_imgSrc->curImage == NULL){return NULL;}
-   int rows = m_rgbImage->height;
-   int cols = m_rgbImage->width;
-   int Area = rows*cols;
-   int iplCols= m_rgbImage->widthStep;
-   int Offset = 2; // red channel offset
-   unsigned char *dataCh = new unsigned char[Area];
-   unsigned char *buffer = reinterpret_cast<unsigned char*>(m_rgbImage->imageData);
-   int DataPtr = 0;
-   for (int x=0; x<rows; x++) {
-      for (int y=0; y<cols; y++){
-         dataCh[DataPtr] = buffer[(x*iplCols) + 3*y + Offset];
-         DataPtr++;
-      }
-   }
+   unsigned char *dataCh = new unsigned char[m_frame.get()->height*m_frame.get()->width];
+
+   getPlanes(NULL, dataCh, NULL, NULL);
    return dataCh;
 }
 
@@ -331,25 +413,24 @@ double* ImageHandler::getGrayImageDb()
         return NULL;
     }
     
-    int rows = m_grayImage->height;
-    int cols = m_grayImage->width;
-    int iplCols= m_grayImage->widthStep;
-    
-    unsigned char *tmp = new unsigned char[rows*cols];
+    IplImage* gray = m_gray.get();
+    int rows = gray->height;
+    int cols = gray->width;
+    FrameView rowView = m_pool->createView(cvSize(cols, 1), IPL_DEPTH_32F, 1);
+    float* row = (rowView.get() != NULL) ? (float*)rowView.get()->imageData : new float[cols];
     double *data = new double[rows*cols];
 
     for(int i=0; i<rows; i++)
     {
-        memcpy (tmp+i*cols, m_grayImage->imageData+i*iplCols, sizeof(char)*cols);
+        splitRow((unsigned char*)gray->imageData + i*gray->widthStep, 1, cols, NULL, NULL, NULL, NULL, row);
+        for(int j=0; j<cols; j++)
+        {
+            data[i*cols+j] = row[j];
+        }
     }
 
-    for(int i=0; i<rows*cols; i++)
-    {
-        data[i] = (double)tmp[i];
-    }
-
-    delete[] tmp;
-
+    if (rowView.get() == NULL)
+        delete[] row;
     return data;
 }
 
@@ -383,17 +464,21 @@ unsigned char* ImageHandler::getRGBImage()
 
 void ImageHandler::putTextOnImage(char* text, Point2D org, Color color, float fontSize)
 {
-	CvFont font;
-	cvInitFont( &font, CV_FONT_VECTOR0, fontSize, fontSize, 0, 1, 20);
-	cvPutText( m_imgSrc->curImage, text, cvPoint(org.col,org.row), &font, cvScalar(color.blue,color.green,color.red) );
+	if (!m_drawing)
+		return;
+
+	CvPoint pt = cvPoint(org.col,org.row);
+	addOverlay(Overlay::TEXT, pt, pt, cvScalar(color.blue,color.green,color.red), 1);
+	m_overlay.back().fontSize = fontSize;
+	m_overlay.back().text = text;
 }
 
 
 void ImageHandler::saveROIofGrayImage(Rect rect, char* filename)
 {
-    int rowsImg = m_grayImage->height;
-    int coslImg = m_grayImage->width;
-    int iplColsImg = m_grayImage->widthStep;
+    int rowsImg = m_gray.get()->height;
+    int coslImg = m_gray.get()->width;
+    int iplColsImg = m_gray.get()->widthStep;
 
     // create patch IPL image
     IplImage *grayROIImage = 
@@ -410,7 +495,7 @@ void ImageHandler::saveROIofGrayImage(Rect rect, char* filename)
     for(int i=0; i<rect.height; i++)
     {
         memcpy (grayROIImage->imageData+i*iplColsROI, 
-            m_grayImage->imageData+i*iplColsImg+offset, sizeof(char)*colsROI);
+            m_gray.get()->imageData+i*iplColsImg+offset, sizeof(char)*colsROI);
     }
     
     cvSaveImage(filename,grayROIImage);
@@ -420,7 +505,7 @@ void ImageHandler::saveROIofGrayImage(Rect rect, char* filename)
 
 unsigned char* ImageHandler::getPatch(Rect rect)
 {
-    int iplCols = m_grayImage->widthStep;
+    int iplCols = m_gray.get()->widthStep;
     int rows = rect.height;
     int cols = rect.width;
 
@@ -430,7 +515,7 @@ unsigned char* ImageHandler::getPatch(Rect rect)
     
     for(int i=0; i<rect.height; i++)
     {
-        memcpy (patch+i*cols, m_grayImage->imageData+i*iplCols+offset, sizeof(char)*cols);
+        memcpy (patch+i*cols, m_gray.get()->imageData+i*iplCols+offset, sizeof(char)*cols);
     }
 
     return patch;
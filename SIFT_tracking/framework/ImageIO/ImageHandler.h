@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include "opencv2\opencv.hpp"
 #include "opencv2\highgui\highgui.hpp"
@@ -12,11 +13,14 @@
 #include "ImageSourceAny.h"
 #include "Regions.h"
 
+class ImagePool;
+
 class ImageHandler
 {
 public:
 
-	ImageHandler(ImageSource* imgSrc);
+	// frame buffers come from pool, the global pool if NULL
+	ImageHandler(ImageSource* imgSrc, ImagePool* pool = NULL);
 	virtual ~ImageHandler(void);
 
 	bool getImage();
@@ -31,18 +35,43 @@ public:
 		
 	void saveImage(char* filename);
 
+	// copy of the drawable frame; the caller releases it
 	IplImage* getIplImage();
+	// drawable frame as painted, borrowed until the next getImage
+	IplImage* getPaintedImage();
+	// gray frame, borrowed until the next getImage
 	IplImage* getIplGrayImage();
-
+	// frame as decoded and its gray version, unaffected by painting; the
+	// views keep their buffers alive and unchanged for as long as they live
+	FrameView getFrame();
+	FrameView getGrayFrame();
+
+    // planes of the decoded frame, width*height values each with packed
+    // rows, in one pass over it (see PlanarConvert.h); NULL skips a plane
+    bool getPlanes(unsigned char* gray, unsigned char* red, unsigned char* green,
+        unsigned char* blue, float* grayF = NULL);
+    // gray frame as float, in a pool buffer
+    FrameView getGrayFloatFrame();
+
+    // copies the caller deletes[]
     unsigned char* getGrayImage();
     unsigned char* getR_Channel();
     unsigned char* getG_Channel();
     unsigned char* getB_Channel();
 
+    // deprecated, getGrayFloatFrame() gives the same values without the
+    // copy; widens splitRow's float rows
     double* getGrayImageDb();
     double* getGrayImageDb2();
     unsigned char* getRGBImage();
 
+	// painting only records an overlay, drawn on the frame once it is
+	// viewed, saved or handed out; a new frame drops what was not drawn.
+	// With drawing off nothing is recorded, for runs nobody watches
+	void setDrawing(bool drawing);
+	bool isDrawing() { return m_drawing; };
+	void renderOverlay();
+
 	void paintRectangle(CvRect rect, Color color = Color(255,255,0), int thickness = 1, bool filled = false);
     void paintRectangle(Rect rect, Color color = Color(255,255,0), int thickness = 1, bool filled = false);
 	void paintCenter(Rect rect, Color color = Color(255,255,0), int thickness = 2);
@@ -58,11 +87,33 @@ public:
 
 private:
 
+    bool updateFrame();
+    IplImage* writableBuffer(FrameView& view, CvSize size, int depth, int channels);
+
  	ImageSource *m_imgSrc;
+    ImagePool *m_pool;
     char *m_windowName;
 
-    IplImage *m_grayImage;
-    IplImage *m_rgbImage;
+    FrameView m_frame;
+    FrameView m_gray;
+
+    struct Overlay
+    {
+        enum Kind {RECTANGLE, LINE, CIRCLE, TEXT};
+        Kind kind;
+        CvPoint pt1;
+        CvPoint pt2;
+        CvScalar color;
+        // line thickness, CV_FILLED for filled shapes
+        int thickness;
+        int radius;
+        float fontSize;
+        std::string text;
+    };
+    void addOverlay(Overlay::Kind kind, CvPoint pt1, CvPoint pt2, CvScalar color, int thickness);
+
+    bool m_drawing;
+    std::vector<Overlay> m_overlay;
 };
 
 #endif //IMAGE_HANDLER_H
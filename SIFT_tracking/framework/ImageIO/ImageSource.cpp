@@ -74,7 +74,31 @@ bool ImageSource::isImageAvailable()
     }
 }
 
+FrameView ImageSource::getFrameView()
+{
+	return FrameView();
+}
+
+FrameView ImageSource::getGrayView()
+{
+	return FrameView();
+}
+
 const char* ImageSource::getFilename(int idx)
 {
 	return "";
 }
+
+void ImageSource::setCurImage(const IplImage* frame)
+{
+	if (curImage != NULL && (frame == NULL || curImage->width != frame->width ||
+		curImage->height != frame->height || curImage->depth != frame->depth ||
+		curImage->nChannels != frame->nChannels))
+		cvReleaseImage(&curImage);
+	if (frame == NULL)
+		return;
+	if (curImage == NULL)
+		curImage = cvCloneImage(frame);
+	else
+		cvCopy(frame, curImage);
+}
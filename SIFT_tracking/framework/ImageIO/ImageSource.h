@@ -6,12 +6,13 @@
 #include "opencv2\highgui\highgui.hpp"
 #include "opencv2\opencv.hpp"
 #include "Regions.h"
+#include "FrameView.h"
 
 class ImageSource
 {
 public:
 
-	enum InputDevice {AVI, USB, DIRECTORY};
+	enum InputDevice {AVI, USB, DIRECTORY, Y4M};
 
 	IplImage *curImage;
 
@@ -23,6 +24,10 @@ public:
 
 	virtual void reloadIplImage();
 	virtual const char* getFilename(int idx=-1);
+	// views of the frame as decoded and of its gray version, for sources
+	// that keep them apart from the drawable curImage; empty otherwise
+	virtual FrameView getFrameView();
+	virtual FrameView getGrayView();
 
 	Size getImageSize();
 	CvSize getImageCvSize();
@@ -32,6 +37,10 @@ public:
 
 protected:
 
+	// copies frame into curImage, keeping curImage's buffer while width,
+	// height, depth and channels stay the same; NULL releases curImage
+	void setCurImage(const IplImage* frame);
+
 	char aviFilename[255 + 1];
 
 
@@ -28,15 +28,14 @@ ImageSourceAVIFile::~ImageSourceAVIFile()
 	{
 		cvReleaseCapture(&m_capture);
 	}
+	if (curImage != NULL)
+	{
+		cvReleaseImage(&curImage);
+	}
 }
 
 void ImageSourceAVIFile::getIplImage()
 {
-	if (curImage != NULL)
-    {
-        cvReleaseImage (&curImage);
-    }
-
 	cvGrabFrame(m_capture);
 	m_copyImg = cvRetrieveFrame(m_capture);
 
@@ -48,11 +47,13 @@ void ImageSourceAVIFile::getIplImage()
 			m_copyImg->origin = 0;
 		}
 		m_existImage = true;
-		curImage = cvCloneImage(m_copyImg);
 	}
 	else
 		m_existImage = false;
 
+	// curImage keeps its buffer while the frame format stays the same
+	setCurImage(m_copyImg);
+
 
 }
 
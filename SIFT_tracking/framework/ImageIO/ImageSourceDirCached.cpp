@@ -0,0 +1,279 @@
+#include "ImageSourceDirCached.h"
+#include "stdafx.h"
+#include <algorithm>
+
+ImageSourceDirCached::ImageSourceDirCached(const char* directory, const char* indexFile,
+	int numThreads, int ahead, size_t cacheBytes)
+	: m_decoders(numThreads)
+{
+	curImage = NULL;
+	m_dir = directory;
+	m_curFile = 0;
+	m_ahead = MAX(1, ahead);
+	m_cacheBytes = 0;
+	m_maxBytes = cacheBytes;
+	m_stopping = false;
+	m_numHits = 0;
+	m_numWaits = 0;
+
+	if (indexFile != NULL)
+	{
+		if (!readIndex(indexFile))
+			printf("cannot read index file %s\n", indexFile);
+	}
+	else if (!readIndex((m_dir + "/index.txt").c_str()))
+		listDirectory();
+}
+
+ImageSourceDirCached::~ImageSourceDirCached()
+{
+	// decodes still queued are skipped
+	m_mutex.lock();
+	m_stopping = true;
+	m_mutex.unlock();
+	m_decoders.wait();
+
+	m_frame.release();
+	if (curImage != NULL)
+		cvReleaseImage(&curImage);
+}
+
+// read the frame list from an index file; false if it cannot be opened
+bool ImageSourceDirCached::readIndex(const char* indexFile)
+{
+	FILE* file = fopen(indexFile, "r");
+	char line[MAX_PATH+64];
+	char name[MAX_PATH+1];
+	double timestamp;
+	int fields;
+
+	if (file == NULL)
+		return false;
+
+	m_fileNames.clear();
+	m_timestamps.clear();
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		if (line[0] == '#')
+			continue;
+		fields = sscanf(line, "%260s %lf", name, &timestamp);
+		if (fields < 1)
+			continue;
+		m_fileNames.push_back(name);
+		m_timestamps.push_back((fields == 2) ? timestamp : -1.0);
+	}
+	fclose(file);
+	return true;
+}
+
+// the image files of the directory in name order
+void ImageSourceDirCached::listDirectory()
+{
+	ImageSourceDir lister(m_dir.c_str());
+	const char* name;
+
+	m_fileNames.clear();
+	m_timestamps.clear();
+	for (int i = 0; i < lister.getNumImages(); i++)
+	{
+		name = lister.getFilename(i);
+		if (name != NULL && isImageFile(name))
+			m_fileNames.push_back(name);
+	}
+	std::sort(m_fileNames.begin(), m_fileNames.end());
+}
+
+bool ImageSourceDirCached::isImageFile(const std::string& name)
+{
+	static const char* extensions[] = {".jpg", ".jpeg", ".png", ".bmp", ".pgm", ".ppm", ".tif", ".tiff"};
+	std::string ext;
+	size_t dot = name.rfind('.');
+
+	if (dot == std::string::npos)
+		return false;
+	ext = name.substr(dot);
+	for (size_t i = 0; i < ext.size(); i++)
+		ext[i] = (char)tolower(ext[i]);
+	for (int i = 0; i < (int)(sizeof(extensions)/sizeof(extensions[0])); i++)
+		if (ext == extensions[i])
+			return true;
+	return false;
+}
+
+// queue the decoding of frames [first, first+count) that are neither
+// cached nor queued yet
+void ImageSourceDirCached::schedule(int first, int count)
+{
+	std::vector<DecodeJob*> jobs;
+	DecodeJob* job;
+	int last = MIN(first + count, (int)m_fileNames.size());
+
+	m_mutex.lock();
+	for (int idx = MAX(0, first); idx < last; idx++)
+	{
+		if (m_cache.find(idx) != m_cache.end())
+			continue;
+		m_cache[idx].ready = false;
+		m_cache[idx].bytes = 0;
+		job = new DecodeJob;
+		job->self = this;
+		job->idx = idx;
+		jobs.push_back(job);
+	}
+	m_mutex.unlock();
+
+	// without decoder threads the jobs run here, and they take the lock
+	for (int i = 0; i < (int)jobs.size(); i++)
+		m_decoders.submit(decodeTask, jobs[i]);
+}
+
+void ImageSourceDirCached::decodeTask(void* arg, int worker)
+{
+	DecodeJob* job = (DecodeJob*)arg;
+	ImageSourceDirCached* self = job->self;
+	IplImage* img = NULL;
+	bool stopping;
+
+	self->m_mutex.lock();
+	stopping = self->m_stopping;
+	self->m_mutex.unlock();
+
+	if (!stopping)
+		img = cvLoadImage((self->m_dir + "/" + self->m_fileNames[job->idx]).c_str(), -1);
+
+	self->m_mutex.lock();
+	self->store(job->idx, img);
+	self->m_decoded.broadcast();
+	self->m_mutex.unlock();
+	delete job;
+}
+
+// enter a decoded frame in the cache, newest in the LRU order; called
+// with m_mutex held. A frame that failed to load is cached as empty.
+void ImageSourceDirCached::store(int idx, IplImage* img)
+{
+	Entry& entry = m_cache[idx];
+
+	entry.image = FrameView(img);
+	entry.bytes = (img != NULL) ? img->imageSize : 0;
+	entry.ready = true;
+	m_lru.push_front(idx);
+	entry.lru = m_lru.begin();
+	m_cacheBytes += entry.bytes;
+	evict();
+}
+
+// drop the least recently read frames until the cache fits its bound,
+// always keeping the newest; views handed out keep their frames alive
+void ImageSourceDirCached::evict()
+{
+	int idx;
+
+	while (m_cacheBytes > m_maxBytes && m_lru.size() > 1)
+	{
+		idx = m_lru.back();
+		m_lru.pop_back();
+		m_cacheBytes -= m_cache[idx].bytes;
+		m_cache.erase(idx);
+	}
+}
+
+void ImageSourceDirCached::getIplImage()
+{
+	std::map<int, Entry>::iterator it;
+	FrameView view;
+	int idx = m_curFile;
+	bool waited = false;
+
+	if (idx < 0 || idx >= (int)m_fileNames.size())
+	{
+		present(FrameView());
+		return;
+	}
+
+	schedule(idx, m_ahead);
+	m_mutex.lock();
+	for (;;)
+	{
+		it = m_cache.find(idx);
+		if (it == m_cache.end())
+		{
+			// evicted before it was read, the cache is too small for the lookahead
+			m_mutex.unlock();
+			schedule(idx, 1);
+			m_mutex.lock();
+			continue;
+		}
+		if (it->second.ready)
+			break;
+		waited = true;
+		m_decoded.wait(m_mutex);
+	}
+	if (waited)
+		m_numWaits++;
+	else
+		m_numHits++;
+	m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+	view = it->second.image;
+	m_mutex.unlock();
+
+	present(view);
+	m_curFile++;
+}
+
+void ImageSourceDirCached::getIplImage(const std::string& fileName)
+{
+	std::vector<std::string>::iterator it;
+
+	it = std::find(m_fileNames.begin(), m_fileNames.end(), fileName);
+	if (it == m_fileNames.end())
+	{
+		present(FrameView());
+		return;
+	}
+	m_curFile = (int)(it - m_fileNames.begin());
+	getIplImage();
+}
+
+// make view the current frame, no frame if it is empty
+void ImageSourceDirCached::present(const FrameView& view)
+{
+	m_frame = view;
+	setCurImage(view.get());
+}
+
+void ImageSourceDirCached::reloadIplImage()
+{
+	if (curImage != NULL && !m_frame.empty())
+		cvCopy(m_frame.get(), curImage);
+}
+
+const char* ImageSourceDirCached::getFilename(int idx)
+{
+	if (idx >= (int)m_fileNames.size())
+		return NULL;
+	if (idx < 0)
+		idx = m_curFile - 1;
+	if (idx < 0)
+		return NULL;
+	return m_fileNames[idx].c_str();
+}
+
+double ImageSourceDirCached::getTimestamp(int idx)
+{
+	if (idx < 0)
+		idx = m_curFile - 1;
+	if (idx < 0 || idx >= (int)m_timestamps.size())
+		return -1.0;
+	return m_timestamps[idx];
+}
+
+FrameView ImageSourceDirCached::getFrameView()
+{
+	return m_frame;
+}
+
+void ImageSourceDirCached::reset()
+{
+	m_curFile = 0;
+}
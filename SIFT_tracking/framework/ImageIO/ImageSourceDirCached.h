@@ -0,0 +1,92 @@
+#ifndef IMAGE_SOURCE_DIR_CACHED_H
+#define IMAGE_SOURCE_DIR_CACHED_H
+
+#include "ImageSource.h"
+#include "Thread.h"
+#include <vector>
+#include <string>
+#include <map>
+#include <list>
+
+// Directory source that decodes the next frames on a thread pool while
+// the current one is tracked. Decoded frames are kept in a cache bounded
+// by bytes; the least recently read ones are dropped first, so going back
+// over recent frames (getIplImage(fileName), reset) costs no decoding.
+// Frames come from an index file if there is one, else from the image
+// files of the directory in name order. An index file has one frame per
+// line, a file name relative to the directory and an optional timestamp
+// in seconds; lines starting with '#' are skipped.
+class ImageSourceDirCached : public ImageSource
+{
+public:
+
+	// indexFile of NULL uses <directory>/index.txt if it exists;
+	// numThreads of 0 uses one decoder per core
+	ImageSourceDirCached(const char* directory, const char* indexFile = NULL,
+		int numThreads = 0, int ahead = 8, size_t cacheBytes = 256*1024*1024);
+	virtual ~ImageSourceDirCached();
+
+	void getIplImage();
+	void getIplImage(const std::string& fileName);
+	void reloadIplImage();
+	const char* getFilename(int idx=-1);
+	FrameView getFrameView();
+	virtual void reset();
+
+	int getNumImages() { return (int)m_fileNames.size(); };
+	// timestamp of frame idx (the current one if idx < 0), -1 if unknown
+	double getTimestamp(int idx=-1);
+	int getNumHits() { return m_numHits; };
+	int getNumWaits() { return m_numWaits; };
+	size_t getCacheBytes() { return m_cacheBytes; };
+
+private:
+
+	struct Entry
+	{
+		FrameView image;
+		size_t bytes;
+		bool ready;
+		std::list<int>::iterator lru;
+	};
+
+	struct DecodeJob
+	{
+		ImageSourceDirCached* self;
+		int idx;
+	};
+
+	bool readIndex(const char* indexFile);
+	void listDirectory();
+	void schedule(int first, int count);
+	void store(int idx, IplImage* img);
+	void evict();
+	void present(const FrameView& view);
+	static void decodeTask(void* arg, int worker);
+	static bool isImageFile(const std::string& name);
+
+	std::string m_dir;
+	std::vector<std::string> m_fileNames;
+	std::vector<double> m_timestamps;
+	int m_curFile;
+	int m_ahead;
+
+	// frame index -> decoded or pending frame; m_lru lists the decoded
+	// ones, most recently read first
+	std::map<int, Entry> m_cache;
+	std::list<int> m_lru;
+	size_t m_cacheBytes;
+	size_t m_maxBytes;
+	bool m_stopping;
+	int m_numHits;
+	int m_numWaits;
+	Mutex m_mutex;
+	Condition m_decoded;
+
+	ThreadPool m_decoders;
+
+	// frame as decoded; curImage is its drawable copy
+	FrameView m_frame;
+};
+
+#endif //IMAGE_SOURCE_DIR_CACHED_H
@@ -0,0 +1,236 @@
+#include "ImageSourcePrefetch.h"
+#include "stdafx.h"
+
+// pool of NULL takes the buffers from the global pool
+ImageSourcePrefetch::ImageSourcePrefetch(ImageSource* source, int depth, bool ownSource,
+	ImagePool* pool, DropPolicy policy)
+{
+	curImage = NULL;
+	m_pool = (pool != NULL) ? pool : ImagePool::global();
+	m_source = source;
+	m_ownSource = ownSource;
+	m_policy = policy;
+	// a mailbox of one frame for LATEST
+	m_depth = (policy == LATEST) ? 1 : MAX(1, depth);
+	m_stopping = false;
+	m_finished = false;
+	m_numStalls = 0;
+	m_numDropped = 0;
+	m_numFrames = 0;
+	m_latencySum = 0.0;
+	m_latencyMax = 0.0;
+	m_captureTime = 0.0;
+
+	start();
+}
+
+ImageSourcePrefetch::~ImageSourcePrefetch()
+{
+	stop();
+
+	if (curImage != NULL)
+		cvReleaseImage(&curImage);
+	m_frame.release();
+	m_gray.release();
+
+	if (m_ownSource)
+		delete m_source;
+}
+
+// copy the wrapped source's current image into frame and convert it to
+// gray; returns false if the source has no image. A full pool is waited
+// out, the buffers come from the heap if it stays full
+bool ImageSourcePrefetch::takeFrame(Frame* frame)
+{
+	IplImage* src = m_source->curImage;
+	const char* name;
+
+	if (src == NULL)
+		return false;
+
+	// the wrapped source may own or reuse its image, so keep a copy
+	frame->color = m_pool->createViewWaiting(cvGetSize(src), src->depth, src->nChannels,
+		FRAME_POOL_WAIT_MS/1000.0);
+	frame->gray = m_pool->createViewWaiting(cvGetSize(src), 8, 1, FRAME_POOL_WAIT_MS/1000.0);
+	cvCopy(src, frame->color.get());
+	frame->color.get()->origin = src->origin;
+	if (src->nChannels > 1)
+		cvCvtColor(src, frame->gray.get(), CV_RGB2GRAY);
+	else
+		cvCopy(src, frame->gray.get());
+
+	name = m_source->getFilename();
+	frame->name = (name != NULL) ? name : "";
+	frame->captureTime = wallTime();
+	return true;
+}
+
+void ImageSourcePrefetch::producerMain(void* arg)
+{
+	ImageSourcePrefetch* self = (ImageSourcePrefetch*)arg;
+	bool ok;
+
+	for (;;)
+	{
+		Frame frame;
+
+		// backpressure: decode no further ahead than the ring allows
+		self->m_mutex.lock();
+		while (self->m_policy == BLOCK && !self->m_stopping &&
+			(int)self->m_ring.size() >= self->m_depth)
+			self->m_notFull.wait(self->m_mutex);
+		if (self->m_stopping)
+		{
+			self->m_mutex.unlock();
+			return;
+		}
+		self->m_mutex.unlock();
+
+		self->m_source->getIplImage();
+		ok = self->takeFrame(&frame);
+
+		self->m_mutex.lock();
+		if (ok)
+		{
+			// the reader is behind: the new frame replaces the oldest one
+			while ((int)self->m_ring.size() >= self->m_depth)
+			{
+				self->m_ring.pop_front();
+				self->m_numDropped++;
+			}
+			self->m_ring.push_back(frame);
+		}
+		else
+			self->m_finished = true;
+		self->m_notEmpty.signal();
+		self->m_mutex.unlock();
+		if (!ok)
+			return;
+	}
+}
+
+void ImageSourcePrefetch::start()
+{
+	m_stopping = false;
+	m_finished = false;
+	m_thread.start(producerMain, this);
+}
+
+// stop the producer and drop the frames it decoded ahead
+void ImageSourcePrefetch::stop()
+{
+	m_mutex.lock();
+	m_stopping = true;
+	m_notFull.broadcast();
+	m_mutex.unlock();
+	m_thread.join();
+
+	m_ring.clear();
+}
+
+// make frame the current one; its buffers come back once the views of
+// this and earlier frames are gone
+void ImageSourcePrefetch::present(Frame* frame)
+{
+	double latency;
+
+	m_frame = frame->color;
+	m_gray = frame->gray;
+	m_curName = frame->name;
+
+	m_captureTime = frame->captureTime;
+	latency = wallTime() - frame->captureTime;
+	m_latencySum += latency;
+	m_latencyMax = MAX(m_latencyMax, latency);
+	m_numFrames++;
+
+	setCurImage(frame->color.get());
+}
+
+void ImageSourcePrefetch::getIplImage()
+{
+	Frame frame;
+	bool ok;
+
+	if (!m_thread.isRunning() && !m_finished)
+	{
+		// no background thread: decode on the caller's thread
+		m_source->getIplImage();
+		ok = takeFrame(&frame);
+		m_finished = !ok;
+	}
+	else
+	{
+		m_mutex.lock();
+		if (m_ring.empty() && !m_finished)
+			m_numStalls++;
+		while (m_ring.empty() && !m_finished)
+			m_notEmpty.wait(m_mutex);
+		ok = !m_ring.empty();
+		if (ok)
+		{
+			frame = m_ring.front();
+			m_ring.pop_front();
+			m_notFull.signal();
+		}
+		m_mutex.unlock();
+	}
+
+	if (ok)
+		present(&frame);
+	else
+	{
+		setCurImage(NULL);
+		m_frame.release();
+		m_gray.release();
+	}
+}
+
+void ImageSourcePrefetch::getIplImage(const std::string& fileName)
+{
+	Frame frame;
+
+	// a random access read restarts the prefetch behind the requested frame
+	stop();
+	m_source->getIplImage(fileName);
+	if (takeFrame(&frame))
+		present(&frame);
+	else
+	{
+		setCurImage(NULL);
+		m_frame.release();
+		m_gray.release();
+	}
+	start();
+}
+
+void ImageSourcePrefetch::reloadIplImage()
+{
+	if (curImage != NULL && !m_frame.empty())
+		cvCopy(m_frame.get(), curImage);
+}
+
+const char* ImageSourcePrefetch::getFilename(int idx)
+{
+	// the wrapped source is ahead of the reader; only its file list is safe
+	if (idx >= 0)
+		return m_source->getFilename(idx);
+	return m_curName.c_str();
+}
+
+FrameView ImageSourcePrefetch::getFrameView()
+{
+	return m_frame;
+}
+
+FrameView ImageSourcePrefetch::getGrayView()
+{
+	return m_gray;
+}
+
+void ImageSourcePrefetch::reset()
+{
+	stop();
+	m_source->reset();
+	start();
+}
@@ -0,0 +1,95 @@
+#ifndef IMAGE_SOURCE_PREFETCH_H
+#define IMAGE_SOURCE_PREFETCH_H
+
+#include "ImageSource.h"
+#include "Thread.h"
+#include <deque>
+
+class ImagePool;
+
+// Decodes the frames of another image source on a background thread, a
+// bounded number of frames ahead of the reader, so that decoding overlaps
+// the tracking of the current frame. The gray version of every frame is
+// computed on that thread too and handed to the ImageHandler. What the
+// thread does when the ring is full is the drop policy: BLOCK waits, for
+// files where every frame counts; DROP_OLDEST drops the oldest queued
+// frame and LATEST keeps only the newest one, for live sources where the
+// tracker must stay close to the camera. Every frame carries the time it
+// was captured, for measuring latency. Without threads (unknown OS) frames
+// are read on demand as before. Frame buffers come from an image pool and go
+// back to it once their views are gone; when the pool's cap leaves no room
+// for a frame, the thread waits for buffers to come back and then takes
+// them from the heap, so a full pool never ends the stream.
+class ImageSourcePrefetch : public ImageSource
+{
+public:
+
+	enum DropPolicy {BLOCK, DROP_OLDEST, LATEST};
+
+	ImageSourcePrefetch(ImageSource* source, int depth = 4, bool ownSource = true,
+		ImagePool* pool = NULL, DropPolicy policy = BLOCK);
+	virtual ~ImageSourcePrefetch();
+
+	void getIplImage();
+	void getIplImage(const std::string& fileName);
+	void reloadIplImage();
+	const char* getFilename(int idx=-1);
+	FrameView getFrameView();
+	FrameView getGrayView();
+	virtual void reset();
+
+	int getDepth() { return m_depth; };
+	DropPolicy getDropPolicy() { return m_policy; };
+	int getNumStalls() { return m_numStalls; };
+	int getNumDropped() { return m_numDropped; };
+	int getNumFrames() { return m_numFrames; };
+	// wallTime() at which the current frame was captured
+	double getCaptureTime() { return m_captureTime; };
+	// time frames spent between capture and getIplImage, in seconds
+	double getMeanQueueLatency() { return (m_numFrames > 0) ? m_latencySum/m_numFrames : 0.0; };
+	double getMaxQueueLatency() { return m_latencyMax; };
+
+private:
+
+	struct Frame
+	{
+		FrameView color;
+		FrameView gray;
+		std::string name;
+		double captureTime;
+	};
+
+	bool takeFrame(Frame* frame);
+	void present(Frame* frame);
+	void start();
+	void stop();
+	static void producerMain(void* arg);
+
+	ImageSource* m_source;
+	bool m_ownSource;
+	int m_depth;
+	DropPolicy m_policy;
+	std::deque<Frame> m_ring;
+	bool m_stopping;
+	bool m_finished;
+	int m_numStalls;
+	int m_numDropped;
+	int m_numFrames;
+	double m_latencySum;
+	double m_latencyMax;
+	double m_captureTime;
+	Thread m_thread;
+	Mutex m_mutex;
+	Condition m_notEmpty;
+	Condition m_notFull;
+
+	// pool of the frame buffers, shared with the views handed out
+	ImagePool* m_pool;
+
+	// frame as decoded, for reloadIplImage; curImage is its drawable copy
+	FrameView m_frame;
+	FrameView m_gray;
+	std::string m_curName;
+};
+
+#endif //IMAGE_SOURCE_PREFETCH_H
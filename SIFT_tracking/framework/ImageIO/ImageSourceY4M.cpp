@@ -0,0 +1,516 @@
+#include "ImageSourceY4M.h"
+#include "stdafx.h"
+
+#if OS_type==1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+
+ImageSourceY4M::ImageSourceY4M(const char* y4mFilename, ImagePool* pool)
+{
+	curImage = NULL;
+	m_filename = y4mFilename;
+	m_width = 0;
+	m_height = 0;
+	m_chroma = C420;
+	m_decoderOrder = false;
+	m_fullRange = false;
+	m_lumaLut = NULL;
+	m_chromaLut = NULL;
+	m_fpsNum = 0;
+	m_fpsDen = 0;
+	m_map = NULL;
+	m_fileSize = 0;
+#if OS_type==2
+	m_fileHandle = INVALID_HANDLE_VALUE;
+	m_mapHandle = NULL;
+#elif OS_type==1
+	m_fd = -1;
+#endif
+	m_file = NULL;
+	m_dataStart = 0;
+	m_next = 0;
+	m_curFrame = -1;
+	m_pool = (pool != NULL) ? pool : ImagePool::global();
+
+	if (!open())
+	{
+		printf("ERROR: cannot read Y4M file %s\n", y4mFilename);
+		close();
+	}
+}
+
+ImageSourceY4M::~ImageSourceY4M()
+{
+	m_frame.release();
+	m_gray.release();
+	if (curImage != NULL)
+		cvReleaseImage(&curImage);
+	if (m_lumaLut != NULL)
+		cvReleaseMat(&m_lumaLut);
+	if (m_chromaLut != NULL)
+		cvReleaseMat(&m_chromaLut);
+	close();
+}
+
+// map the file, or open it for reading if it cannot be mapped, and parse
+// the stream header
+bool ImageSourceY4M::open()
+{
+	char header[512];
+	char* end;
+	int len, i;
+
+#if OS_type==2
+	LARGE_INTEGER size;
+
+	m_fileHandle = CreateFileA(m_filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m_fileHandle != INVALID_HANDLE_VALUE && GetFileSizeEx(m_fileHandle, &size))
+	{
+		m_fileSize = (__uint64)size.QuadPart;
+		m_mapHandle = CreateFileMapping(m_fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_mapHandle != NULL)
+			m_map = (const unsigned char*)MapViewOfFile(m_mapHandle, FILE_MAP_READ, 0, 0, 0);
+	}
+#elif OS_type==1
+	struct stat st;
+	void* map;
+
+	m_fd = ::open(m_filename.c_str(), O_RDONLY);
+	if (m_fd >= 0 && fstat(m_fd, &st) == 0)
+	{
+		m_fileSize = (__uint64)st.st_size;
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, m_fd, 0);
+		if (map != MAP_FAILED)
+			m_map = (const unsigned char*)map;
+	}
+#endif
+
+	if (m_map == NULL)
+	{
+		m_file = fopen(m_filename.c_str(), "rb");
+		if (m_file == NULL)
+			return false;
+		fseek(m_file, 0, SEEK_END);
+		if (m_fileSize == 0)
+			m_fileSize = (__uint64)ftell(m_file);
+	}
+
+	len = readAt(0, header, sizeof(header) - 1);
+	header[MAX(0, len)] = '\0';
+	end = strchr(header, '\n');
+	if (end == NULL)
+		return false;
+	*end = '\0';
+	if (!parseHeader(header))
+		return false;
+
+	if (!m_fullRange)
+	{
+		// Y: 16-235 to 0-255, chroma: 16-240 around 128 to 0-255
+		m_lumaLut = cvCreateMat(1, 256, CV_8UC1);
+		m_chromaLut = cvCreateMat(1, 256, CV_8UC1);
+		for (i = 0; i < 256; i++)
+		{
+			m_lumaLut->data.ptr[i] = (uchar)MIN(255, MAX(0, cvRound((i - 16)*255.0/219)));
+			m_chromaLut->data.ptr[i] = (uchar)MIN(255, MAX(0, cvRound((i - 128)*255.0/224 + 128)));
+		}
+	}
+
+	m_dataStart = (__uint64)(end - header) + 1;
+	m_next = m_dataStart;
+	return true;
+}
+
+// read size, frame rate, chroma layout and sample range from the stream
+// header line; untagged clips are limited range unless convertAVI wrote them
+bool ImageSourceY4M::parseHeader(const char* header)
+{
+	std::string params(header);
+	std::string tag;
+	size_t pos = 0, next;
+	bool limited = false;
+
+	if (params.compare(0, 10, "YUV4MPEG2 ") != 0)
+		return false;
+
+	while (pos < params.size())
+	{
+		next = params.find(' ', pos);
+		if (next == std::string::npos)
+			next = params.size();
+		tag = params.substr(pos, next - pos);
+		pos = next + 1;
+		if (tag.empty())
+			continue;
+
+		switch (tag[0])
+		{
+		case 'W':
+			m_width = atoi(tag.c_str() + 1);
+			break;
+		case 'H':
+			m_height = atoi(tag.c_str() + 1);
+			break;
+		case 'F':
+			sscanf(tag.c_str() + 1, "%d:%d", &m_fpsNum, &m_fpsDen);
+			break;
+		case 'C':
+			if (tag == "Cmono")
+				m_chroma = MONO;
+			else if (tag == "C444")
+				m_chroma = C444;
+			else if (tag.compare(0, 4, "C420") == 0)
+				m_chroma = C420;
+			else
+			{
+				printf("ERROR: Y4M chroma %s is not supported\n", tag.c_str());
+				return false;
+			}
+			break;
+		case 'X':
+			if (tag == "XSOURCE=CONVERTAVI")
+				m_decoderOrder = true;
+			else if (tag == "XCOLORRANGE=FULL")
+				m_fullRange = true;
+			else if (tag == "XCOLORRANGE=LIMITED")
+				limited = true;
+			break;
+		}
+	}
+	if (m_decoderOrder && !limited)
+		m_fullRange = true;
+	return m_width > 0 && m_height > 0;
+}
+
+void ImageSourceY4M::close()
+{
+#if OS_type==2
+	if (m_map != NULL)
+		UnmapViewOfFile(m_map);
+	if (m_mapHandle != NULL)
+		CloseHandle(m_mapHandle);
+	if (m_fileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(m_fileHandle);
+	m_mapHandle = NULL;
+	m_fileHandle = INVALID_HANDLE_VALUE;
+#elif OS_type==1
+	if (m_map != NULL)
+		munmap((void*)m_map, (size_t)m_fileSize);
+	if (m_fd >= 0)
+		::close(m_fd);
+	m_fd = -1;
+#endif
+	m_map = NULL;
+	if (m_file != NULL)
+		fclose(m_file);
+	m_file = NULL;
+	m_dataStart = 0;
+}
+
+// copy up to len bytes at offset into buf; returns the number copied
+int ImageSourceY4M::readAt(__uint64 offset, void* buf, int len)
+{
+	if (offset >= m_fileSize)
+		return 0;
+	if (offset + len > m_fileSize)
+		len = (int)(m_fileSize - offset);
+
+	if (m_map != NULL)
+	{
+		memcpy(buf, m_map + offset, len);
+		return len;
+	}
+#if OS_type==2
+	_fseeki64(m_file, (__int64)offset, SEEK_SET);
+#elif OS_type==1
+	fseeko(m_file, (off_t)offset, SEEK_SET);
+#else
+	fseek(m_file, (long)offset, SEEK_SET);
+#endif
+	return (int)fread(buf, 1, len, m_file);
+}
+
+// check the frame header at offset and find the frame's data; false at
+// the end of the stream or if the frame is cut off
+bool ImageSourceY4M::frameHeader(__uint64 offset, __uint64* data)
+{
+	char header[128];
+	char* end;
+	int len, area = m_width*m_height;
+	__uint64 frameBytes = area;
+
+	if (m_chroma == C420)
+		frameBytes += 2*((m_width+1)/2)*((m_height+1)/2);
+	else if (m_chroma == C444)
+		frameBytes += 2*area;
+
+	len = readAt(offset, header, sizeof(header) - 1);
+	header[MAX(0, len)] = '\0';
+	if (len < 6 || strncmp(header, "FRAME", 5) != 0)
+		return false;
+	end = (char*)memchr(header, '\n', len);
+	if (end == NULL)
+		return false;
+
+	*data = offset + (end - header) + 1;
+	return *data + frameBytes <= m_fileSize;
+}
+
+// a plane of the file: a header on the mapping, or a pool image the
+// plane is read into; NULL if the pool has no room
+IplImage* ImageSourceY4M::plane(__uint64 offset, CvSize size)
+{
+	IplImage* img;
+
+	if (m_map != NULL)
+	{
+		img = cvCreateImageHeader(size, IPL_DEPTH_8U, 1);
+		cvSetData(img, (void*)(m_map + offset), size.width);
+		return img;
+	}
+
+	img = m_pool->create(size, IPL_DEPTH_8U, 1);
+	if (img != NULL)
+		for (int r = 0; r < size.height; r++)
+			readAt(offset + (__uint64)r*size.width, img->imageData + r*img->widthStep, size.width);
+	return img;
+}
+
+void ImageSourceY4M::releasePlane(IplImage** img)
+{
+	if (*img == NULL)
+		return;
+	if (m_map != NULL)
+		cvReleaseImageHeader(img);
+	else
+		m_pool->release(img);
+}
+
+// the last view of a Y plane is gone
+void ImageSourceY4M::recycle(IplImage* img)
+{
+	releasePlane(&img);
+}
+
+void ImageSourceY4M::getIplImage()
+{
+	CvSize size = cvSize(m_width, m_height);
+	CvSize csize = size;
+	IplImage* gray;
+	IplImage* luma;
+	IplImage* chroma[2] = {NULL, NULL};
+	IplImage* full[2] = {NULL, NULL};
+	IplImage* ycrcb = NULL;
+	IplImage* color = NULL;
+	__uint64 data, next;
+	bool ok = true;
+	int i;
+
+	if (!isOpen() || !frameHeader(m_next, &data))
+	{
+		endOfStream();
+		return;
+	}
+
+	next = data + (__uint64)m_width*m_height;
+	gray = plane(data, size);
+	if (gray != NULL && m_lumaLut != NULL)
+	{
+		// expanded into a pool copy, the mapping is read only
+		luma = gray;
+		gray = m_pool->create(size, IPL_DEPTH_8U, 1);
+		if (gray != NULL)
+			cvLUT(luma, gray, m_lumaLut);
+		releasePlane(&luma);
+	}
+	if (gray == NULL)
+	{
+		endOfStream();
+		return;
+	}
+	if (m_lumaLut != NULL)
+		m_gray = FrameView(gray, m_pool);
+	else
+		m_gray = FrameView(gray, this);
+
+	if (m_chroma == MONO)
+		m_frame = m_gray;
+	else
+	{
+		if (m_chroma == C420)
+			csize = cvSize((m_width+1)/2, (m_height+1)/2);
+		// Cb then Cr, upsampled to the frame size for 4:2:0 and expanded
+		// to full range for limited range clips
+		for (i = 0; i < 2 && ok; i++)
+		{
+			chroma[i] = plane(next, csize);
+			next += (__uint64)csize.width*csize.height;
+			if (chroma[i] != NULL && (m_chroma == C420 || m_chromaLut != NULL))
+			{
+				full[i] = m_pool->create(size, IPL_DEPTH_8U, 1);
+				if (full[i] != NULL && m_chroma == C420)
+				{
+					cvResize(chroma[i], full[i], CV_INTER_LINEAR);
+					if (m_chromaLut != NULL)
+						cvLUT(full[i], full[i], m_chromaLut);
+				}
+				else if (full[i] != NULL)
+					cvLUT(chroma[i], full[i], m_chromaLut);
+			}
+			ok = chroma[i] != NULL && (full[i] != NULL || (m_chroma != C420 && m_chromaLut == NULL));
+		}
+		if (ok)
+		{
+			ycrcb = m_pool->create(size, IPL_DEPTH_8U, 3);
+			color = m_pool->create(size, IPL_DEPTH_8U, 3);
+			ok = ycrcb != NULL && color != NULL;
+		}
+		if (ok)
+		{
+			if (full[0] != NULL)
+				cvMerge(gray, full[1], full[0], NULL, ycrcb);
+			else
+				cvMerge(gray, chroma[1], chroma[0], NULL, ycrcb);
+			// undoes convertAVI's conversion, or converts standard chroma to BGR
+			cvCvtColor(ycrcb, color, m_decoderOrder ? CV_YCrCb2RGB : CV_YCrCb2BGR);
+			m_frame = FrameView(color, m_pool);
+		}
+		else
+			m_pool->release(&color);
+
+		for (i = 0; i < 2; i++)
+		{
+			releasePlane(&chroma[i]);
+			m_pool->release(&full[i]);
+		}
+		m_pool->release(&ycrcb);
+		if (!ok)
+		{
+			endOfStream();
+			return;
+		}
+	}
+
+	setCurImage(m_frame.get());
+
+	m_next = next;
+	m_curFrame++;
+}
+
+void ImageSourceY4M::endOfStream()
+{
+	m_frame.release();
+	m_gray.release();
+	setCurImage(NULL);
+}
+
+void ImageSourceY4M::reloadIplImage()
+{
+	if (curImage != NULL && !m_frame.empty())
+		cvCopy(m_frame.get(), curImage);
+}
+
+const char* ImageSourceY4M::getFilename(int idx)
+{
+	return m_filename.c_str();
+}
+
+FrameView ImageSourceY4M::getFrameView()
+{
+	return m_frame;
+}
+
+FrameView ImageSourceY4M::getGrayView()
+{
+	return m_gray;
+}
+
+void ImageSourceY4M::reset()
+{
+	m_next = m_dataStart;
+	m_curFrame = -1;
+}
+
+void ImageSourceY4M::writePlane(FILE* file, const IplImage* img)
+{
+	for (int r = 0; r < img->height; r++)
+		fwrite(img->imageData + r*img->widthStep, 1, img->width, file);
+}
+
+int ImageSourceY4M::convertAVI(const char* aviFilename, const char* y4mFilename, bool grayOnly)
+{
+	ImageSourceAVIFile avi(aviFilename);
+	IplImage* frame = avi.curImage;
+	IplImage* gray;
+	IplImage* ycrcb = NULL;
+	IplImage* cr = NULL;
+	IplImage* cb = NULL;
+	CvSize size;
+	FILE* out;
+	double fps;
+	int n = 0;
+
+	if (!avi.isImageAvailable() || frame == NULL)
+		return -1;
+	out = fopen(y4mFilename, "wb");
+	if (out == NULL)
+		return -1;
+
+	size = cvGetSize(frame);
+	fps = avi.getFrameRate();
+	fprintf(out, "YUV4MPEG2 W%d H%d F%d:1000 Ip A1:1 %s XCOLORRANGE=FULL XSOURCE=CONVERTAVI\n", size.width, size.height,
+		(fps > 0) ? cvRound(fps*1000) : 25000, grayOnly ? "Cmono" : "C444");
+
+	gray = cvCreateImage(size, IPL_DEPTH_8U, 1);
+	if (!grayOnly)
+	{
+		ycrcb = cvCreateImage(size, IPL_DEPTH_8U, 3);
+		cr = cvCreateImage(size, IPL_DEPTH_8U, 1);
+		cb = cvCreateImage(size, IPL_DEPTH_8U, 1);
+	}
+
+	for (; avi.curImage != NULL; avi.getIplImage())
+	{
+		frame = avi.curImage;
+		// a clip has one frame size
+		if (frame->width != size.width || frame->height != size.height)
+			break;
+
+		if (frame->nChannels > 1)
+			cvCvtColor(frame, gray, CV_RGB2GRAY);
+		else
+			cvCopy(frame, gray);
+		fputs("FRAME\n", out);
+		writePlane(out, gray);
+
+		if (!grayOnly)
+		{
+			if (frame->nChannels > 1)
+			{
+				cvCvtColor(frame, ycrcb, CV_RGB2YCrCb);
+				cvSplit(ycrcb, NULL, cr, cb, NULL);
+			}
+			else
+			{
+				cvSet(cr, cvScalarAll(128));
+				cvSet(cb, cvScalarAll(128));
+			}
+			writePlane(out, cb);
+			writePlane(out, cr);
+		}
+		n++;
+	}
+
+	fclose(out);
+	cvReleaseImage(&gray);
+	if (!grayOnly)
+	{
+		cvReleaseImage(&ycrcb);
+		cvReleaseImage(&cr);
+		cvReleaseImage(&cb);
+	}
+	return n;
+}
@@ -0,0 +1,102 @@
+#ifndef IMAGE_SOURCE_Y4M_H
+#define IMAGE_SOURCE_Y4M_H
+
+#include "ImageSource.h"
+#include <vector>
+#include <string>
+
+class ImagePool;
+
+// Reads uncompressed YUV4MPEG2 (.y4m) clips through a memory mapping of
+// the file, for replaying the same clip many times without decoding it.
+// The gray view is the Y plane of the mapping itself, no copy and no
+// color conversion; the color frame is converted from Y, Cb and Cr into
+// a pool buffer in BGR order. Mono, 4:2:0 and 4:4:4 clips are read. Clips
+// tagged XCOLORRANGE=LIMITED, and untagged clips from other tools, hold
+// 16-235 samples and are expanded to full range; their gray view is then
+// a pool copy of the Y plane. If the file cannot be mapped (e.g. it is
+// larger than the address space), frames are read into pool buffers.
+//
+// convertAVI() writes clips from videos for this reader only. Its Y plane
+// comes from the same conversion as ImageHandler's gray image, so the gray
+// frames of a clip and of its source video are identical, and its chroma
+// from CV_RGB2YCrCb on the frame in decoder channel order. Neither is the
+// standard BT.601 conversion of the picture: other players show such a
+// clip with wrong colors. The clips are tagged XSOURCE=CONVERTAVI and read
+// back with the inverse conversion; clips from other tools hold standard
+// chroma and are converted as such.
+class ImageSourceY4M : public ImageSource, public FrameRecycler
+{
+public:
+
+	// pool of NULL takes color buffers from the global pool
+	ImageSourceY4M(const char* y4mFilename, ImagePool* pool = NULL);
+	virtual ~ImageSourceY4M();
+
+	void getIplImage();
+	void reloadIplImage();
+	const char* getFilename(int idx=-1);
+	FrameView getFrameView();
+	FrameView getGrayView();
+	virtual void reset();
+	void recycle(IplImage* img);
+
+	bool isOpen() { return m_dataStart > 0; };
+	bool isMapped() { return m_map != NULL; };
+	int getCurrentFrameIndex() { return m_curFrame; };
+	double getFrameRate() { return (m_fpsDen > 0) ? (double)m_fpsNum/m_fpsDen : 0.0; };
+
+	// writes the frames of a video as a Y4M clip, 4:4:4 or gray only;
+	// returns the number of frames written, or -1 if a file cannot be opened
+	static int convertAVI(const char* aviFilename, const char* y4mFilename, bool grayOnly = false);
+
+private:
+
+	enum Chroma {MONO, C420, C444};
+
+	bool open();
+	bool parseHeader(const char* header);
+	void close();
+	int readAt(__uint64 offset, void* buf, int len);
+	bool frameHeader(__uint64 offset, __uint64* data);
+	IplImage* plane(__uint64 offset, CvSize size);
+	void releasePlane(IplImage** img);
+	void endOfStream();
+	static void writePlane(FILE* file, const IplImage* img);
+
+	std::string m_filename;
+	int m_width;
+	int m_height;
+	Chroma m_chroma;
+	// chroma of the frames in decoder channel order, as convertAVI writes it
+	bool m_decoderOrder;
+	// 0-255 samples rather than 16-235 (Y) and 16-240 (chroma)
+	bool m_fullRange;
+	// expand limited range Y and chroma to full range; NULL if full range
+	CvMat* m_lumaLut;
+	CvMat* m_chromaLut;
+	int m_fpsNum;
+	int m_fpsDen;
+
+	// mapping of the whole file, or the file read with stdio
+	const unsigned char* m_map;
+	__uint64 m_fileSize;
+#if OS_type==2
+	HANDLE m_fileHandle;
+	HANDLE m_mapHandle;
+#elif OS_type==1
+	int m_fd;
+#endif
+	FILE* m_file;
+
+	__uint64 m_dataStart;
+	__uint64 m_next;
+	int m_curFrame;
+
+	ImagePool* m_pool;
+	// frame as converted and the Y plane; curImage is the drawable copy
+	FrameView m_frame;
+	FrameView m_gray;
+};
+
+#endif //IMAGE_SOURCE_Y4M_H
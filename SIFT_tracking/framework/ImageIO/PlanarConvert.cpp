@@ -0,0 +1,171 @@
+#include "PlanarConvert.h"
+#include "stdafx.h"
+
+#if SIFT_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+// cvCvtColor's gray weights, scaled by 2^14
+#define GRAY_SHIFT 14
+#define GRAY_W0 4899
+#define GRAY_W1 9617
+#define GRAY_W2 1868
+
+#if SIFT_USE_SSE2
+
+// gray of 8 pixels, widened to 16 bits, as two vectors of 4 ints
+static inline void gray8(__m128i v0, __m128i v1, __m128i v2, __m128i* lo, __m128i* hi)
+{
+    const __m128i w01 = _mm_set1_epi32((GRAY_W1 << 16) | GRAY_W0);
+    const __m128i w2r = _mm_set1_epi32(((1 << (GRAY_SHIFT-1)) << 16) | GRAY_W2);
+    const __m128i one = _mm_set1_epi16(1);
+
+    *lo = _mm_srai_epi32(_mm_add_epi32(
+        _mm_madd_epi16(_mm_unpacklo_epi16(v0, v1), w01),
+        _mm_madd_epi16(_mm_unpacklo_epi16(v2, one), w2r)), GRAY_SHIFT);
+    *hi = _mm_srai_epi32(_mm_add_epi32(
+        _mm_madd_epi16(_mm_unpackhi_epi16(v0, v1), w01),
+        _mm_madd_epi16(_mm_unpackhi_epi16(v2, one), w2r)), GRAY_SHIFT);
+}
+
+// gray of 16 pixels given by their channels
+static inline void gray16(__m128i c0, __m128i c1, __m128i c2, unsigned char* gray, float* grayF)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i g0, g1, g2, g3;
+
+    gray8(_mm_unpacklo_epi8(c0, zero), _mm_unpacklo_epi8(c1, zero), _mm_unpacklo_epi8(c2, zero), &g0, &g1);
+    gray8(_mm_unpackhi_epi8(c0, zero), _mm_unpackhi_epi8(c1, zero), _mm_unpackhi_epi8(c2, zero), &g2, &g3);
+    if (gray != NULL)
+        _mm_storeu_si128((__m128i*)gray, _mm_packus_epi16(_mm_packs_epi32(g0, g1), _mm_packs_epi32(g2, g3)));
+    if (grayF != NULL)
+    {
+        _mm_storeu_ps(grayF, _mm_cvtepi32_ps(g0));
+        _mm_storeu_ps(grayF+4, _mm_cvtepi32_ps(g1));
+        _mm_storeu_ps(grayF+8, _mm_cvtepi32_ps(g2));
+        _mm_storeu_ps(grayF+12, _mm_cvtepi32_ps(g3));
+    }
+}
+
+// one round of the deinterleaving network, interleaving the bytes of a[k]
+// with those of a[k+3]
+static inline void unpackRound(__m128i* a)
+{
+    __m128i b[6];
+
+    b[0] = _mm_unpacklo_epi8(a[0], a[3]);
+    b[1] = _mm_unpackhi_epi8(a[0], a[3]);
+    b[2] = _mm_unpacklo_epi8(a[1], a[4]);
+    b[3] = _mm_unpackhi_epi8(a[1], a[4]);
+    b[4] = _mm_unpacklo_epi8(a[2], a[5]);
+    b[5] = _mm_unpackhi_epi8(a[2], a[5]);
+    for (int k = 0; k < 6; k++)
+        a[k] = b[k];
+}
+
+// 32 interleaved 3 channel pixels (96 bytes) into their channels; five
+// rounds leave channel k of pixels 0-15 in a[2k] and of 16-31 in a[2k+1]
+static inline void deinterleave32(const unsigned char* src, __m128i* a)
+{
+    for (int k = 0; k < 6; k++)
+        a[k] = _mm_loadu_si128((const __m128i*)(src + 16*k));
+    for (int r = 0; r < 5; r++)
+        unpackRound(a);
+}
+
+#endif
+
+void splitRow(const unsigned char* src, int channels, int n, unsigned char* gray,
+    unsigned char* c0, unsigned char* c1, unsigned char* c2, float* grayF)
+{
+    int x = 0;
+
+    if (channels == 1)
+    {
+        if (gray != NULL)
+            memcpy(gray, src, n);
+        if (grayF != NULL)
+        {
+#if SIFT_USE_SSE2
+            const __m128i zero = _mm_setzero_si128();
+            __m128i v, lo, hi;
+            for (; x + 16 <= n; x += 16)
+            {
+                v = _mm_loadu_si128((const __m128i*)(src + x));
+                lo = _mm_unpacklo_epi8(v, zero);
+                hi = _mm_unpackhi_epi8(v, zero);
+                _mm_storeu_ps(grayF+x, _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)));
+                _mm_storeu_ps(grayF+x+4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)));
+                _mm_storeu_ps(grayF+x+8, _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)));
+                _mm_storeu_ps(grayF+x+12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)));
+            }
+#endif
+            for (; x < n; x++)
+                grayF[x] = (float)src[x];
+        }
+        return;
+    }
+
+#if SIFT_USE_SSE2
+    __m128i a[6];
+    for (; x + 32 <= n; x += 32)
+    {
+        deinterleave32(src + 3*x, a);
+        if (c0 != NULL)
+        {
+            _mm_storeu_si128((__m128i*)(c0+x), a[0]);
+            _mm_storeu_si128((__m128i*)(c0+x+16), a[1]);
+        }
+        if (c1 != NULL)
+        {
+            _mm_storeu_si128((__m128i*)(c1+x), a[2]);
+            _mm_storeu_si128((__m128i*)(c1+x+16), a[3]);
+        }
+        if (c2 != NULL)
+        {
+            _mm_storeu_si128((__m128i*)(c2+x), a[4]);
+            _mm_storeu_si128((__m128i*)(c2+x+16), a[5]);
+        }
+        if (gray != NULL || grayF != NULL)
+        {
+            gray16(a[0], a[2], a[4], (gray != NULL) ? gray+x : NULL, (grayF != NULL) ? grayF+x : NULL);
+            gray16(a[1], a[3], a[5], (gray != NULL) ? gray+x+16 : NULL, (grayF != NULL) ? grayF+x+16 : NULL);
+        }
+    }
+#endif
+    for (; x < n; x++)
+    {
+        const unsigned char* p = src + 3*x;
+        int g = (p[0]*GRAY_W0 + p[1]*GRAY_W1 + p[2]*GRAY_W2 + (1 << (GRAY_SHIFT-1))) >> GRAY_SHIFT;
+
+        if (c0 != NULL)
+            c0[x] = p[0];
+        if (c1 != NULL)
+            c1[x] = p[1];
+        if (c2 != NULL)
+            c2[x] = p[2];
+        if (gray != NULL)
+            gray[x] = (unsigned char)g;
+        if (grayF != NULL)
+            grayF[x] = (float)g;
+    }
+}
+
+bool splitPlanes(const IplImage* img, unsigned char* gray, unsigned char* c0,
+    unsigned char* c1, unsigned char* c2, float* grayF)
+{
+    int offset;
+
+    if (img == NULL || img->depth != IPL_DEPTH_8U || (img->nChannels != 1 && img->nChannels != 3))
+        return false;
+
+    for (int y = 0; y < img->height; y++)
+    {
+        offset = y*img->width;
+        splitRow((const unsigned char*)img->imageData + y*img->widthStep, img->nChannels, img->width,
+            (gray != NULL) ? gray+offset : NULL, (c0 != NULL) ? c0+offset : NULL,
+            (c1 != NULL) ? c1+offset : NULL, (c2 != NULL) ? c2+offset : NULL,
+            (grayF != NULL) ? grayF+offset : NULL);
+    }
+    return true;
+}
@@ -0,0 +1,24 @@
+#ifndef PLANAR_CONVERT_H
+#define PLANAR_CONVERT_H
+
+#include "opencv2\opencv.hpp"
+
+// Splits interleaved 8 bit frames into planes in a single pass: the three
+// channels in memory order (c0, c1, c2), the gray image and the gray image
+// as float, any of them at once. Gray weights c0, c1 and c2 by 0.299,
+// 0.587 and 0.114 in the fixed point arithmetic of cvCvtColor with
+// CV_RGB2GRAY, so it equals the handler's gray frame to the last bit; the
+// float plane holds the same values. Frames with one channel are gray
+// already and only fill gray and grayF. Planes not wanted are NULL. The
+// loop runs 32 pixels at a time with SSE2 where SIFT_USE_SSE2 is set.
+
+// one row of n pixels
+void splitRow(const unsigned char* src, int channels, int n, unsigned char* gray,
+    unsigned char* c0, unsigned char* c1, unsigned char* c2, float* grayF);
+
+// the whole frame into planes of width*height values with packed rows;
+// false if the frame is not 8 bit with 1 or 3 channels
+bool splitPlanes(const IplImage* img, unsigned char* gray, unsigned char* c0,
+    unsigned char* c1, unsigned char* c2, float* grayF);
+
+#endif //PLANAR_CONVERT_H
@@ -62,6 +62,33 @@ static __inline float pixval32f( IplImage* img, int r, int c )
 {
 	return ( (float*)(img->imageData + img->widthStep*r) )[c];
 }
+/**
+A function to get a pixel value from a 16-bit signed image.
+
+@param img an image
+@param r row
+@param c column
+@return Returns the value of the pixel at (\a r, \a c) in \a img
+*/
+static __inline int pixval16s( IplImage* img, int r, int c )
+{
+	return ( (short*)(img->imageData + img->widthStep*r) )[c];
+}
+
+
+/**
+A function to set a pixel value in a 16-bit signed image.
+
+@param img an image
+@param r row
+@param c column
+@param val pixel value
+*/
+static __inline void setpix16s( IplImage* img, int r, int c, short val )
+{
+	( (short*)(img->imageData + img->widthStep*r) )[c] = val;
+}
+
 static __inline float pixval8U(IplImage* img, int r, int c )
 {
 	return ( (unsigned char*)(img->imageData + img->widthStep*r) )[c];
@@ -248,9 +275,4 @@ extern int win_closed( char* name );
 
 double descr_dist_sq( struct SIFT_feature_unit* f1, struct SIFT_feature_unit* f2 );
 void ModifyTrackingWindows(Rect &trackintRect ,Rect* trackingwindow,Rect WholeImageSize);
-/*
-For optical flow
-*/
-Point2D partial(IplImage* ipIm,Point2D p);
-Point2D getOptFlow(IplImage* currentFrame,Point2D p,IplImage* preFrame);
 #endif
@@ -22,9 +22,14 @@
 #include "ImageRepresentation.h"
 #include "ImageSource.h"
 #include "ImageSourceDir.h"
+#include "ImageSourceDirCached.h"
 #include "ImageHandler.h"
+#include "PlanarConvert.h"
 #include "ImageSourceUSBCam.h"
 #include "ImageSourceAVIFile.h"
+#include "ImageSourceY4M.h"
+#include "ImageSourcePrefetch.h"
+#include "ImagePool.h"
 //#include "imgfeatures.h"
 //#include "sift.h"
 //#include "utils.h"
@@ -32,6 +37,11 @@
 #include "SIFTBoostingTracker.h"
 #include "SIFT_navie_tracker.h"
 #include "SIFT_opt_tracker.h"
+#include "WindowPredictor.h"
+#include "TrackingScheduler.h"
+#include "MultiTargetTracker.h"
+#include "ResultWriter.h"
+#include "BatchRunner.h"
 #include "kdtree.h"
 #include "minpq.h"
 
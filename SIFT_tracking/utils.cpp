@@ -411,59 +411,3 @@ void ModifyTrackingWindows(Rect &trackingRect ,Rect* TrackingWindow,Rect WholeIm
 		TrackingWindow->width-=abs(TrackingWindow->left+TrackingWindow->width-WholeImageSize.width);
 	}
 }
-
-//////////////////////////////////////////////////////////////////////////
-//For optical flow
-//////////////////////////////////////////////////////////////////////////
-
-//////////////////////////////////////////////////////////////////////////
-//caculate the partial of the point p in image ipim
-//note that the return Point2D,Vx=v.col,Vy = v.row
-//////////////////////////////////////////////////////////////////////////
-Point2D partial(IplImage* ipIm,Point2D p)
-{
-	Point2D v;
-	v.dcol = (pixval8U(ipIm,p.row,p.col+1)-pixval8U(ipIm,p.row,p.col-1))/2.0;
-	v.drow = (pixval8U(ipIm,p.row+1,p.col)-pixval8U(ipIm,p.row-1,p.col))/2.0;
-	return v;
-}
-
-//////////////////////////////////////////////////////////////////////////
-//caculate A
-//////////////////////////////////////////////////////////////////////////
-
-Point2D getOptFlow(IplImage* currentFrame,Point2D p,IplImage* preFrame)
-{
-	Point2D temp;
-	double b[2];
-	b[0]=0;b[1]=0;
-	
-	double M11=0,M12=0,M22=0;
-	for(int i = -OPTICAL_FLOW_POINT_AREA/2; i < OPTICAL_FLOW_POINT_AREA/2; i++)
-	{
-		for (int j = -OPTICAL_FLOW_POINT_AREA/2;j < OPTICAL_FLOW_POINT_AREA/2;j++)
-		{
-			temp = partial(currentFrame,Point2D(p.row+i,p.col+j));
-			M11 += temp.dcol*temp.dcol;
-			M12 += temp.dcol*temp.drow;
-			M22 += temp.drow*temp.drow;
-			b[0] += temp.dcol*(pixval8U(currentFrame,p.row+i,p.col+j)-pixval8U(preFrame,p.row+i,p.col+j));
-			b[1] += temp.drow*(pixval8U(currentFrame,p.row+i,p.col+j)-pixval8U(preFrame,p.row+i,p.col+j));
-		}
-	}
-	double a[] = {M11,M12,M12,M22};
-	CvMat M=cvMat(2, 2, CV_64FC1, a);
-	CvMat *Mi = cvCloneMat(&M);
-	cvInvert(&M,Mi,CV_SVD);
-	temp.col=0;
-	temp.row=0;
-	b[0] = -b[0];
-	b[1] = -b[1];
-	CvMat Mb = cvMat(2,1,CV_64FC1,b);
-	CvMat *Mr = cvCloneMat(&Mb);
-	cvMatMul( Mi, &Mb, Mr);
-	double vy = (cvmGet(Mr,1,0));
-	double vx = (cvmGet(Mr,0,0));
-	
-	return (Point2D(vy,vx));
-}
\ No newline at end of file